@@ -0,0 +1,111 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "adjacencygraph.h"
+#include "linetypes/modelobject.h"
+
+void AdjacencyGraph::clear()
+{
+	m_edges.clear();
+	m_objectEdges.clear();
+}
+
+/*
+ * Adds the edges of an object to the graph, replacing the edges that it had before.
+ */
+void AdjacencyGraph::insert(LDObject* object)
+{
+	remove(object);
+	const int count = object->numVertices();
+
+	if (count == 0)
+		return;
+
+	QVector<LineSegment>& objectEdges = m_objectEdges[object];
+	const bool isBoundary = (object->type() == LDObjectType::EdgeLine);
+
+	for (int i = 0; i < count; i += 1)
+	{
+		LineSegment segment {object->vertex(i), object->vertex((i + 1) % count)};
+
+		// An edge line goes along the same edge in both directions.
+		if (objectEdges.contains(segment))
+			continue;
+
+		objectEdges.append(segment);
+		Edge& edge = m_edges[segment];
+
+		if (isBoundary)
+			edge.boundaryCount += 1;
+		else
+			edge.objects.append(object);
+	}
+}
+
+/*
+ * Returns the objects that share an edge with the given object, and are not separated from it by an edge line. An
+ * object that shares several edges is returned several times.
+ */
+QVector<LDObject*> AdjacencyGraph::neighbours(LDObject* object) const
+{
+	QVector<LDObject*> result;
+
+	for (const LineSegment& segment : m_objectEdges.value(object))
+	{
+		auto iterator = m_edges.find(segment);
+
+		if (iterator != m_edges.end() and iterator->boundaryCount == 0)
+		{
+			for (LDObject* neighbour : iterator->objects)
+			{
+				if (neighbour != object)
+					result.append(neighbour);
+			}
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Removes the edges of an object from the graph.
+ */
+void AdjacencyGraph::remove(LDObject* object)
+{
+	auto iterator = m_objectEdges.find(object);
+
+	if (iterator == m_objectEdges.end())
+		return;
+
+	for (const LineSegment& segment : *iterator)
+	{
+		auto edgeIterator = m_edges.find(segment);
+
+		if (edgeIterator == m_edges.end())
+			continue;
+
+		// Edge lines are only counted.
+		if (not edgeIterator->objects.removeOne(object))
+			edgeIterator->boundaryCount -= 1;
+
+		if (edgeIterator->objects.isEmpty() and edgeIterator->boundaryCount == 0)
+			m_edges.erase(edgeIterator);
+	}
+
+	m_objectEdges.erase(iterator);
+}
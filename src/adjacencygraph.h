@@ -0,0 +1,49 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QHash>
+#include "main.h"
+#include "geometry/linesegment.h"
+
+class LDObject;
+
+/*
+ * The edges that the objects of a model share, for finding the neighbours of a polygon without going through the whole
+ * model. The objects take part with their own vertices only, subfiles are not looked into.
+ *
+ * Edges that an edge line runs along separate the objects on either side of them, so they connect nothing.
+ */
+class AdjacencyGraph
+{
+public:
+	void clear();
+	void insert(LDObject* object);
+	QVector<LDObject*> neighbours(LDObject* object) const;
+	void remove(LDObject* object);
+
+private:
+	struct Edge
+	{
+		QVector<LDObject*> objects;
+		int boundaryCount = 0; // Edge lines along this edge
+	};
+
+	QHash<LineSegment, Edge> m_edges;
+	QHash<LDObject*, QVector<LineSegment>> m_objectEdges;
+};
@@ -0,0 +1,262 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include "batchmode.h"
+#include "documentmanager.h"
+#include "lddocument.h"
+#include "parser.h"
+
+static const QMap<QString, BatchMode::Command> commandNames = {
+	{"errors", BatchMode::ReportErrors},
+	{"triangles", BatchMode::CountTriangles},
+	{"inline", BatchMode::InlineDeep},
+	{"header", BatchMode::ValidateHeaders},
+};
+
+BatchMode::BatchMode(QObject* parent) :
+	QObject {parent} {}
+
+/*
+ * Returns whether the command line asks for batch mode. This has to be known before the application object is
+ * created, since batch mode must not create one that needs a display.
+ */
+bool BatchMode::isRequested(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i += 1)
+	{
+		if (std::strcmp(argv[i], "--batch") == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Parses the command line, opens the files and runs the command on each of them. Returns the exit status.
+ */
+int BatchMode::run(const QStringList& arguments)
+{
+	QCommandLineParser parser;
+	QCommandLineOption batchOption {"batch", tr("Runs without a user interface.")};
+	QCommandLineOption outputOption {
+		QStringList {"o", "output"},
+		tr("Writes the files of the inline command into <directory>."),
+		tr("directory")
+	};
+	parser.setApplicationDescription(tr("Processes LDraw files without a user interface."));
+	parser.addHelpOption();
+	parser.addOption(batchOption);
+	parser.addOption(outputOption);
+	parser.addPositionalArgument("command", tr("One of: %1.").arg(commandNames.keys().join(", ")));
+	parser.addPositionalArgument("files", tr("The LDraw files to process."), tr("files..."));
+	parser.process(arguments);
+
+	QStringList positionalArguments = parser.positionalArguments();
+
+	if (positionalArguments.size() < 2 or not commandNames.contains(positionalArguments.first()))
+	{
+		fprint(stderr, "%1\n", parser.helpText());
+		return 2;
+	}
+
+	Command command = commandNames.value(positionalArguments.takeFirst());
+	m_outputDirectory = parser.value(outputOption);
+
+	if (command == InlineDeep and m_outputDirectory.isEmpty())
+	{
+		fprint(stderr, tr("The inline command needs an output directory.\n"));
+		return 2;
+	}
+
+	DocumentManager documents;
+	QVector<LDDocument*> loadedDocuments = documents.openDocuments(positionalArguments, true);
+	int problems = 0;
+	m_totalTriangles = 0;
+
+	for (int i = 0; i < loadedDocuments.size(); i += 1)
+	{
+		LDDocument* document = loadedDocuments[i];
+
+		if (document == nullptr)
+		{
+			fprint(stderr, tr("%1: could not be opened\n"), positionalArguments[i]);
+			problems += 1;
+			continue;
+		}
+
+		switch (command)
+		{
+		case ReportErrors:
+			problems += reportErrors(document);
+			break;
+
+		case CountTriangles:
+			problems += countTriangles(document);
+			break;
+
+		case InlineDeep:
+			problems += inlineDeep(documents, document);
+			break;
+
+		case ValidateHeaders:
+			problems += validateHeader(document);
+			break;
+		}
+	}
+
+	if (command == CountTriangles)
+		fprint(stdout, tr("total: %1\n"), m_totalTriangles);
+
+	return (problems > 0) ? 1 : 0;
+}
+
+/*
+ * Prints the lines of the document that could not be parsed. Returns the amount of them.
+ */
+int BatchMode::reportErrors(LDDocument* document)
+{
+	int count = 0;
+
+	for (LDObject* object : document->objects())
+	{
+		if (object->type() == LDObjectType::Error)
+		{
+			LDError* error = static_cast<LDError*>(object);
+			fprint(stdout, "%1: %2: %3\n", document->fullPath(), error->reason(), error->contents());
+			count += 1;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Prints the amount of triangles of the document. References that cannot be resolved count as problems, since their
+ * triangles are missing from the count.
+ */
+int BatchMode::countTriangles(LDDocument* document)
+{
+	int missingSubfiles = 0;
+
+	for (LDObject* object : document->objects())
+	{
+		if (object->type() == LDObjectType::SubfileReference
+			and static_cast<LDSubfileReference*>(object)->fileInfo(document->documentManager()) == nullptr)
+		{
+			fprint(stderr, tr("%1: missing subfile %2\n"), document->fullPath(),
+				static_cast<LDSubfileReference*>(object)->referenceName());
+			missingSubfiles += 1;
+		}
+	}
+
+	int count = document->triangleCount();
+	m_totalTriangles += count;
+	fprint(stdout, "%1: %2\n", document->fullPath(), count);
+	return missingSubfiles;
+}
+
+/*
+ * Writes the document into the output directory with every subfile reference replaced by the contents of the subfile.
+ */
+int BatchMode::inlineDeep(DocumentManager& documents, LDDocument* document)
+{
+	QString path = QDir {m_outputDirectory}.filePath(QFileInfo {document->fullPath()}.fileName());
+
+	if (QFileInfo {path} == QFileInfo {document->fullPath()})
+	{
+		fprint(stderr, tr("%1: refusing to overwrite the input file\n"), document->fullPath());
+		return 1;
+	}
+
+	// The flat document is not registered with the manager, so that it cannot be mistaken for the original.
+	Model inlined {&documents};
+	document->inlineContents(inlined, true, false);
+	LDDocument flatDocument {&documents};
+	flatDocument.history()->setIgnoring(true);
+	flatDocument.header = document->header;
+	flatDocument.setWinding(document->winding());
+	flatDocument.merge(inlined);
+
+	if (not flatDocument.save(path))
+	{
+		fprint(stderr, tr("%1: could not be written\n"), path);
+		return 1;
+	}
+
+	fprint(stdout, "%1 -> %2\n", document->fullPath(), path);
+	return 0;
+}
+
+/*
+ * Prints the problems of the header of the document, following the header specification of the LDraw library.
+ * Returns the amount of them. The header is read from the file again, since opening the document replaces its name
+ * with that of the file.
+ */
+int BatchMode::validateHeader(LDDocument* document)
+{
+	QFile file {document->fullPath()};
+
+	if (not file.open(QIODevice::ReadOnly))
+	{
+		fprint(stderr, tr("%1: could not be opened\n"), document->fullPath());
+		return 1;
+	}
+
+	Parser parser {file};
+	Winding winding = NoWinding;
+	const LDHeader header = parser.parseHeader(winding);
+	QStringList problems;
+
+	if (header.type == LDHeader::NoHeader)
+	{
+		problems.append(tr("no !LDRAW_ORG line"));
+	}
+	else
+	{
+		QString name = QString {header.name}.replace("\\", "/");
+		QString fileName = QFileInfo {file}.fileName();
+
+		if (header.description.isEmpty())
+			problems.append(tr("no description"));
+
+		if (name.isEmpty())
+			problems.append(tr("no name"));
+		else if (QFileInfo {name}.fileName().compare(fileName, Qt::CaseInsensitive) != 0)
+			problems.append(tr("name %1 does not match the file name %2").arg(header.name, fileName));
+
+		if (header.author.isEmpty())
+			problems.append(tr("no author"));
+
+		if (header.license == LDHeader::UnspecifiedLicense)
+			problems.append(tr("no license"));
+
+		if (winding == NoWinding)
+			problems.append(tr("not BFC certified"));
+	}
+
+	for (const QString& problem : problems)
+		fprint(stdout, "%1: %2\n", document->fullPath(), problem);
+
+	return problems.size();
+}
@@ -0,0 +1,60 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QObject>
+#include <QStringList>
+#include "main.h"
+
+class DocumentManager;
+class LDDocument;
+
+/*
+ * Runs LDForge from the command line without a user interface, so that it needs neither a display nor a GL context.
+ * The files are opened in parallel by a document manager of its own, which resolves their references against the
+ * configured libraries, and are then processed by one of the commands below. The exit status is non-zero if any file
+ * could not be opened or any problem was reported.
+ */
+class BatchMode : public QObject
+{
+	Q_OBJECT
+
+public:
+	enum Command
+	{
+		ReportErrors,    // Lists the lines that could not be parsed
+		CountTriangles,  // Counts the triangles of the files, subfiles included
+		InlineDeep,      // Writes the files with every subfile inlined
+		ValidateHeaders, // Lists the problems of the headers of the files
+	};
+
+	BatchMode(QObject* parent = nullptr);
+
+	int run(const QStringList& arguments);
+
+	static bool isRequested(int argc, char* argv[]);
+
+private:
+	int reportErrors(LDDocument* document);
+	int countTriangles(LDDocument* document);
+	int inlineDeep(DocumentManager& documents, LDDocument* document);
+	int validateHeader(LDDocument* document);
+
+	QString m_outputDirectory;
+	int m_totalTriangles = 0;
+};
@@ -0,0 +1,272 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QFile>
+#include <QThread>
+#include <QThreadPool>
+#include "documentloader.h"
+#include "documentmanager.h"
+#include "parser.h"
+
+enum
+{
+	// Lines parsed by the worker before the objects are handed over to the document.
+	BatchSize = 2000,
+};
+
+/*
+ * Parses the file in a worker thread into a model of its own, and hands the objects over to the loader after every
+ * batch of lines.
+ */
+class DocumentLoader::Worker : public QRunnable
+{
+public:
+	Worker(DocumentLoader* loader) :
+		m_loader {loader} {}
+
+	void run() override
+	{
+		QFile file {m_loader->m_path};
+
+		if (not file.open(QIODevice::ReadOnly))
+		{
+			m_loader->postFailure(file.errorString());
+			return;
+		}
+
+		Model model {m_loader->m_manager};
+		Parser parser {file};
+		Winding winding = NoWinding;
+		LDHeader header = parser.parseHeader(winding);
+		m_loader->postHeader(header, winding);
+
+		parser.parseBody(model, BatchSize, [&](Model& batch, qreal progress)
+		{
+			m_loader->postBatch(batch.takeObjects(), progress);
+			return not m_loader->isCancelled();
+		});
+
+		m_loader->postFinish();
+	}
+
+private:
+	DocumentLoader* const m_loader;
+};
+
+DocumentLoader::DocumentLoader(LDDocument* document, const QString& path, QObject* parent) :
+	QObject {parent},
+	m_document {document},
+	m_manager {document->documentManager()},
+	m_path {path},
+	m_threadPool {new QThreadPool {this}},
+	m_preloader {new SubfilePreloader {m_manager, this}}
+{
+	m_threadPool->setMaxThreadCount(1);
+	connect(m_preloader, &SubfilePreloader::finished, this, &DocumentLoader::insertPreloadedBatch);
+}
+
+DocumentLoader::~DocumentLoader()
+{
+	cancel();
+	m_threadPool->waitForDone();
+
+	for (const Batch& batch : m_batches)
+		qDeleteAll(batch.objects);
+
+	if (m_isPreloading)
+		qDeleteAll(m_preloadingBatch.objects);
+}
+
+/*
+ * Starts loading the document.
+ */
+void DocumentLoader::start()
+{
+	m_threadPool->start(new Worker {this});
+}
+
+/*
+ * Stops loading the document. The worker stops at the end of its current batch, and the objects that have not been
+ * added to the document yet are discarded.
+ */
+void DocumentLoader::cancel()
+{
+	m_isCancelled = true;
+}
+
+LDDocument* DocumentLoader::document() const
+{
+	return m_document;
+}
+
+QString DocumentLoader::errorString() const
+{
+	return m_errorString;
+}
+
+bool DocumentLoader::hasFailed() const
+{
+	return m_hasFailed;
+}
+
+bool DocumentLoader::isCancelled() const
+{
+	return m_isCancelled;
+}
+
+/*
+ * The following are called by the worker thread.
+ */
+void DocumentLoader::postHeader(const LDHeader& header, Winding winding)
+{
+	QMutexLocker locker {&m_mutex};
+	m_header = header;
+	m_winding = winding;
+	m_hasHeader = true;
+	schedule();
+}
+
+void DocumentLoader::postBatch(const QVector<LDObject*>& objects, qreal progress)
+{
+	// The objects were created in the worker thread, move them over to the loader.
+	for (LDObject* object : objects)
+		object->moveToThread(thread());
+
+	QMutexLocker locker {&m_mutex};
+	m_batches.enqueue({objects, progress});
+	schedule();
+}
+
+void DocumentLoader::postFailure(const QString& errorString)
+{
+	QMutexLocker locker {&m_mutex};
+	m_errorString = errorString;
+	m_hasFailed = true;
+	m_isWorkerDone = true;
+	schedule();
+}
+
+void DocumentLoader::postFinish()
+{
+	QMutexLocker locker {&m_mutex};
+	m_isWorkerDone = true;
+	schedule();
+}
+
+/*
+ * Makes the event loop of the loader process what the worker has posted. The mutex must be locked.
+ */
+void DocumentLoader::schedule()
+{
+	if (not m_isScheduled)
+	{
+		m_isScheduled = true;
+		QMetaObject::invokeMethod(this, "processPending", Qt::QueuedConnection);
+	}
+}
+
+/*
+ * Applies the header and at most one batch of objects to the document, and defers the rest to the event loop so that
+ * the interface stays responsive between batches.
+ */
+void DocumentLoader::processPending()
+{
+	bool hasHeader;
+	bool hasBatch;
+	bool isDone;
+	LDHeader header;
+	Winding winding = NoWinding;
+	Batch batch;
+
+	{
+		QMutexLocker locker {&m_mutex};
+		m_isScheduled = false;
+
+		// Nothing else can be appended before the batch whose subfiles are being preloaded. This is called again once
+		// the preloading has finished.
+		if (m_isPreloading)
+			return;
+
+		hasHeader = m_hasHeader;
+		header = m_header;
+		winding = m_winding;
+		hasBatch = not m_batches.isEmpty();
+		m_hasHeader = false;
+
+		if (hasBatch)
+			batch = m_batches.dequeue();
+
+		isDone = m_isWorkerDone and m_batches.isEmpty();
+
+		if (not m_batches.isEmpty())
+			schedule();
+	}
+
+	// The document may have been closed in the meantime, in which case there is nothing to load it into.
+	if (m_document.isNull())
+		cancel();
+
+	if (hasHeader and m_document)
+	{
+		m_document->header = header;
+		m_document->setFullPath(m_path);
+		m_document->setName(LDDocument::shortenName(m_path));
+		m_document->setWinding(winding);
+		emit headerLoaded(m_document);
+	}
+
+	if (hasBatch)
+	{
+		if (isCancelled())
+		{
+			qDeleteAll(batch.objects);
+		}
+		else
+		{
+			// Load the subfiles of the batch first, so that they don't have to be loaded one by one when the batch
+			// is rendered. The batch is appended by insertPreloadedBatch.
+			m_preloadingBatch = batch;
+			m_isPreloading = true;
+			m_preloader->start(batch.objects);
+			return;
+		}
+
+		emit progressChanged(static_cast<int>(batch.progress * 1000));
+	}
+
+	if (isDone)
+		emit finished();
+}
+
+/*
+ * Appends the batch whose subfiles have just been preloaded to the document, and goes on with the rest.
+ */
+void DocumentLoader::insertPreloadedBatch()
+{
+	Batch batch = m_preloadingBatch;
+	m_preloadingBatch = {};
+	m_isPreloading = false;
+
+	if (m_document.isNull() or isCancelled())
+		qDeleteAll(batch.objects);
+	else
+		m_document->insertObjects(m_document->size(), batch.objects);
+
+	emit progressChanged(static_cast<int>(batch.progress * 1000));
+	processPending();
+}
@@ -0,0 +1,97 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <QMutex>
+#include <QPointer>
+#include <QQueue>
+#include "main.h"
+#include "lddocument.h"
+
+class DocumentManager;
+class QThreadPool;
+class SubfilePreloader;
+
+/*
+ * Loads a document in the background. A worker thread parses the file in batches, which are appended to the document
+ * one at a time in the thread of the loader as they arrive. The document can thus be shown and rendered while the rest
+ * of it is still being parsed. The subfiles that a batch references are preloaded before the batch is appended, without
+ * blocking the thread of the loader.
+ *
+ * The document may be destroyed while it is still being loaded, in which case the loading is cancelled.
+ */
+class DocumentLoader : public QObject
+{
+	Q_OBJECT
+
+public:
+	DocumentLoader(LDDocument* document, const QString& path, QObject* parent = nullptr);
+	~DocumentLoader();
+
+	LDDocument* document() const;
+	QString errorString() const;
+	bool hasFailed() const;
+	bool isCancelled() const;
+	void start();
+
+public slots:
+	void cancel();
+
+signals:
+	void headerLoaded(LDDocument* document);
+	void progressChanged(int permille);
+	void finished();
+
+private:
+	class Worker;
+
+	struct Batch
+	{
+		QVector<LDObject*> objects;
+		qreal progress;
+	};
+
+	void postHeader(const LDHeader& header, Winding winding);
+	void postBatch(const QVector<LDObject*>& objects, qreal progress);
+	void postFailure(const QString& errorString);
+	void postFinish();
+	void schedule();
+	Q_SLOT void processPending();
+	Q_SLOT void insertPreloadedBatch();
+
+	const QPointer<LDDocument> m_document;
+	DocumentManager* const m_manager;
+	const QString m_path;
+	QThreadPool* m_threadPool;
+	std::atomic<bool> m_isCancelled {false};
+	bool m_hasFailed = false;
+	QString m_errorString;
+	SubfilePreloader* m_preloader;
+	bool m_isPreloading = false;
+	Batch m_preloadingBatch; // Waiting for its subfiles to be preloaded
+
+	// Shared with the worker thread, guarded by the mutex.
+	mutable QMutex m_mutex;
+	QQueue<Batch> m_batches;
+	bool m_hasHeader = false;
+	LDHeader m_header;
+	Winding m_winding = NoWinding;
+	bool m_isWorkerDone = false;
+	bool m_isScheduled = false;
+};
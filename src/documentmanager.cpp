@@ -16,10 +16,16 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QApplication>
 #include <QDir>
 #include <QFileInfo>
 #include <QMessageBox>
+#include <QProgressDialog>
+#include <QSet>
 #include <QSettings>
+#include <QThread>
+#include <QThreadPool>
+#include "documentloader.h"
 #include "documentmanager.h"
 #include "lddocument.h"
 #include "partdownloader.h"
@@ -31,9 +37,94 @@ enum
 	MaxRecentFiles = 10
 };
 
+/*
+ * Reads the header and the body of a document from the given device.
+ */
+static void loadDocument(LDDocument* document, QIODevice& device, const QString& path)
+{
+	Parser parser {device};
+	Winding winding = NoWinding;
+	document->header = parser.parseHeader(winding);
+	document->setFullPath(path);
+	document->setName(LDDocument::shortenName(path));
+	document->setWinding(winding);
+	parser.parseBody(*document);
+}
+
+/*
+ * Returns the amount of lines of the given document that could not be parsed.
+ */
+static int countErrors(LDDocument* document)
+{
+	int count = 0;
+
+	for (LDObject* object : document->objects())
+	{
+		if (object->type() == LDObjectType::Error)
+			count += 1;
+	}
+
+	return count;
+}
+
+/*
+ * Loads a single subfile in a worker thread. The document is built in the worker thread and then handed over to the
+ * thread of the document manager, which registers it once all loaders of the current round have finished.
+ */
+class SubfileLoader : public QRunnable
+{
+public:
+	SubfileLoader(DocumentManager* manager, const QString& path) :
+		m_manager {manager},
+		m_path {path}
+	{
+		setAutoDelete(false);
+	}
+
+	~SubfileLoader()
+	{
+		delete m_document;
+	}
+
+	void run() override
+	{
+		QFile file {m_path};
+
+		if (file.open(QIODevice::ReadOnly))
+		{
+			m_document = new LDDocument {m_manager};
+			m_document->history()->setIgnoring(true);
+			loadDocument(m_document, file, m_path);
+			QThread* targetThread = m_manager->thread();
+
+			for (LDObject* object : m_document->objects())
+				object->moveToThread(targetThread);
+
+			m_document->history()->moveToThread(targetThread);
+			m_document->moveToThread(targetThread);
+		}
+	}
+
+	/*
+	 * Hands the loaded document over to the caller, or returns null if the file could not be opened.
+	 */
+	LDDocument* takeDocument()
+	{
+		LDDocument* document = m_document;
+		m_document = nullptr;
+		return document;
+	}
+
+private:
+	DocumentManager* const m_manager;
+	const QString m_path;
+	LDDocument* m_document = nullptr;
+};
+
 DocumentManager::DocumentManager (QObject* parent) :
 	QObject (parent),
 	HierarchyElement (parent),
+	m_libraryIndex {QDir {qApp->applicationDirPath()}.filePath("library.cache")},
 	m_loadingMainFile (false),
 	m_isLoadingLogoedStuds (false),
 	m_logoedStud (nullptr),
@@ -41,11 +132,16 @@ DocumentManager::DocumentManager (QObject* parent) :
 
 DocumentManager::~DocumentManager()
 {
+	// Loaders still preloading subfiles register them here, so they have to be stopped before the documents go away.
+	qDeleteAll(findChildren<DocumentLoader*>(QString {}, Qt::FindDirectChildrenOnly));
 	clear();
 }
 
 void DocumentManager::clear()
 {
+	m_documentsByName.clear();
+	m_indexedNames.clear();
+	m_generation += 1;
 	m_documents.clear();
 }
 
@@ -74,7 +170,12 @@ LDDocument* DocumentManager::getDocumentByName (QString filename)
 	}
 }
 
-void DocumentManager::openMainModel (QString path)
+/*
+ * Opens the given file as a main model, replacing any document of the same name. By default, the file is loaded
+ * progressively in the background, so that the document is shown and rendered while it is being loaded and the
+ * loading can be cancelled. Otherwise, the file is loaded completely before returning.
+ */
+void DocumentManager::openMainModel(QString path, bool progressive)
 {
 	// If there's already a file with the same name, this file must replace it. Thus, we cannot open this file if the
 	// document this would replace is not safe to close.
@@ -85,37 +186,139 @@ void DocumentManager::openMainModel (QString path)
 			return;
 
 		(*documentToReplace)->close();
-		m_documents.erase(documentToReplace);
+		eraseDocument(documentToReplace);
 	}
 
-	m_loadingMainFile = true;
-	LDDocument* file = openDocument(path, false, false);
+	if (progressive)
+	{
+		QFile file {path};
+
+		if (not file.open(QIODevice::ReadOnly))
+		{
+			QMessageBox::critical(m_window, tr("Error"), format(tr("Failed to open %1: %2"), path, file.errorString()));
+			return;
+		}
+
+		file.close();
+		LDDocument* document = createNew(false);
+		document->setFullPath(path);
+		document->setName(LDDocument::shortenName(path));
 
-	if (file == nullptr)
+		// Loading the file shouldn't count as actual edits to the document.
+		document->history()->setIgnoring(true);
+
+		DocumentLoader* loader = new DocumentLoader {document, path, this};
+		QProgressDialog* progressDialog = new QProgressDialog {m_window};
+		progressDialog->setLabelText(format(tr("Loading %1..."), LDDocument::shortenName(path)));
+		progressDialog->setRange(0, 1000);
+		progressDialog->setWindowModality(Qt::WindowModal);
+		progressDialog->setMinimumDuration(500);
+		connect(progressDialog, &QProgressDialog::canceled, loader, &DocumentLoader::cancel);
+		connect(loader, &DocumentLoader::progressChanged, progressDialog, &QProgressDialog::setValue);
+		connect(loader, &DocumentLoader::headerLoaded, this, &DocumentManager::mainModelLoaded);
+		connect(
+			this,
+			&DocumentManager::documentClosed,
+			loader,
+			[loader, document](LDDocument* closedDocument)
+			{
+				if (closedDocument == document)
+					loader->cancel();
+			}
+		);
+		connect(
+			loader,
+			&DocumentLoader::finished,
+			this,
+			[this, loader, progressDialog]()
+			{
+				progressDialog->deleteLater();
+				loader->deleteLater();
+				finishLoadingMainModel(loader);
+			}
+		);
+		loader->start();
+	}
+	else
 	{
-		// Tell the user loading failed.
-		setlocale (LC_ALL, "C");
-		QMessageBox::critical(m_window, tr("Error"), format(tr("Failed to open %1: %2"), path, strerror (errno)));
+		m_loadingMainFile = true;
+		LDDocument* file = openDocument(path, false, false);
 		m_loadingMainFile = false;
+
+		if (file == nullptr)
+		{
+			// Tell the user loading failed.
+			setlocale (LC_ALL, "C");
+			QMessageBox::critical(m_window, tr("Error"), format(tr("Failed to open %1: %2"), path, strerror (errno)));
+			return;
+		}
+
+		emit mainModelLoaded(file);
+		addRecentFile (path);
+		downloadMissingSubfiles(file);
+	}
+}
+
+/*
+ * Completes the progressive loading of a main model once its loader has finished.
+ */
+void DocumentManager::finishLoadingMainModel(DocumentLoader* loader)
+{
+	LDDocument* document = loader->document();
+
+	if (document == nullptr)
+	{
+		// The document was destroyed while it was being loaded, so there is nothing left to finish.
 		return;
 	}
+	else if (loader->hasFailed() or loader->isCancelled())
+	{
+		if (loader->hasFailed())
+		{
+			QMessageBox::critical(
+				m_window,
+				tr("Error"),
+				format(tr("Failed to open %1: %2"), document->fullPath(), loader->errorString())
+			);
+		}
+		else
+		{
+			print(tr("Loading %1 was cancelled."), document->name());
+		}
+
+		// A partially loaded document must not be mistaken for the file, so it is discarded.
+		document->close();
+
+		auto iterator = m_documents.find(document);
 
-	emit mainModelLoaded(file);
-	addRecentFile (path);
-	m_loadingMainFile = false;
+		if (iterator != end())
+			eraseDocument(iterator);
+	}
+	else
+	{
+		document->history()->setIgnoring(false);
+		print(tr("File %1 opened successfully (%2 errors)."), document->name(), countErrors(document));
+		addRecentFile(document->fullPath());
+		downloadMissingSubfiles(document);
+	}
+}
 
-	// If there were problems loading subfile references, try see if we can find these
-	// files on the parts tracker.
+/*
+ * If there were problems loading subfile references of the given document, tries to see if these files can be found
+ * on the parts tracker.
+ */
+void DocumentManager::downloadMissingSubfiles(LDDocument* document)
+{
 	QStringList unknowns;
 
-	for (LDObject* obj : file->objects())
+	for (LDObject* obj : document->objects())
 	{
 		if (obj->type() == LDObjectType::SubfileReference)
 		{
 			LDSubfileReference* reference = static_cast<LDSubfileReference*>(obj);
-			LDDocument* document = reference->fileInfo(this);
+			LDDocument* subfile = reference->fileInfo(this);
 
-			if (document == nullptr)
+			if (subfile == nullptr)
 				unknowns << reference->referenceName();
 		}
 	}
@@ -124,7 +327,7 @@ void DocumentManager::openMainModel (QString path)
 	{
 		PartDownloader dl (m_window);
 		dl.setSourceType (PartDownloader::PartsTracker);
-		dl.setPrimaryFile (file);
+		dl.setPrimaryFile (document);
 
 		for (QString const& unknown : unknowns)
 			dl.downloadFromPartsTracker (unknown);
@@ -136,34 +339,64 @@ void DocumentManager::openMainModel (QString path)
 
 DocumentManager::iterator DocumentManager::findDocumentByName(const QString& name)
 {
-	if (not name.isEmpty())
-	{
-		for (auto it = begin(); it != end(); ++it)
-		{
-			if (name == oneOf((*it)->name(), (*it)->defaultName()))
-				return it;
-		}
-	}
+	LDDocument* document = m_documentsByName.value(normalizedName(name));
 
-	return end();
+	if (document)
+		return m_documents.find(document);
+	else
+		return end();
 }
 
-QString DocumentManager::findDocument(QString name) const
+/*
+ * Returns the path of the library file of the given name, or an empty string if the libraries have no such file. The
+ * libraries are indexed on first use, so this doesn't touch the file system.
+ */
+QString DocumentManager::findDocument(const QString& name)
 {
-	name = name.replace("\\", "/");
+	if (not m_isLibraryIndexed)
+		refreshLibraries();
 
-	for (const Library& library : config::libraries())
-	{
-		for (const QString& subdirectory : {"parts", "p"})
-		{
-			QDir dir {library.path + "/" + subdirectory};
+	return m_libraryIndex.find(name);
+}
 
-			if (dir.exists(name))
-				return QDir::cleanPath(dir.filePath(name));
-		}
+/*
+ * Brings the library index up to date, after the libraries have been configured differently or files have been added
+ * to them.
+ */
+void DocumentManager::refreshLibraries()
+{
+	m_libraryIndex.update(config::libraries());
+	m_isLibraryIndexed = true;
+}
+
+/*
+ * Finds the file that a subfile reference refers to: the file at the name itself if there is one, or failing that, a
+ * file of the libraries. Names that resolve to neither are remembered until the library index changes, so that models
+ * with missing subfiles don't look them up again whenever they are compiled.
+ */
+QString DocumentManager::resolveSubfilePath(const QString& name)
+{
+	if (m_unresolvedRevision != m_libraryIndex.revision())
+	{
+		m_unresolvedNames.clear();
+		m_unresolvedRevision = m_libraryIndex.revision();
 	}
 
-	return {};
+	// A name only gets here after it was neither a file nor in the libraries, so it costs no system calls.
+	if (m_unresolvedNames.contains(name))
+		return {};
+
+	if (QFileInfo {name}.exists())
+		return name;
+
+	// Convert the file name to lowercase when searching because some parts contain subfile references with
+	// uppercase file names. I'll assume here that the library will always use lowercase file names for the part files.
+	QString path = findDocument(name.toLower());
+
+	if (path.isEmpty())
+		m_unresolvedNames.insert(name);
+
+	return path;
 }
 
 void DocumentManager::printParseErrorMessage(QString message)
@@ -173,12 +406,12 @@ void DocumentManager::printParseErrorMessage(QString message)
 
 LDDocument* DocumentManager::openDocument(QString path, bool search, bool implicit)
 {
-	if (search and not QFileInfo {path}.exists())
+	if (search)
 	{
-		// Convert the file name to lowercase when searching because some parts contain subfile
-		// subfile references with uppercase file names. I'll assume here that the library will
-		// always use lowercase file names for the part files.
-		path = this->findDocument(path.toLower());
+		path = resolveSubfilePath(path);
+
+		if (path.isEmpty())
+			return nullptr;
 	}
 
 	QFile file {path};
@@ -190,27 +423,14 @@ LDDocument* DocumentManager::openDocument(QString path, bool search, bool implic
 		// Loading the file shouldn't count as actual edits to the document.
 		load->history()->setIgnoring (true);
 
-		Parser parser {file};
-		Winding winding = NoWinding;
-		load->header = parser.parseHeader(winding);
-		load->setFullPath(path);
-		load->setName(LDDocument::shortenName(path));
-		load->setWinding(winding);
-		parser.parseBody(*load);
+		loadDocument(load, file, path);
 		file.close();
+		preloadSubfiles(load);
 
 		if (m_loadingMainFile)
 		{
-			int numWarnings = 0;
-
-			for (LDObject* object : load->objects())
-			{
-				if (object->type() == LDObjectType::Error)
-					numWarnings += 1;
-			}
-
 			m_window->changeDocument(load);
-			print(tr("File %1 opened successfully (%2 errors)."), load->name(), numWarnings);
+			print(tr("File %1 opened successfully (%2 errors)."), load->name(), countErrors(load));
 		}
 
 		load->history()->setIgnoring (false);
@@ -222,6 +442,247 @@ LDDocument* DocumentManager::openDocument(QString path, bool search, bool implic
 	}
 }
 
+/*
+ * Loads every subfile that the given document references, directly or indirectly, and that is not loaded yet. The
+ * references are followed one level at a time; the subfiles of each level are parsed in parallel by a thread pool
+ * and then registered here in this thread.
+ */
+void DocumentManager::preloadSubfiles(LDDocument* document)
+{
+	preloadSubfiles(document->objects());
+}
+
+/*
+ * Like above, but for the subfiles referenced by the given objects.
+ */
+void DocumentManager::preloadSubfiles(const QVector<LDObject*>& objects)
+{
+	PreloadRequests requests = newPreloadRequests();
+	QVector<LDObject*> level = objects;
+
+	while (not level.isEmpty())
+	{
+		QStringList paths = unloadedSubfilePaths(level, requests);
+		level.clear();
+
+		for (LDDocument* loadedDocument : loadInParallel(paths, true))
+		{
+			if (loadedDocument)
+				level += loadedDocument->objects();
+		}
+	}
+}
+
+/*
+ * Returns the requests of a new preload of subfiles, which already count the paths of the loaded documents so that a
+ * second copy of a document that is referred to by another name is not loaded.
+ */
+DocumentManager::PreloadRequests DocumentManager::newPreloadRequests() const
+{
+	PreloadRequests requests;
+
+	for (const std::unique_ptr<LDDocument>& loadedDocument : m_documents)
+		requests.paths.insert(loadedDocument->fullPath());
+
+	return requests;
+}
+
+/*
+ * Returns the paths of the subfiles that the given objects reference, which are neither loaded nor requested yet, and
+ * adds them to the requests.
+ */
+QStringList DocumentManager::unloadedSubfilePaths(const QVector<LDObject*>& objects, PreloadRequests& requests)
+{
+	QStringList paths;
+
+	for (LDObject* object : objects)
+	{
+		if (object->type() != LDObjectType::SubfileReference)
+			continue;
+
+		QString name = static_cast<LDSubfileReference*>(object)->referenceName();
+
+		if (name.isEmpty() or requests.names.contains(name) or findDocumentByName(name) != end())
+			continue;
+
+		requests.names.insert(name);
+
+		// Resolve the path the same way openDocument does.
+		QString path = resolveSubfilePath(name);
+
+		if (not path.isEmpty() and not requests.paths.contains(path))
+		{
+			requests.paths.insert(path);
+			paths.append(path);
+		}
+	}
+
+	return paths;
+}
+
+/*
+ * Opens the given files in parallel, and then the subfiles that they reference. Returns the documents in the order of
+ * the paths, with null in place of the files that could not be opened.
+ */
+QVector<LDDocument*> DocumentManager::openDocuments(const QStringList& paths, bool implicit)
+{
+	QVector<LDDocument*> documents = loadInParallel(paths, implicit);
+	QVector<LDObject*> objects;
+
+	for (LDDocument* document : documents)
+	{
+		if (document)
+			objects += document->objects();
+	}
+
+	preloadSubfiles(objects);
+	return documents;
+}
+
+/*
+ * Parses the given files with a thread pool, and registers the documents here in this thread once all of them have
+ * been parsed. Returns the documents in the order of the paths, with null in place of the files that could not be
+ * opened.
+ */
+QVector<LDDocument*> DocumentManager::loadInParallel(const QStringList& paths, bool implicit)
+{
+	std::vector<std::unique_ptr<SubfileLoader>> loaders;
+	QVector<LDDocument*> documents;
+	QThreadPool pool;
+
+	for (const QString& path : paths)
+		loaders.emplace_back(std::make_unique<SubfileLoader>(this, path));
+
+	for (const std::unique_ptr<SubfileLoader>& loader : loaders)
+		pool.start(loader.get());
+
+	pool.waitForDone();
+
+	for (const std::unique_ptr<SubfileLoader>& loader : loaders)
+	{
+		LDDocument* loadedDocument = loader->takeDocument();
+
+		if (loadedDocument)
+			registerLoadedDocument(loadedDocument, implicit);
+
+		documents.append(loadedDocument);
+	}
+
+	return documents;
+}
+
+/*
+ * Takes ownership of a document that a SubfileLoader has parsed and moved to this thread.
+ */
+void DocumentManager::registerLoadedDocument(LDDocument* document, bool implicit)
+{
+	document->setParent(this);
+	m_documents.emplace(document);
+	trackDocument(document);
+	emit documentCreated(document, implicit);
+	document->history()->setIgnoring(false);
+
+	// Documents that referred to the subfile before it was loaded have nothing cached from it.
+	invalidateDependents(document);
+}
+
+/*
+ * Parses the subfiles of one level of references with a thread pool of its own, and then lets the preloader register
+ * them in its own thread.
+ */
+class SubfilePreloader::Worker : public QRunnable
+{
+public:
+	Worker(SubfilePreloader* preloader) :
+		m_preloader {preloader} {}
+
+	void run() override
+	{
+		QThreadPool pool;
+
+		for (const std::unique_ptr<SubfileLoader>& loader : m_preloader->m_loaders)
+			pool.start(loader.get());
+
+		pool.waitForDone();
+		QMetaObject::invokeMethod(m_preloader, "finishLevel", Qt::QueuedConnection);
+	}
+
+private:
+	SubfilePreloader* const m_preloader;
+};
+
+SubfilePreloader::SubfilePreloader(DocumentManager* manager, QObject* parent) :
+	QObject {parent},
+	m_manager {manager},
+	m_threadPool {new QThreadPool {this}}
+{
+	m_threadPool->setMaxThreadCount(1);
+}
+
+SubfilePreloader::~SubfilePreloader()
+{
+	// The worker uses the loaders, which are destroyed before the thread pool is.
+	m_threadPool->waitForDone();
+}
+
+/*
+ * Starts loading the subfiles that the given objects reference. Must not be called again before finished() has been
+ * emitted.
+ */
+void SubfilePreloader::start(const QVector<LDObject*>& objects)
+{
+	m_requests = m_manager->newPreloadRequests();
+	startLevel(objects);
+}
+
+void SubfilePreloader::startLevel(const QVector<LDObject*>& objects)
+{
+	QStringList paths = m_manager->unloadedSubfilePaths(objects, m_requests);
+
+	if (paths.isEmpty())
+	{
+		emit finished();
+	}
+	else
+	{
+		for (const QString& path : paths)
+			m_loaders.emplace_back(std::make_unique<SubfileLoader>(m_manager, path));
+
+		m_threadPool->start(new Worker {this});
+	}
+}
+
+/*
+ * Registers the subfiles of the level that has just been parsed, and goes on with the subfiles that they reference.
+ */
+void SubfilePreloader::finishLevel()
+{
+	QVector<LDObject*> level;
+	QSet<QString> loadedPaths = m_manager->newPreloadRequests().paths;
+
+	for (const std::unique_ptr<SubfileLoader>& loader : m_loaders)
+	{
+		LDDocument* loadedDocument = loader->takeDocument();
+
+		if (loadedDocument == nullptr)
+			continue;
+
+		// Another preload may have loaded the same file while this level was being parsed.
+		if (loadedPaths.contains(loadedDocument->fullPath()))
+		{
+			delete loadedDocument;
+			continue;
+		}
+
+		loadedPaths.insert(loadedDocument->fullPath());
+		m_manager->registerLoadedDocument(loadedDocument, true);
+		level += loadedDocument->objects();
+	}
+
+	m_loaders.clear();
+	startLevel(level);
+}
+
 void DocumentManager::addRecentFile (QString path)
 {
 	QStringList recentFiles = config::recentFiles();
@@ -282,37 +743,209 @@ void DocumentManager::loadLogoedStuds()
 		print (tr ("Logoed studs loaded.\n"));
 }
 
-bool DocumentManager::preInline (LDDocument* doc, Model& model, bool deep, bool renderinline)
+/*
+ * Returns the logoed stud that should be rendered in place of the given document, or null if the document should be
+ * rendered as is.
+ */
+LDDocument* DocumentManager::logoedStudFor(LDDocument* document)
 {
 	// Possibly substitute with logoed studs:
 	// stud.dat -> stud-logo.dat
 	// stud2.dat -> stud-logo2.dat
-	if (config::useLogoStuds() and renderinline)
+	if (config::useLogoStuds())
 	{
 		// Ensure logoed studs are loaded first
 		loadLogoedStuds();
 
-		if (doc->name() == "stud.dat" and m_logoedStud)
-		{
-			m_logoedStud->inlineContents(model, deep, renderinline);
-			return true;
-		}
-		else if (doc->name() == "stud2.dat" and m_logoedStud2)
-		{
-			m_logoedStud2->inlineContents(model, deep, renderinline);
-			return true;
-		}
+		if (document->name() == "stud.dat")
+			return m_logoedStud;
+		else if (document->name() == "stud2.dat")
+			return m_logoedStud2;
+	}
+
+	return nullptr;
+}
+
+bool DocumentManager::preInline (LDDocument* doc, Model& model, bool deep, bool renderinline)
+{
+	LDDocument* logoedStud = renderinline ? logoedStudFor(doc) : nullptr;
+
+	if (logoedStud)
+	{
+		logoedStud->inlineContents(model, deep, renderinline);
+		return true;
 	}
+
 	return false;
 }
 
 LDDocument* DocumentManager::createNew(bool implicit)
 {
 	auto pair = m_documents.emplace(std::make_unique<LDDocument>(this));
+	trackDocument(pair.first->get());
 	emit documentCreated(pair.first->get(), implicit);
 	return pair.first->get();
 }
 
+/*
+ * Records that the given document refers to the subfile of the given name once more.
+ */
+void DocumentManager::addDependency(LDDocument* document, const QString& subfileName)
+{
+	QMutexLocker locker {&m_dependentsMutex};
+	m_dependents[normalizedName(subfileName)][document] += 1;
+}
+
+/*
+ * Records that the given document refers to the subfile of the given name once less.
+ */
+void DocumentManager::removeDependency(LDDocument* document, const QString& subfileName)
+{
+	QMutexLocker locker {&m_dependentsMutex};
+	auto iterator = m_dependents.find(normalizedName(subfileName));
+
+	if (iterator != m_dependents.end())
+	{
+		auto documentIterator = iterator->find(document);
+
+		if (documentIterator != iterator->end())
+		{
+			*documentIterator -= 1;
+
+			if (*documentIterator <= 0)
+				iterator->erase(documentIterator);
+		}
+
+		if (iterator->isEmpty())
+			m_dependents.erase(iterator);
+	}
+}
+
+/*
+ * Lets the documents that refer to the given document, directly or through other subfiles, know that it has changed,
+ * so that they drop what they have cached from it and draw their references to it again. Other documents are left
+ * alone.
+ */
+void DocumentManager::invalidateDependents(LDDocument* document)
+{
+	QVector<LDDocument*> queue {document};
+	QSet<LDDocument*> visited {document};
+
+	for (int i = 0; i < queue.size(); i += 1)
+	{
+		LDDocument* subfile = queue[i];
+
+		for (const QString& subfileName : {subfile->name(), subfile->defaultName()})
+		{
+			QHash<LDDocument*, int> dependents;
+			QString name = normalizedName(subfileName);
+
+			if (name.isEmpty())
+				continue;
+
+			{
+				QMutexLocker locker {&m_dependentsMutex};
+				dependents = m_dependents.value(name);
+			}
+
+			for (LDDocument* dependent : dependents.keys())
+			{
+				dependent->invalidateSubfile(name);
+
+				if (not visited.contains(dependent))
+				{
+					visited.insert(dependent);
+					queue.append(dependent);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Starts keeping track of a document that has been added to the documents: indexes it by its names, and invalidates
+ * its dependents whenever it changes. Changes made in other threads, like those of documents being parsed, are handled
+ * in the thread of the manager.
+ */
+void DocumentManager::trackDocument(LDDocument* document)
+{
+	indexDocument(document);
+
+	connect(document, &Model::modelChanged, this, [this, document]()
+	{
+		invalidateDependents(document);
+	});
+
+	connect(document, &LDDocument::renamed, this, [this, document]()
+	{
+		indexDocument(document);
+	});
+}
+
+/*
+ * Indexes a document by its current names, replacing the names it was indexed by before.
+ */
+void DocumentManager::indexDocument(LDDocument* document)
+{
+	QStringList names;
+
+	for (const QString& name : m_indexedNames.take(document))
+		m_documentsByName.remove(name, document);
+
+	for (const QString& name : {document->name(), document->defaultName()})
+	{
+		QString key = normalizedName(name);
+
+		if (not key.isEmpty() and not names.contains(key))
+		{
+			names.append(key);
+			m_documentsByName.insert(key, document);
+		}
+	}
+
+	m_indexedNames.insert(document, names);
+	m_generation += 1;
+}
+
+/*
+ * Removes a document from the documents, which destroys it. If the document is still being loaded, its loader is
+ * cancelled first.
+ */
+void DocumentManager::eraseDocument(iterator iterator)
+{
+	LDDocument* document = iterator->get();
+
+	for (DocumentLoader* loader : findChildren<DocumentLoader*>(QString {}, Qt::FindDirectChildrenOnly))
+	{
+		if (loader->document() == document)
+			loader->cancel();
+	}
+
+	for (const QString& name : m_indexedNames.take(document))
+		m_documentsByName.remove(name, document);
+
+	m_generation += 1;
+	m_documents.erase(iterator);
+}
+
+/*
+ * Returns a number that changes whenever documents are added or removed or change their names, so that whoever has
+ * looked up documents by their names knows when to look them up again.
+ */
+quint64 DocumentManager::generation() const
+{
+	return m_generation;
+}
+
+/*
+ * Returns the form of a name that documents are looked up by. Names of LDraw files are not case-sensitive, and either
+ * kind of slash may separate directories in them.
+ */
+QString DocumentManager::normalizedName(const QString& name)
+{
+	return name.toLower().replace('/', '\\');
+}
+
 DocumentManager::Documents::iterator DocumentManager::end()
 {
 	return m_documents.end();
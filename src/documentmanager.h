@@ -17,37 +17,80 @@
  */
 
 #pragma once
+#include <functional>
+#include <memory>
 #include <set>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
 #include "main.h"
 #include "hierarchyelement.h"
+#include "libraryindex.h"
 
+class DocumentLoader;
 class Model;
+class QThreadPool;
+class SubfileLoader;
+
+/*
+ * Orders documents by address, so that a document can be looked up in the set of documents by its address alone.
+ */
+struct DocumentOrder
+{
+	using is_transparent = void;
+
+	bool operator()(const std::unique_ptr<LDDocument>& one, const std::unique_ptr<LDDocument>& other) const
+	{
+		return std::less<LDDocument*> {}(one.get(), other.get());
+	}
+
+	bool operator()(const std::unique_ptr<LDDocument>& one, LDDocument* other) const
+	{
+		return std::less<LDDocument*> {}(one.get(), other);
+	}
+
+	bool operator()(LDDocument* one, const std::unique_ptr<LDDocument>& other) const
+	{
+		return std::less<LDDocument*> {}(one, other.get());
+	}
+};
 
 class DocumentManager : public QObject, public HierarchyElement
 {
 	Q_OBJECT
 
 public:
-	using Documents = std::set<std::unique_ptr<LDDocument>>;
+	using Documents = std::set<std::unique_ptr<LDDocument>, DocumentOrder>;
 	using iterator = Documents::iterator;
 
 	DocumentManager (QObject* parent = nullptr);
 	~DocumentManager();
 
+	void addDependency(LDDocument* document, const QString& subfileName);
 	void addRecentFile (QString path);
 	const Documents& allDocuments() const;
 	Documents::iterator begin();
 	void clear();
 	LDDocument* createNew(bool implicit);
 	Documents::iterator end();
-	QString findDocument(QString name) const;
+	QString findDocument(const QString& name);
 	iterator findDocumentByName(const QString& name);
+	quint64 generation() const;
 	LDDocument* getDocumentByName (QString filename);
+	void invalidateDependents(LDDocument* document);
 	bool isSafeToCloseAll();
 	void loadLogoedStuds();
+	LDDocument* logoedStudFor(LDDocument* document);
 	LDDocument* openDocument(QString path, bool search, bool implicit);
-	void openMainModel (QString path);
+	QVector<LDDocument*> openDocuments(const QStringList& paths, bool implicit);
+	void openMainModel(QString path, bool progressive = true);
 	bool preInline (LDDocument* doc, Model& model, bool deep, bool renderinline);
+	void preloadSubfiles(LDDocument* document);
+	void preloadSubfiles(const QVector<LDObject*>& objects);
+	void refreshLibraries();
+	void removeDependency(LDDocument* document, const QString& subfileName);
+
+	static QString normalizedName(const QString& name);
 
 signals:
 	void documentCreated(LDDocument* document, bool cache);
@@ -55,11 +98,74 @@ signals:
 	void mainModelLoaded(LDDocument* document);
 
 private:
+	friend class SubfilePreloader;
+
+	/*
+	 * The subfile names and paths that have been asked to be loaded by a preload of subfiles.
+	 */
+	struct PreloadRequests
+	{
+		QSet<QString> names;
+		QSet<QString> paths;
+	};
+
+	void downloadMissingSubfiles(LDDocument* document);
+	void eraseDocument(iterator iterator);
+	void indexDocument(LDDocument* document);
+	QVector<LDDocument*> loadInParallel(const QStringList& paths, bool implicit);
+	void finishLoadingMainModel(DocumentLoader* loader);
+	PreloadRequests newPreloadRequests() const;
 	Q_SLOT void printParseErrorMessage(QString message);
+	void registerLoadedDocument(LDDocument* document, bool implicit);
+	QString resolveSubfilePath(const QString& name);
+	void trackDocument(LDDocument* document);
+	QStringList unloadedSubfilePaths(const QVector<LDObject*>& objects, PreloadRequests& requests);
 
-	std::set<std::unique_ptr<LDDocument>> m_documents;
+	Documents m_documents;
+	QMultiHash<QString, LDDocument*> m_documentsByName; // By normalized name and default name
+	QHash<LDDocument*, QStringList> m_indexedNames; // Keys of the documents in the above
+	quint64 m_generation = 1; // Changes whenever the names of the documents change
+	// Documents that refer to each subfile name, with the amounts of their references. Documents parsed in worker
+	// threads record their references as well, hence the mutex.
+	QHash<QString, QHash<LDDocument*, int>> m_dependents;
+	QMutex m_dependentsMutex;
+	LibraryIndex m_libraryIndex;
+	bool m_isLibraryIndexed = false;
+	QSet<QString> m_unresolvedNames; // Subfile names that resolved to no file, valid for one revision of the index
+	int m_unresolvedRevision = -1;
 	bool m_loadingMainFile;
 	bool m_isLoadingLogoedStuds;
 	LDDocument* m_logoedStud;
 	LDDocument* m_logoedStud2;
 };
+
+/*
+ * Loads the subfiles that some objects reference, directly or indirectly, like DocumentManager::preloadSubfiles but
+ * without blocking the thread of the document manager. The names are resolved and the loaded documents registered in
+ * that thread, while the files of each level of references are parsed in a thread pool. Emits finished() once there
+ * are no more subfiles to load.
+ */
+class SubfilePreloader : public QObject
+{
+	Q_OBJECT
+
+public:
+	SubfilePreloader(DocumentManager* manager, QObject* parent = nullptr);
+	~SubfilePreloader();
+
+	void start(const QVector<LDObject*>& objects);
+
+signals:
+	void finished();
+
+private:
+	class Worker;
+
+	Q_SLOT void finishLevel();
+	void startLevel(const QVector<LDObject*>& objects);
+
+	DocumentManager* const m_manager;
+	QThreadPool* m_threadPool;
+	DocumentManager::PreloadRequests m_requests;
+	std::vector<std::unique_ptr<SubfileLoader>> m_loaders; // Loaders of the level being parsed
+};
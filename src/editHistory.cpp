@@ -16,9 +16,23 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QTemporaryFile>
 #include "editHistory.h"
 #include "lddocument.h"
 
+/*
+ * Estimates how much memory an archive takes.
+ */
+static qint64 archiveSize(const Serializer::Archive& archive)
+{
+	qint64 size = sizeof archive + archive.data.capacity();
+
+	for (const QString& string : archive.strings)
+		size += sizeof string + string.capacity() * sizeof(QChar);
+
+	return size;
+}
+
 EditHistory::EditHistory (LDDocument* document) :
 	m_document (document),
 	m_isIgnoring (false),
@@ -69,11 +83,15 @@ void EditHistory::redo()
 
 void EditHistory::clear()
 {
-	for (Changeset set : m_changesets)
-	for (AbstractHistoryEntry* change : set)
+	for (const StoredChangeset& set : m_changesets)
+	for (AbstractHistoryEntry* change : set.entries)
 		delete change;
 
 	m_changesets.clear();
+	m_memoryUsage = 0;
+	m_spilledSize = 0;
+	delete m_spillFile;
+	m_spillFile = nullptr;
 }
 
 void EditHistory::addStep()
@@ -83,17 +101,28 @@ void EditHistory::addStep()
 
 	while (position() < size() - 1)
 	{
-		Changeset last = m_changesets.last();
+		StoredChangeset& last = m_changesets.last();
+
+		if (not last.entries.isEmpty())
+			m_memoryUsage -= last.memoryUsage;
 
-		for (AbstractHistoryEntry* entry : last)
+		for (AbstractHistoryEntry* entry : last.entries)
 			delete entry;
 
 		m_changesets.removeLast();
 	}
 
-	m_changesets << m_currentChangeset;
+	StoredChangeset set;
+	set.entries = m_currentChangeset;
+
+	for (AbstractHistoryEntry* entry : set.entries)
+		set.memoryUsage += entry->memoryUsage();
+
+	m_changesets << set;
+	m_memoryUsage += set.memoryUsage;
 	m_currentChangeset.clear();
 	++m_position;
+	enforceMemoryBudget();
 	emit stepAdded();
 }
 
@@ -102,9 +131,103 @@ int EditHistory::size() const
 	return countof(m_changesets);
 }
 
-const EditHistory::Changeset& EditHistory::changesetAt (int pos) const
+/*
+ * Returns the changeset at the given position, reading it back from the spill file if it has been spilled.
+ */
+const EditHistory::Changeset& EditHistory::changesetAt (int pos)
 {
-	return m_changesets[pos];
+	StoredChangeset& set = m_changesets[pos];
+
+	if (set.entries.isEmpty() and m_spillFile)
+	{
+		m_spillFile->seek(set.fileOffset);
+		QByteArray data = qUncompress(m_spillFile->read(set.fileLength));
+		QDataStream stream {data};
+		qint32 count;
+		stream >> count;
+
+		for (int i = 0; i < count; i += 1)
+		{
+			AbstractHistoryEntry* entry = AbstractHistoryEntry::read(stream, this);
+
+			if (entry)
+				set.entries.append(entry);
+		}
+
+		m_memoryUsage += set.memoryUsage;
+		enforceMemoryBudget();
+	}
+
+	return set.entries;
+}
+
+/*
+ * Spills changesets until the history fits into the memory budget again. The changesets farthest from the current
+ * position go first, the ones that the next undo and redo need stay.
+ */
+void EditHistory::enforceMemoryBudget()
+{
+	const qint64 budget = qint64(config::historyMemoryBudget()) * 1024 * 1024;
+
+	while (budget > 0 and m_memoryUsage > budget)
+	{
+		int farthest = -1;
+
+		for (int i = 0; i < size(); i += 1)
+		{
+			bool isCandidate = not m_changesets[i].entries.isEmpty() and i != position() and i != position() + 1;
+
+			if (isCandidate and (farthest == -1 or qAbs(i - position()) > qAbs(farthest - position())))
+				farthest = i;
+		}
+
+		if (farthest == -1 or not spill(m_changesets[farthest]))
+			break;
+	}
+}
+
+/*
+ * Removes the entries of the given changeset from memory, writing them to the spill file first unless they already
+ * were written there before. Returns false if the spill file could not be written.
+ */
+bool EditHistory::spill(StoredChangeset& set)
+{
+	if (set.fileOffset == -1)
+	{
+		if (m_spillFile == nullptr)
+		{
+			m_spillFile = new QTemporaryFile {this};
+
+			if (not m_spillFile->open())
+			{
+				delete m_spillFile;
+				m_spillFile = nullptr;
+				return false;
+			}
+		}
+
+		QByteArray data;
+		QDataStream stream {&data, QIODevice::WriteOnly};
+		stream << qint32(set.entries.size());
+
+		for (AbstractHistoryEntry* entry : set.entries)
+			entry->write(stream);
+
+		QByteArray compressed = qCompress(data);
+		qint64 offset = m_spillFile->size();
+
+		if (not m_spillFile->seek(offset) or m_spillFile->write(compressed) != compressed.size())
+			return false;
+
+		set.fileOffset = offset;
+		set.fileLength = compressed.size();
+		m_spilledSize += compressed.size();
+	}
+
+	qDeleteAll(set.entries);
+	set.entries.clear();
+	m_memoryUsage -= set.memoryUsage;
+	return true;
 }
 
 int EditHistory::position()
@@ -127,6 +250,48 @@ LDDocument* EditHistory::document() const
 	return m_document;
 }
 
+/*
+ * Returns an estimate of how much memory the changesets that are not spilled take.
+ */
+qint64 EditHistory::memoryUsage() const
+{
+	return m_memoryUsage;
+}
+
+/*
+ * Returns how many bytes of changesets have been spilled into the spill file.
+ */
+qint64 EditHistory::spilledSize() const
+{
+	return m_spilledSize;
+}
+
+/*
+ * Reads an entry written by AbstractHistoryEntry::write.
+ */
+AbstractHistoryEntry* AbstractHistoryEntry::read(QDataStream& stream, EditHistory* parent)
+{
+	qint32 type;
+	stream >> type;
+
+	switch (static_cast<Type>(type))
+	{
+	case Add:
+		return new AddHistoryEntry {stream, parent};
+
+	case Del:
+		return new DelHistoryEntry {stream, parent};
+
+	case Edit:
+		return new EditHistoryEntry {stream, parent};
+
+	case Move:
+		return new MoveHistoryEntry {stream, parent};
+	}
+
+	return nullptr;
+}
+
 AbstractHistoryEntry::AbstractHistoryEntry(EditHistory* parent) :
 	m_parent {parent} {}
 
@@ -137,20 +302,55 @@ EditHistory* AbstractHistoryEntry::parent() const
 	return m_parent;
 }
 
-AddHistoryEntry::AddHistoryEntry(const QModelIndex& index, EditHistory* parent) :
+AddHistoryEntry::AddHistoryEntry(int first, int last, EditHistory* parent) :
 	AbstractHistoryEntry {parent},
-	m_row {index.row()},
-	m_code {Serializer::store(parent->document()->lookup(index))} {}
+	m_row {first}
+{
+	m_codes.reserve(last - first + 1);
+
+	for (int row = first; row <= last; row += 1)
+		m_codes.append(Serializer::store(parent->document()->getObject(row)));
+}
+
+AddHistoryEntry::AddHistoryEntry(QDataStream& stream, EditHistory* parent) :
+	AbstractHistoryEntry {parent}
+{
+	stream >> m_row >> m_codes;
+}
+
+qint64 AddHistoryEntry::memoryUsage() const
+{
+	qint64 size = sizeof *this;
+
+	for (const Serializer::Archive& code : m_codes)
+		size += archiveSize(code);
+
+	return size;
+}
+
+AbstractHistoryEntry::Type AddHistoryEntry::type() const
+{
+	return Add;
+}
+
+void AddHistoryEntry::write(QDataStream& stream) const
+{
+	stream << qint32(type()) << m_row << m_codes;
+}
 
 void AddHistoryEntry::undo()
 {
-	LDObject* object = parent()->document()->getObject(m_row);
-	parent()->document()->remove(object);
+	parent()->document()->removeRows(m_row, m_codes.size());
 }
 
 void AddHistoryEntry::redo()
 {
-	parent()->document()->insertFromArchive(m_row, m_code);
+	parent()->document()->insertFromArchives(m_row, m_codes);
+}
+
+AbstractHistoryEntry::Type DelHistoryEntry::type() const
+{
+	return Del;
 }
 
 void DelHistoryEntry::undo()
@@ -174,6 +374,27 @@ EditHistoryEntry::EditHistoryEntry(
 	oldState {oldState},
 	newState {newState} {}
 
+EditHistoryEntry::EditHistoryEntry(QDataStream& stream, EditHistory* parent) :
+	AbstractHistoryEntry {parent}
+{
+	stream >> row >> oldState >> newState;
+}
+
+qint64 EditHistoryEntry::memoryUsage() const
+{
+	return sizeof *this + archiveSize(oldState) + archiveSize(newState);
+}
+
+AbstractHistoryEntry::Type EditHistoryEntry::type() const
+{
+	return Edit;
+}
+
+void EditHistoryEntry::write(QDataStream& stream) const
+{
+	stream << qint32(type()) << row << oldState << newState;
+}
+
 void EditHistoryEntry::undo()
 {
 	parent()->document()->setObjectAt(row, oldState);
@@ -190,6 +411,27 @@ MoveHistoryEntry::MoveHistoryEntry(int top, int bottom, int destination, EditHis
 	bottom {bottom},
 	destination {destination} {}
 
+MoveHistoryEntry::MoveHistoryEntry(QDataStream& stream, EditHistory* parent) :
+	AbstractHistoryEntry {parent}
+{
+	stream >> top >> bottom >> destination;
+}
+
+qint64 MoveHistoryEntry::memoryUsage() const
+{
+	return sizeof *this;
+}
+
+AbstractHistoryEntry::Type MoveHistoryEntry::type() const
+{
+	return Move;
+}
+
+void MoveHistoryEntry::write(QDataStream& stream) const
+{
+	stream << qint32(type()) << top << bottom << destination;
+}
+
 void MoveHistoryEntry::undo()
 {
 	bool downwards = (destination < top);
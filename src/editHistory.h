@@ -17,12 +17,18 @@
  */
 
 #pragma once
+#include <QDataStream>
 #include "main.h"
 #include "serializer.h"
 #include "linetypes/modelobject.h"
 
 class AbstractHistoryEntry;
+class QTemporaryFile;
 
+/*
+ * The undo history of a document. To keep its memory use within the configured budget, the changesets farthest from
+ * the current position are compressed and spilled into a temporary file, and read back when undo or redo reaches them.
+ */
 class EditHistory : public QObject
 {
 	Q_OBJECT
@@ -41,14 +47,16 @@ public:
 	}
 
 	void addStep();
-	const Changeset& changesetAt (int pos) const;
+	const Changeset& changesetAt (int pos);
 	void clear();
 	LDDocument* document() const;
 	bool isIgnoring() const;
+	qint64 memoryUsage() const;
 	int position();
 	void redo();
 	void setIgnoring (bool value);
 	int size() const;
+	qint64 spilledSize() const;
 	void undo();
 
 signals:
@@ -57,43 +65,78 @@ signals:
 	void stepAdded();
 
 private:
+	struct StoredChangeset
+	{
+		Changeset entries; // Empty while the changeset is spilled
+		qint64 memoryUsage = 0;
+		qint64 fileOffset = -1; // Where the changeset was spilled, if it ever was
+		qint64 fileLength = 0;
+	};
+
+	void enforceMemoryBudget();
+	bool spill(StoredChangeset& changeset);
+
 	LDDocument* m_document;
 	Changeset m_currentChangeset;
-	QVector<Changeset> m_changesets;
+	QVector<StoredChangeset> m_changesets;
 	bool m_isIgnoring;
 	int m_position;
+	qint64 m_memoryUsage = 0;
+	qint64 m_spilledSize = 0;
+	QTemporaryFile* m_spillFile = nullptr;
 };
 
 class AbstractHistoryEntry
 {
 public:
+	enum Type
+	{
+		Add,
+		Del,
+		Edit,
+		Move,
+	};
+
 	AbstractHistoryEntry(EditHistory* parent);
 	virtual ~AbstractHistoryEntry();
 
 	EditHistory* parent() const;
+	virtual qint64 memoryUsage() const = 0;
 	virtual void redo() = 0;
+	virtual Type type() const = 0;
 	virtual void undo() = 0;
+	virtual void write(QDataStream& stream) const = 0;
+
+	static AbstractHistoryEntry* read(QDataStream& stream, EditHistory* parent);
 
 private:
 	EditHistory* const m_parent;
 };
 
+/*
+ * Records the insertion of a block of rows.
+ */
 class AddHistoryEntry : public AbstractHistoryEntry
 {
 public:
-	AddHistoryEntry (const QModelIndex& index, EditHistory* parent);
+	AddHistoryEntry (int first, int last, EditHistory* parent);
+	AddHistoryEntry (QDataStream& stream, EditHistory* parent);
+	qint64 memoryUsage() const override;
+	Type type() const override;
 	void undo() override;
 	void redo() override;
+	void write(QDataStream& stream) const override;
 	
 private:
 	int m_row;
-	Serializer::Archive m_code;
+	QVector<Serializer::Archive> m_codes;
 };
 
 class DelHistoryEntry : public AddHistoryEntry
 {
 public:
 	using AddHistoryEntry::AddHistoryEntry;
+	Type type() const override;
 	void undo() override;
 	void redo() override;
 };
@@ -107,8 +150,12 @@ public:
 		const Serializer::Archive& newCode,
 		EditHistory* parent
 	);
+	EditHistoryEntry(QDataStream& stream, EditHistory* parent);
+	qint64 memoryUsage() const override;
+	Type type() const override;
 	void undo() override;
 	void redo() override;
+	void write(QDataStream& stream) const override;
 	
 private:
 	int row;
@@ -120,8 +167,12 @@ class MoveHistoryEntry : public AbstractHistoryEntry
 {
 public:
 	MoveHistoryEntry(int top, int bottom, int destination, EditHistory* parent);
+	MoveHistoryEntry(QDataStream& stream, EditHistory* parent);
+	qint64 memoryUsage() const override;
+	Type type() const override;
 	void undo() override;
 	void redo() override;
+	void write(QDataStream& stream) const override;
 
 private:
 	int top;
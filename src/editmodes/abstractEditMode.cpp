@@ -117,7 +117,27 @@ bool AbstractDrawMode::mouseReleased(MouseEventData const& data)
 		Vertex cursorPosition = renderer()->currentCamera().convert2dTo3d(data.ev->pos());
 		QPoint cursorPosition2D = data.ev->pos();
 		const Axis depthAxis = renderer()->getRelativeZ();
-		QVector<Vertex> vertices = currentDocument()->inlineVertices().toList().toVector();
+		Vertex minimum {-inf, -inf, -inf};
+		Vertex maximum {inf, inf, inf};
+
+		// Only the vertices that are at most 64 pixels away from the cursor can be picked, so look them up from the
+		// box that these pixels cover. The depth of the box is unbounded.
+		if (not renderer()->currentCamera().isModelview())
+		{
+			Vertex corner1 = renderer()->currentCamera().convert2dTo3d(cursorPosition2D - QPoint {64, 64});
+			Vertex corner2 = renderer()->currentCamera().convert2dTo3d(cursorPosition2D + QPoint {64, 64});
+
+			for (Axis axis : {X, Y, Z})
+			{
+				if (axis != depthAxis)
+				{
+					minimum[axis] = qMin(corner1[axis], corner2[axis]);
+					maximum[axis] = qMax(corner1[axis], corner2[axis]);
+				}
+			}
+		}
+
+		QVector<Vertex> vertices = currentDocument()->vertexIndex().verticesInBox(minimum, maximum);
 
 		// Sort the vertices in order of distance to camera
 		sort(vertices.begin(), vertices.end(), [&](const Vertex& a, const Vertex& b) -> bool
@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <QMouseEvent>
 #include "magicWandMode.h"
 #include "../lddocument.h"
@@ -23,115 +24,102 @@
 #include "../canvas.h"
 
 MagicWandMode::MagicWandMode(Canvas* canvas) :
-	Super {canvas}
-{
-	QSet<LineSegment> boundarySegments;
-
-	// Get vertex<->object data
-	for (const QModelIndex& index : currentDocument()->indices())
-	{
-		// Note: this deliberately only takes vertex-objects into account.
-		// The magic wand does not process subparts.
-		LDObject* object = currentDocument()->lookup(index);
-
-		for (int i = 0; i < object->numVertices(); ++i)
-		{
-			LineSegment segment {
-				object->vertex(i),
-				object->vertex((i + 1) % object->numVertices())
-			};
-			m_vertices[object->vertex(i)].insert(index);
-
-			if (object->type() == LDObjectType::EdgeLine)
-				boundarySegments.insert(segment);
-			else
-				this->segments[segment].insert(index);
-		}
-	}
-
-	// Remove all edge lines from the set of available segments because they get in the way.
-	for (const LineSegment& boundarySegment : boundarySegments)
-		this->segments.remove(boundarySegment);
-}
+	Super {canvas} {}
 
 EditModeType MagicWandMode::type() const
 {
 	return EditModeType::MagicWand;
 }
 
-void MagicWandMode::edgeFill(
-	QModelIndex index,
-	QItemSelection& selection,
-	QSet<QModelIndex>& processed
-) const {
-	QItemSelection result;
-	processed.insert(index);
-	result.select(index, index);
-	QSet<QPersistentModelIndex> candidates;
-	LDObject* object = currentDocument()->lookup(index);
-
-	// Get the list of objects that touch this object, i.e. share a vertex with it.
-	for (int i = 0; i < object->numVertices(); ++i)
-		candidates |= m_vertices[object->vertex(i)];
-
-	candidates.remove(index);
+/*
+ * Returns the edge lines of the same color that are connected to the given edge line through their vertices.
+ */
+QVector<LDObject*> MagicWandMode::edgeFill(LDObject* start) const
+{
+	QVector<LDObject*> result {start};
+	QSet<LDObject*> processed {start};
 
-	for (const QModelIndex& candidate : candidates)
+	// Go through the objects in the result as they are found, rather than recursing.
+	for (int i = 0; i < result.size(); i += 1)
 	{
-		LDObject* candidateObject = currentDocument()->lookup(candidate);
-
-		if (candidateObject->type() == LDObjectType::EdgeLine
-			and candidateObject->color() == object->color()
-		) {
-			selection.select(candidate, candidate);
+		LDObject* object = result[i];
 
-			if (not processed.contains(candidate))
-				edgeFill(candidate, selection, processed);
+		for (int j = 0; j < object->numVertices(); j += 1)
+		{
+			for (LDObject* candidate : currentDocument()->vertexIndex().objectsAt(object->vertex(j)))
+			{
+				if (candidate->type() == LDObjectType::EdgeLine
+					and candidate->color() == object->color()
+					and not processed.contains(candidate)
+				) {
+					processed.insert(candidate);
+					result.append(candidate);
+				}
+			}
 		}
 	}
+
+	return result;
 }
 
-void MagicWandMode::surfaceFill(
-	QModelIndex index,
-	QItemSelection& selection,
-	QSet<QModelIndex>& processed
-) const {
-	LDObject* object = currentDocument()->lookup(index);
-	selection.select(index, index);
-	processed.insert(index);
+/*
+ * Returns the polygons of the same color that are connected to the given polygon through edges without edge lines.
+ */
+QVector<LDObject*> MagicWandMode::surfaceFill(LDObject* start) const
+{
+	QVector<LDObject*> result {start};
+	QSet<LDObject*> processed {start};
+	const AdjacencyGraph& adjacency = currentDocument()->adjacency();
 
-	for (int i = 0; i < object->numVertices(); i += 1)
+	for (int i = 0; i < result.size(); i += 1)
 	{
-		Vertex v_1 = object->vertex(i);
-		Vertex v_2 = object->vertex((i + 1) % object->numVertices());
-		LineSegment segment {v_1, v_2};
+		LDObject* object = result[i];
 
-		for (const QModelIndex& candidate : this->segments[segment])
+		for (LDObject* candidate : adjacency.neighbours(object))
 		{
-			if (currentDocument()->lookup(candidate)->color() == object->color())
+			if (candidate->color() == object->color() and not processed.contains(candidate))
 			{
-				selection.select(candidate, candidate);
-
-				if (not processed.contains(candidate))
-					surfaceFill(candidate, selection, processed);
+				processed.insert(candidate);
+				result.append(candidate);
 			}
 		}
 	}
+
+	return result;
 }
 
 QItemSelection MagicWandMode::doMagic(const QModelIndex& index) const
 {
 	QItemSelection selection;
 	LDObject* object = currentDocument()->lookup(index);
+	QVector<LDObject*> objects;
 
 	if (object)
 	{
-		QSet<QModelIndex> processed;
-
 		if (object->type() == LDObjectType::EdgeLine)
-			edgeFill(index, selection, processed);
+			objects = edgeFill(object);
 		else if (object->numPolygonVertices() >= 3)
-			surfaceFill(index, selection, processed);
+			objects = surfaceFill(object);
+	}
+
+	// Select consecutive rows as one range each.
+	QVector<int> rows;
+	rows.reserve(objects.size());
+
+	for (LDObject* object : objects)
+		rows.append(currentDocument()->indexOf(object).row());
+
+	std::sort(rows.begin(), rows.end());
+
+	for (int i = 0; i < rows.size();)
+	{
+		int first = i;
+
+		while (i + 1 < rows.size() and rows[i + 1] == rows[i] + 1)
+			i += 1;
+
+		selection.select(currentDocument()->index(rows[first]), currentDocument()->index(rows[i]));
+		i += 1;
 	}
 
 	return selection;
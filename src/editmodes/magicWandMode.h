@@ -19,14 +19,10 @@
 #pragma once
 #include "abstractEditMode.h"
 #include "../basics.h"
-#include "../geometry/linesegment.h"
-#include <QMap>
 #include <QVector>
 
 class MagicWandMode : public AbstractSelectMode
 {
-	QMap<Vertex, QSet<QPersistentModelIndex>> m_vertices;
-	QMap<LineSegment, QSet<QPersistentModelIndex>> segments;
 	QItemSelection m_selection;
 
 	DEFINE_CLASS (MagicWandMode, AbstractSelectMode)
@@ -39,12 +35,6 @@ public:
 	virtual bool mouseReleased(MouseEventData const& data) override;
 
 private:
-	void edgeFill(
-		QModelIndex index,
-		QItemSelection& selection,
-		QSet<QModelIndex>& processed) const;
-	void surfaceFill(
-		QModelIndex index,
-		QItemSelection& selection,
-		QSet<QModelIndex>& processed) const;
+	QVector<LDObject*> edgeFill(LDObject* start) const;
+	QVector<LDObject*> surfaceFill(LDObject* start) const;
 };
@@ -0,0 +1,105 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "edittransaction.h"
+#include "model.h"
+
+static thread_local EditTransaction* currentTransaction = nullptr;
+
+EditTransaction::EditTransaction(Model* model) :
+	m_model {model}
+{
+	if (currentTransaction == nullptr)
+		currentTransaction = this;
+}
+
+EditTransaction::~EditTransaction()
+{
+	commit();
+}
+
+/*
+ * Returns the open transaction of this thread, if any.
+ */
+EditTransaction* EditTransaction::current()
+{
+	return currentTransaction;
+}
+
+/*
+ * Archives an object that is about to be changed, unless it has already been changed during this transaction.
+ */
+void EditTransaction::recordObject(LDObject* object)
+{
+	auto iterator = m_recordIndices.find(object);
+
+	// The address may also belong to an object that has been deleted during the transaction.
+	if (iterator == m_recordIndices.end() or m_records[*iterator].object != object)
+	{
+		m_recordIndices[object] = m_records.size();
+		m_records.append({object, Serializer::store(object)});
+	}
+}
+
+/*
+ * Ends the transaction and announces the changes. Further changes are announced as they are made.
+ */
+void EditTransaction::commit()
+{
+	if (currentTransaction != this)
+		return;
+
+	// Close the transaction first, so that whatever reacts to the changes can make changes of its own.
+	currentTransaction = nullptr;
+	QVector<Change> changes;
+
+	for (Record& record : m_records)
+	{
+		LDObject* object = record.object;
+
+		// Objects that have been deleted during the transaction have nothing left to announce.
+		if (object == nullptr)
+			continue;
+
+		Serializer::Archive& before = record.before;
+		Serializer::Archive after = Serializer::store(object);
+
+		if (before == after)
+			continue;
+
+		QModelIndex index = m_model ? m_model->indexOf(object) : QModelIndex {};
+
+		if (index.isValid())
+			changes.append({object, index.row(), before, after});
+		else
+			emit object->modified(before, after);
+	}
+
+	m_records.clear();
+	m_recordIndices.clear();
+
+	if (not changes.isEmpty())
+	{
+		std::sort(changes.begin(), changes.end(), [](const Change& one, const Change& other)
+		{
+			return one.row < other.row;
+		});
+		m_model->commitChanges(changes);
+	}
+}
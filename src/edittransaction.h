@@ -0,0 +1,73 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QHash>
+#include <QPointer>
+#include <QVector>
+#include "serializer.h"
+
+class LDObject;
+class Model;
+
+/*
+ * Groups the changes made to objects while it exists. Instead of archiving and announcing every change of every
+ * property, each object is archived once when it is first changed, and the changes are announced when the transaction
+ * ends: the objects of the model of the transaction are handed to the model all at once, other objects announce their
+ * changes one by one.
+ *
+ * Transactions apply to the thread that creates them. A transaction created while another one is open joins the
+ * outer one.
+ */
+class EditTransaction
+{
+public:
+	/*
+	 * A change of an object of the model of the transaction.
+	 */
+	struct Change
+	{
+		LDObject* object;
+		int row;
+		Serializer::Archive before;
+		Serializer::Archive after;
+	};
+
+	EditTransaction(Model* model);
+	EditTransaction(const EditTransaction& other) = delete;
+	~EditTransaction();
+
+	void commit();
+	void recordObject(LDObject* object);
+
+	static EditTransaction* current();
+
+private:
+	/*
+	 * An object changed during the transaction, as it was before the change.
+	 */
+	struct Record
+	{
+		QPointer<LDObject> object;
+		Serializer::Archive before;
+	};
+
+	Model* const m_model;
+	QVector<Record> m_records;
+	QHash<LDObject*, int> m_recordIndices;
+};
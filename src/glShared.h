@@ -17,6 +17,7 @@
  */
 
 #pragma once
+#include <cstddef>
 #include <QOpenGLFunctions>
 #include <QGenericMatrix>
 #include "basics.h"
@@ -24,6 +25,10 @@
 #include "generics/enums.h"
 #include "types/vertex.h"
 
+#ifndef GL_INT_2_10_10_10_REV
+# define GL_INT_2_10_10_10_REV 0x8D9F
+#endif
+
 class LDObject;
 
 namespace gl
@@ -51,6 +56,7 @@ namespace gl
 
 	class Renderer;
 	class Compiler;
+	class PickingTree;
 
 	static const QPen thinBorderPen {QColor {0, 0, 0, 208}, 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin};
 
@@ -129,14 +135,10 @@ MAKE_ITERABLE_ENUM(VboClass)
 
 enum class VboSubclass
 {
-	Surfaces,
 	RegularColors,
-	PickColors,
 	BfcFrontColors,
 	BfcBackColors,
 	RandomColors,
-	Normals,
-	InvertedNormals,
 	_End
 };
 
@@ -144,5 +146,21 @@ MAKE_ITERABLE_ENUM(VboSubclass)
 
 enum
 {
-	NumVbos = EnumLimits<VboClass>::Count * EnumLimits<VboSubclass>::Count
+	NumVbos = EnumLimits<VboClass>::Count
+};
+
+/*
+ * A vertex as stored in the VBOs of the compiler. Every vertex carries its color in each VBO subclass, and the
+ * renderer picks the subclass to draw by the offset of its color.
+ */
+struct VboVertex
+{
+	GLfloat position[3];
+	GLuint normal; // Packed as GL_INT_2_10_10_10_REV, or as three GL_BYTEs where that type is unsupported
+	GLubyte colors[EnumLimits<VboSubclass>::Count][4]; // RGBA
+
+	static std::size_t colorOffset(VboSubclass subclass)
+	{
+		return offsetof(VboVertex, colors) + static_cast<int>(subclass) * sizeof(colors[0]);
+	}
 };
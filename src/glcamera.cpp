@@ -292,12 +292,59 @@ QMatrix4x4 GLCamera::realMatrix() const
 		0, 0, 0, 1
 	};
 
-	QMatrix4x4 panningMatrix {
+	return ortho * panningMatrix() * m_rotationMatrix;
+}
+
+QMatrix4x4 GLCamera::panningMatrix() const
+{
+	return {
 		1, 0, 0, float(m_panningX),
 		0, 1, 0, float(m_panningY),
 		0, 0, 1, 0,
 		0, 0, 0, 1
 	};
+}
+
+/*
+ * Returns the smallest zoom at which the given points, in GL coordinates, fit into the view of this fixed camera at
+ * its current panning. The zoom is the half-width of the view, and the half-height follows from the aspect ratio.
+ */
+double GLCamera::fittingZoom(const QVector<QVector3D>& points) const
+{
+	const QMatrix4x4 matrix = panningMatrix() * m_rotationMatrix * gl::ldrawToGLAdapterMatrix;
+	const double aspectRatio = double(m_size.width()) / m_size.height();
+	double result = 0;
+
+	for (const QVector3D& point : points)
+	{
+		QVector3D projected = matrix.map(point);
+		result = qMax(result, qAbs(double(projected.x())));
+		result = qMax(result, qAbs(projected.y()) * aspectRatio);
+	}
+
+	return result;
+}
+
+/*
+ * Pans this fixed camera so that the projection of the given points, in GL coordinates, is centered in the view, and
+ * then zooms it so that they fit into the view.
+ */
+void GLCamera::fitToView(const QVector<QVector3D>& points)
+{
+	if (points.isEmpty())
+		return;
+
+	const QMatrix4x4 matrix = m_rotationMatrix * gl::ldrawToGLAdapterMatrix;
+	QVector3D minimum = matrix.map(points[0]);
+	QVector3D maximum = minimum;
+
+	for (const QVector3D& point : points)
+	{
+		QVector3D projected = matrix.map(point);
+		minimum = {qMin(minimum.x(), projected.x()), qMin(minimum.y(), projected.y()), 0};
+		maximum = {qMax(maximum.x(), projected.x()), qMax(maximum.y(), projected.y()), 0};
+	}
 
-	return ortho * panningMatrix * m_rotationMatrix;
+	setPanning(-(minimum.x() + maximum.x()) / 2, -(minimum.y() + maximum.y()) / 2);
+	setZoom(qBound(0.01, fittingZoom(points), 10000.0));
 }
@@ -51,6 +51,8 @@ public:
 	Vertex realize(const Vertex& idealCoordinates) const;
 	Vertex idealize(const Vertex& realCoordinates) const;
 	double depth() const;
+	double fittingZoom(const QVector<QVector3D>& points) const;
+	void fitToView(const QVector<QVector3D>& points);
 	bool isModelview() const;
 	bool isAxisNegated(Axis axis) const;
 	const QString& name() const;
@@ -68,6 +70,8 @@ public:
 	QMatrix4x4 realMatrix() const;
 
 private:
+	QMatrix4x4 panningMatrix() const;
+
 	QString m_name;
 	double m_panningX = 0;
 	double m_panningY = 0;
@@ -19,13 +19,49 @@
 #define GL_GLEXT_PROTOTYPES
 #include <GL/glu.h>
 #include <GL/glext.h>
+#include <algorithm>
+#include <cstring>
+#include <QMutex>
+#include <QOpenGLContext>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
 #include "glcompiler.h"
 #include "guiutilities.h"
 #include "documentmanager.h"
+#include "lddocument.h"
 #include "grid.h"
 #include "algorithms/invert.h"
 #include "generics/ring.h"
 
+// Below this many objects, compiling them on this thread is faster than handing them out to the thread pool.
+static const int parallelCompilationThreshold = 256;
+
+/*
+ * Runs a function on a thread pool.
+ */
+template<typename Function>
+class FunctionRunnable : public QRunnable
+{
+public:
+	FunctionRunnable(Function function) :
+		m_function {function} {}
+
+	void run() override
+	{
+		m_function();
+	}
+
+private:
+	Function m_function;
+};
+
+template<typename Function>
+static QRunnable* makeRunnable(Function function)
+{
+	return new FunctionRunnable<Function> {function};
+}
+
 void checkGLError(QString file, int line)
 {
 	struct ErrorInfo
@@ -70,8 +106,15 @@ void checkGLError(QString file, int line)
  */
 gl::Compiler::Compiler(gl::Renderer* renderer) :
 	HierarchyElement(renderer),
+	m_compactionTimer(new QTimer(this)),
+	m_threadPool(new QThreadPool(this)),
 	m_renderer(renderer)
 {
+	// Compaction rewrites the VBOs in full, so it waits until editing has paused.
+	m_compactionTimer->setSingleShot(true);
+	m_compactionTimer->setInterval(1000);
+	connect(m_compactionTimer, SIGNAL(timeout()), this, SLOT(compactVbos()));
+
 	connect(
 		renderer->model(),
 		SIGNAL(rowsInserted(QModelIndex, int, int)),
@@ -111,7 +154,16 @@ gl::Compiler::Compiler(gl::Renderer* renderer) :
 void gl::Compiler::initialize()
 {
 	initializeOpenGLFunctions();
-	glGenBuffers(countof(m_vbo), &m_vbo[0]);
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+
+	// Packed normals need OpenGL 3.3 or an extension; older contexts get byte normals instead.
+	if (context->format().version() >= qMakePair(3, 3) or context->hasExtension("GL_ARB_vertex_type_2_10_10_10_rev"))
+		m_normalType = GL_INT_2_10_10_10_REV;
+	else
+		m_normalType = GL_BYTE;
+
+	glGenBuffers(countof(m_objectVbos.vbos), &m_objectVbos.vbos[0]);
+	glGenBuffers(countof(m_sharedVbos.vbos), &m_sharedVbos.vbos[0]);
 	CHECK_GL_ERROR();
 }
 
@@ -120,44 +172,31 @@ void gl::Compiler::initialize()
  */
 gl::Compiler::~Compiler()
 {
-	glDeleteBuffers(countof(m_vbo), &m_vbo[0]);
+	glDeleteBuffers(countof(m_objectVbos.vbos), &m_objectVbos.vbos[0]);
+	glDeleteBuffers(countof(m_sharedVbos.vbos), &m_sharedVbos.vbos[0]);
 	CHECK_GL_ERROR();
 }
 
-/*
- * Returns an index color for the LDObject ID given. This color represents the object in the picking scene.
- */
-QColor gl::Compiler::indexColorForID (qint32 id) const
-{
-	// Calculate a color based from this index. This method caters for
-	// 16777216 objects. I don't think that will be exceeded anytime soon. :)
-	int r = (id / 0x10000) % 0x100;
-	int g = (id / 0x100) % 0x100;
-	int b = id % 0x100;
-	return {r, g, b};
-}
-
 /*
  * Returns the suitable color for the polygon.
  * - polygon is the polygon to colorise.
- * - polygonOwner is the LDObject from which the polygon originated.
+ * - owner describes the LDObject from which the polygon originated, or is null for shared geometry.
+ * - settings is the snapshot of the configuration to compile with.
  * - subclass provides context for the polygon.
+ *
+ * This only reads its arguments, so it can be called from any thread.
  */
 QColor gl::Compiler::getColorForPolygon(
 	const LDPolygon& polygon,
-	const QModelIndex& polygonOwnerIndex,
+	const PolygonOwner* owner,
+	const CompilationSettings& settings,
 	VboSubclass subclass
 ) {
 	QColor color;
-	LDObject* polygonOwner = m_renderer->model()->lookup(polygonOwnerIndex);
 
 	switch (subclass)
 	{
-	case VboSubclass::Surfaces:
-	case VboSubclass::Normals:
-	case VboSubclass::InvertedNormals:
 	case VboSubclass::_End:
-		// Surface and normal VBOs contain vertex data, not colors. So we can't return anything meaningful.
 		return {};
 
 	case VboSubclass::BfcFrontColors:
@@ -168,34 +207,31 @@ QColor gl::Compiler::getColorForPolygon(
 		// Use the constant red color for BFC back colors
 		return {208, 64, 64};
 
-	case VboSubclass::PickColors:
-		// For the picking scene, use unique picking colors provided by the model.
-		return m_renderer->model()->pickingColorForObject(polygonOwnerIndex);
-
 	case VboSubclass::RandomColors:
 		// For the random color scene, the owner object has rolled up a random color. Use that.
-		color = polygonOwner->randomColor();
+		if (owner)
+			color = owner->randomColor;
 		break;
 
 	case VboSubclass::RegularColors:
 		// For normal colors, use the polygon's color.
-		if (LDColor {polygon.color} == MainColor)
+		if (LDColor {polygon.color} == MainColor and owner)
 		{
 			// If it's the main color, use the polygon owner's color.
-			if (polygonOwner->color() == MainColor)
+			if (owner->color == MainColor)
 			{
 				// If that also is the main color, then we whatever the user has configured the main color to look like.
-				color = mainColorRepresentation();
+				color = settings.mainColor;
 			}
 			else
 			{
-				color = polygonOwner->color().faceColor();
+				color = owner->color.faceColor();
 			}
 		}
 		else if (LDColor {polygon.color} == EdgeColor)
 		{
 			// Edge color is black, unless we have a dark background, in which case lines need to be bright.
-			color = luma(config::backgroundColor()) > 40 ? Qt::black : Qt::white;
+			color = settings.edgeColor;
 		}
 		else
 		{
@@ -208,16 +244,11 @@ QColor gl::Compiler::getColorForPolygon(
 	if (color.isValid())
 	{
 		// We may wish to apply blending on the color to indicate selection or highlight.
-		double blendAlpha = 0.0;
-
-		if (this->_selectionModel and this->_selectionModel->isSelected(polygonOwnerIndex))
-			blendAlpha = 1.0;
-		else if (polygonOwnerIndex == m_renderer->objectAtCursor())
-			blendAlpha = 0.5;
+		double blendAlpha = owner ? owner->blendAlpha : 0.0;
 
 		if (blendAlpha != 0.0)
 		{
-			QColor selectedColor = config::selectColorBlend();
+			const QColor& selectedColor = settings.selectionColor;
 			double denominator = blendAlpha + 1.0;
 			color.setRed((color.red() + (selectedColor.red() * blendAlpha)) / denominator);
 			color.setGreen((color.green() + (selectedColor.green() * blendAlpha)) / denominator);
@@ -228,12 +259,15 @@ QColor gl::Compiler::getColorForPolygon(
 	{
 		// The color was unknown. Use main color to make the polygon at least not appear pitch-black.
 		if (polygon.type != LDPolygon::Type::EdgeLine and polygon.type != LDPolygon::Type::ConditionalEdge)
-			color = mainColorRepresentation();
+			color = settings.mainColor;
 		else
 			color = Qt::black;
 
 		// Warn about the unknown color, but only once.
 		static QSet<LDColor> warnedColors;
+		static QMutex warnedColorsMutex;
+		QMutexLocker locker {&warnedColorsMutex};
+
 		if (not warnedColors.contains(polygon.color))
 		{
 			print(tr("Unknown color %1!\n"), polygon.color);
@@ -245,12 +279,40 @@ QColor gl::Compiler::getColorForPolygon(
 }
 
 /*
- * Tells the compiler that a merge of VBOs is required.
+ * Takes a snapshot of the configuration that the colors of the polygons depend on, so that compiling does not need
+ * to read the configuration for every polygon, nor from other threads.
+ */
+gl::Compiler::CompilationSettings gl::Compiler::compilationSettings() const
+{
+	CompilationSettings settings;
+	settings.winding = m_renderer->model()->winding();
+	settings.mainColor = mainColorRepresentation();
+	settings.edgeColor = luma(config::backgroundColor()) > 40 ? Qt::black : Qt::white;
+	settings.selectionColor = config::selectColorBlend();
+	settings.normalType = m_normalType;
+	return settings;
+}
+
+/*
+ * Gathers what the colors of the polygons of the given object depend on.
  */
-void gl::Compiler::needMerge()
+gl::Compiler::PolygonOwner gl::Compiler::polygonOwner(const QModelIndex& index) const
 {
-	for (int i = 0; i < countof (m_vboChanged); ++i)
-		m_vboChanged[i] = true;
+	PolygonOwner owner;
+	LDObject* object = m_renderer->model()->lookup(index);
+
+	if (object)
+	{
+		owner.color = object->color();
+		owner.randomColor = object->randomColor();
+	}
+
+	if (this->_selectionModel and this->_selectionModel->isSelected(index))
+		owner.blendAlpha = 1.0;
+	else if (index.isValid() and index == m_renderer->objectAtCursor())
+		owner.blendAlpha = 0.5;
+
+	return owner;
 }
 
 /*
@@ -270,55 +332,414 @@ void gl::Compiler::unstage(const QModelIndex& index)
 }
 
 /*
- * Compiles all staged objects.
+ * Compiles all staged objects. Everything that involves documents or the state of the compiler is done on this
+ * thread, while the polygons of the objects are rasterized and turned into vertices on the thread pool.
  */
 void gl::Compiler::compileStaged()
 {
-	for (const QModelIndex& index : m_staged)
-		compileObject(index);
+	if (m_staged.isEmpty())
+		return;
+
+	const CompilationSettings settings = compilationSettings();
+	QVector<Compilation> compilations;
+	compilations.reserve(m_staged.size());
+
+	for (const QPersistentModelIndex& index : m_staged)
+	{
+		Compilation compilation;
+		compilation.object = m_renderer->model()->lookup(index);
+
+		if (compilation.object == nullptr)
+			continue;
+
+		compilation.index = index;
+		compilation.owner = polygonOwner(index);
+		compilation.info.isHidden = compilation.object->isHidden();
+
+		if (not compileInstance(index, compilation.owner, settings, compilation.info)
+			and compilation.object->type() == LDObjectType::SubfileReference)
+		{
+			// Subfile references need to look up their documents, so they are rasterized here.
+			compilation.polygons = compilation.object->rasterizePolygons(m_documents, settings.winding);
+		}
+
+		compilations.append(compilation);
+	}
 
 	m_staged.clear();
+	Compilation* data = compilations.data();
+	const int count = countof(compilations);
+	DocumentManager* documents = m_documents;
+
+	if (count < parallelCompilationThreshold)
+	{
+		for (int i = 0; i < count; ++i)
+			compileVertices(data[i], settings, documents);
+	}
+	else
+	{
+		const int chunkCount = 4 * qMax(1, m_threadPool->maxThreadCount());
+		const int chunkSize = (count + chunkCount - 1) / chunkCount;
+
+		for (int first = 0; first < count; first += chunkSize)
+		{
+			const int last = qMin(first + chunkSize, count);
+			m_threadPool->start(makeRunnable([data, first, last, &settings, documents]()
+			{
+				for (int i = first; i < last; ++i)
+					compileVertices(data[i], settings, documents);
+			}));
+		}
+
+		m_threadPool->waitForDone();
+	}
+
+	for (Compilation& compilation : compilations)
+		installCompilation(compilation);
+}
+
+/*
+ * Turns the polygons of an object into vertices, rasterizing it first unless it is an instance or it was rasterized
+ * already. This only reads the object, so it can be called from any thread.
+ */
+void gl::Compiler::compileVertices(
+	Compilation& compilation,
+	const CompilationSettings& settings,
+	DocumentManager* documents
+) {
+	LDObject* object = compilation.object;
+
+	if (compilation.info.isInstance)
+		return;
+
+	switch (object->type())
+	{
+	// Note: We cannot split quads into triangles here, it would mess up the
+	// wireframe view. Quads must go into separate vbos.
+	case LDObjectType::Triangle:
+	case LDObjectType::Quadrilateral:
+	case LDObjectType::EdgeLine:
+	case LDObjectType::ConditionalEdge:
+		compilation.polygons = {object->getPolygon()};
+		break;
+
+	case LDObjectType::SubfileReference:
+		break;
+
+	default:
+		if (object->isRasterizable())
+			compilation.polygons = object->rasterizePolygons(documents, settings.winding);
+		break;
+	}
+
+	for (LDPolygon& polygon : compilation.polygons)
+		compilePolygon(polygon, &compilation.owner, settings, compilation.info);
+}
+
+/*
+ * Hands out a range of the given amount of vertices and returns its first vertex. Reuses the first free range that
+ * is large enough, or appends the range to the end.
+ */
+int gl::Compiler::VboSlots::allocate(int count)
+{
+	for (auto iterator = freeRanges.begin(); iterator != freeRanges.end(); ++iterator)
+	{
+		if (iterator->second >= count)
+		{
+			int first = iterator->first;
+			int remaining = iterator->second - count;
+			freeRanges.erase(iterator);
+
+			if (remaining > 0)
+				freeRanges[first + count] = remaining;
+
+			freeCount -= count;
+			return first;
+		}
+	}
+
+	int first = size;
+	size += count;
+
+	if (size > capacity)
+		needsRebuild = true;
+
+	return first;
+}
+
+/*
+ * Returns whether enough of the range is free that it should be compacted.
+ */
+bool gl::Compiler::VboSlots::isFragmented() const
+{
+	return freeCount > 4096 and freeCount > size / 4;
+}
+
+/*
+ * Releases a range of vertices, merging it with neighbouring free ranges.
+ */
+void gl::Compiler::VboSlots::release(int first, int count)
+{
+	rangesToClear.append({first, count});
+	freeCount += count;
+	auto next = freeRanges.lower_bound(first);
+
+	if (next != freeRanges.end() and next->first == first + count)
+	{
+		count += next->second;
+		next = freeRanges.erase(next);
+	}
+
+	if (next != freeRanges.begin())
+	{
+		auto previous = std::prev(next);
+
+		if (previous->first + previous->second == first)
+		{
+			first = previous->first;
+			count += previous->second;
+			freeRanges.erase(previous);
+		}
+	}
+
+	if (first + count == size)
+	{
+		// The range is at the end, so it's not needed at all.
+		size = first;
+		freeCount -= count;
+	}
+	else
+	{
+		freeRanges[first] = count;
+	}
+}
+
+/*
+ * Returns the amount of vertices of the given class.
+ */
+int gl::Compiler::ObjectVboData::vertexCount(VboClass vboclass) const
+{
+	return countof(data[static_cast<int>(vboclass)]);
 }
 
 /*
- * Prepares a VBO for rendering. The VBO is merged if needed.
+ * Prepares the VBOs for rendering. Only the ranges of the objects that have changed are uploaded, unless the VBOs
+ * have run out of room or have been compacted.
  */
-void gl::Compiler::prepareVBO (int vbonum)
+void gl::Compiler::prepareVBOs()
 {
 	// Compile anything that still awaits it
 	compileStaged();
 
-	if (m_vboChanged[vbonum])
+	for (VboClass vboclass : iterateEnum<VboClass>())
 	{
-		// Merge the VBO into a vector of floats.
-		QVector<GLfloat> vbodata;
+		int classIndex = static_cast<int>(vboclass);
+
+		if (m_objectVbos.slots[classIndex].needsRebuild)
+		{
+			QVector<const ObjectVboData*> contents;
+
+			for (const ObjectVboData& info : m_objectInfo)
+				contents.append(&info);
+
+			rebuildVbos(m_objectVbos, vboclass, contents);
+		}
+
+		if (m_sharedVbos.slots[classIndex].needsRebuild)
+		{
+			QVector<const ObjectVboData*> contents;
+
+			for (const SharedGeometry& geometry : m_sharedGeometry)
+				contents.append(&geometry.data);
+
+			rebuildVbos(m_sharedVbos, vboclass, contents);
+		}
 
-		for (
-			auto iterator = m_objectInfo.begin();
-			iterator != m_objectInfo.end();
-		) {
-			if (not iterator.key().isValid())
+		// Clear released ranges so that they don't draw anything.
+		for (VboPool* pool : {&m_objectVbos, &m_sharedVbos})
+		{
+			for (const QPair<int, int>& range : pool->slots[classIndex].rangesToClear)
 			{
-				iterator = m_objectInfo.erase(iterator);
+				QVector<VboVertex> zeroes(range.second);
+				glBindBuffer(GL_ARRAY_BUFFER, pool->vbos[classIndex]);
+				glBufferSubData(
+					GL_ARRAY_BUFFER,
+					range.first * sizeof(VboVertex),
+					countof(zeroes) * sizeof(VboVertex),
+					zeroes.constData()
+				);
 			}
-			else
-			{
-				LDObject* object = m_renderer->model()->lookup(iterator.key());
-				if (not object->isHidden())
-					vbodata += iterator->data[vbonum];
 
-				++iterator;
-			}
+			pool->slots[classIndex].rangesToClear.clear();
+		}
+	}
+
+	for (const QPersistentModelIndex& index : m_dirtyObjects)
+	{
+		auto iterator = m_objectInfo.constFind(index);
+
+		if (iterator != m_objectInfo.constEnd())
+			uploadVertices(m_objectVbos, *iterator);
+	}
+
+	for (LDDocument* subfile : m_dirtySharedGeometry)
+	{
+		auto iterator = m_sharedGeometry.constFind(subfile);
+
+		if (iterator != m_sharedGeometry.constEnd())
+			uploadVertices(m_sharedVbos, iterator->data);
+	}
+
+	m_dirtyObjects.clear();
+	m_dirtySharedGeometry.clear();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+/*
+ * Uploads the vertices of an object into its ranges in the VBOs. Hidden objects upload zeroes instead.
+ */
+void gl::Compiler::uploadVertices(VboPool& pool, const ObjectVboData& objectInfo)
+{
+	for (VboClass vboclass : iterateEnum<VboClass>())
+	{
+		const int classIndex = static_cast<int>(vboclass);
+		const QVector<VboVertex>& data = objectInfo.data[classIndex];
+
+		if (data.isEmpty())
+			continue;
+
+		QVector<VboVertex> zeroes;
+
+		if (objectInfo.isHidden)
+			zeroes.resize(countof(data));
+
+		glBindBuffer(GL_ARRAY_BUFFER, pool.vbos[classIndex]);
+		glBufferSubData(
+			GL_ARRAY_BUFFER,
+			objectInfo.firstVertices[classIndex] * sizeof(VboVertex),
+			countof(data) * sizeof(VboVertex),
+			objectInfo.isHidden ? zeroes.constData() : data.constData()
+		);
+	}
+}
+
+/*
+ * Reallocates the VBOs of the given class, leaving room to grow, and uploads the given objects into them in full.
+ */
+void gl::Compiler::rebuildVbos(VboPool& pool, VboClass vboclass, const QVector<const ObjectVboData*>& contents)
+{
+	const int classIndex = static_cast<int>(vboclass);
+	VboSlots& slots = pool.slots[classIndex];
+	slots.capacity = qMax(1024, slots.size + slots.size / 2);
+	QVector<VboVertex> vbodata(slots.capacity);
+
+	for (const ObjectVboData* info : contents)
+	{
+		if (not info->isHidden)
+		{
+			const QVector<VboVertex>& data = info->data[classIndex];
+			std::copy(data.begin(), data.end(), vbodata.begin() + info->firstVertices[classIndex]);
+		}
+	}
+
+	// Transfer the VBO to the graphics processor.
+	glBindBuffer (GL_ARRAY_BUFFER, pool.vbos[classIndex]);
+	glBufferData (GL_ARRAY_BUFFER, countof(vbodata) * sizeof(VboVertex), vbodata.constData(), GL_DYNAMIC_DRAW);
+	slots.rangesToClear.clear();
+	slots.needsRebuild = false;
+}
+
+/*
+ * Gives the vertices of an object their ranges in the VBOs of the given pool. If the object had been compiled
+ * before, it keeps its previous ranges wherever the amount of vertices is the same.
+ */
+void gl::Compiler::placeVertices(VboPool& pool, ObjectVboData& objectInfo, const ObjectVboData* previousInfo)
+{
+	for (VboClass vboclass : iterateEnum<VboClass>())
+	{
+		int classIndex = static_cast<int>(vboclass);
+		VboSlots& slots = pool.slots[classIndex];
+		int count = objectInfo.vertexCount(vboclass);
+		int previousCount = previousInfo ? previousInfo->vertexCount(vboclass) : 0;
+
+		if (count == previousCount)
+		{
+			objectInfo.firstVertices[classIndex] = previousInfo ? previousInfo->firstVertices[classIndex] : 0;
+			continue;
 		}
 
-		// Transfer the VBO to the graphics processor.
-		glBindBuffer (GL_ARRAY_BUFFER, m_vbo[vbonum]);
-		glBufferData (GL_ARRAY_BUFFER, countof(vbodata) * sizeof(GLfloat), vbodata.constData(), GL_STATIC_DRAW);
-		glBindBuffer (GL_ARRAY_BUFFER, 0);
-		CHECK_GL_ERROR();
-		m_vboChanged[vbonum] = false;
-		m_vboSizes[vbonum] = countof(vbodata);
+		if (previousCount > 0)
+			slots.release(previousInfo->firstVertices[classIndex], previousCount);
+
+		if (count > 0)
+			objectInfo.firstVertices[classIndex] = slots.allocate(count);
+
+		if (slots.isFragmented())
+			m_compactionTimer->start();
+	}
+}
+
+/*
+ * Releases the ranges of an object in the VBOs of the given pool.
+ */
+void gl::Compiler::releaseVertices(VboPool& pool, const ObjectVboData& objectInfo)
+{
+	for (VboClass vboclass : iterateEnum<VboClass>())
+	{
+		VboSlots& slots = pool.slots[static_cast<int>(vboclass)];
+		int count = objectInfo.vertexCount(vboclass);
+
+		if (count > 0)
+			slots.release(objectInfo.firstVertices[static_cast<int>(vboclass)], count);
+
+		if (slots.isFragmented())
+			m_compactionTimer->start();
+	}
+}
+
+/*
+ * Packs the ranges of all objects tightly together. The VBOs are then uploaded in full the next time they are
+ * prepared.
+ */
+void gl::Compiler::compactVbos()
+{
+	for (VboClass vboclass : iterateEnum<VboClass>())
+	{
+		int classIndex = static_cast<int>(vboclass);
+		QVector<ObjectVboData*> objectContents;
+		QVector<ObjectVboData*> sharedContents;
+
+		for (ObjectVboData& info : m_objectInfo)
+			objectContents.append(&info);
+
+		for (SharedGeometry& geometry : m_sharedGeometry)
+			sharedContents.append(&geometry.data);
+
+		for (auto pair : {
+			qMakePair(&m_objectVbos.slots[classIndex], &objectContents),
+			qMakePair(&m_sharedVbos.slots[classIndex], &sharedContents)
+		}) {
+			VboSlots& slots = *pair.first;
+
+			if (slots.freeCount == 0)
+				continue;
+
+			slots.size = 0;
+
+			for (ObjectVboData* info : *pair.second)
+			{
+				info->firstVertices[classIndex] = slots.size;
+				slots.size += info->vertexCount(vboclass);
+			}
+
+			slots.freeCount = 0;
+			slots.freeRanges.clear();
+			slots.needsRebuild = true;
+		}
 	}
+
+	emit sceneChanged();
 }
 
 /*
@@ -326,13 +747,22 @@ void gl::Compiler::prepareVBO (int vbonum)
  */
 void gl::Compiler::dropObjectInfo(const QModelIndex& index)
 {
-	if (m_objectInfo.contains(index))
+	auto iterator = m_objectInfo.find(index);
+
+	if (iterator != m_objectInfo.end())
 	{
 		// If we have data relating to this object, remove it.
-		// The VBOs have changed now and need to be merged.
-		m_objectInfo.remove(index);
+		// Its ranges in the VBOs are released and cleared.
+		releaseVertices(m_objectVbos, *iterator);
+
+		if (iterator->isInstance)
+			releaseInstance(iterator->instance);
+
+		m_instances.remove(index);
+		m_dirtyObjects.remove(index);
+		m_pickingTree.remove(index);
+		m_objectInfo.erase(iterator);
 		this->needBoundingBoxRebuild = true;
-		needMerge();
 	}
 }
 
@@ -346,56 +776,252 @@ void gl::Compiler::forgetObject(QModelIndex index)
 }
 
 /*
- * Compiles a single object.
+ * Replaces the previous compilation of an object with a new one, keeping its ranges in the VBOs where possible.
  */
-void gl::Compiler::compileObject(const QModelIndex& index)
+void gl::Compiler::installCompilation(Compilation& compilation)
 {
+	const QPersistentModelIndex& index = compilation.index;
+	ObjectVboData& info = compilation.info;
+	auto previous = m_objectInfo.find(index);
+
+	if (previous != m_objectInfo.end())
+	{
+		placeVertices(m_objectVbos, info, &*previous);
+
+		if (previous->isInstance)
+			releaseInstance(previous->instance);
+
+		*previous = info;
+		this->needBoundingBoxRebuild = true;
+	}
+	else
+	{
+		placeVertices(m_objectVbos, info, nullptr);
+		m_objectInfo[index] = info;
+
+		// Add the object to the bounding box, unless we're going to do it over from scratch afterwards.
+		if (not this->needBoundingBoxRebuild)
+			considerObject(info);
+	}
+
+	if (info.isInstance and not info.isHidden)
+		m_instances[index] = info.instance;
+	else
+		m_instances.remove(index);
+
+	if (info.isHidden)
+		m_pickingTree.remove(index);
+	else if (info.isInstance)
+		m_pickingTree.setInstance(index, info.instance.subfile, info.instance.matrix);
+	else
+		m_pickingTree.setGeometry(index, info.data);
+
+	m_dirtyObjects.insert(index);
+}
+
+/*
+ * Tries to compile a subfile reference as an instance of its subfile. Returns whether it succeeded; if not, the
+ * reference must be compiled as polygons of its own.
+ */
+bool gl::Compiler::compileInstance(
+	const QModelIndex& index,
+	const PolygonOwner& owner,
+	const CompilationSettings& settings,
+	ObjectVboData& objectInfo
+) {
 	LDObject* object = m_renderer->model()->lookup(index);
 
-	if (object == nullptr)
+	if (object->type() != LDObjectType::SubfileReference)
+		return false;
+
+	// Selected and highlighted references have all of their colors blended, so they need their own copies.
+	if (owner.blendAlpha != 0.0)
+		return false;
+
+	LDSubfileReference* reference = static_cast<LDSubfileReference*>(object);
+	LDDocument* subfile = reference->fileInfo(m_documents);
+
+	if (subfile == nullptr)
+		return false;
+
+	compileSharedGeometry(subfile, settings);
+	m_sharedGeometry[subfile].instanceCount += 1;
+	Instance& instance = objectInfo.instance;
+	Winding winding = settings.winding;
+	QMatrix4x4 flip;
+	flip.scale(1, -1, -1);
+	objectInfo.isInstance = true;
+	instance.subfile = subfile;
+	instance.matrix = flip * reference->transformationMatrix() * flip;
+
+	// Rasterizing would invert the polygons if the reference inverts them, and again if the model is clockwise.
+	// The normals of those polygons would have been computed after the inversion and before any mirroring.
+	instance.invertedWinding = reference->shouldInvert(winding, m_documents) != (winding == Clockwise);
+	instance.invertedNormals = instance.invertedWinding != (reference->transformationMatrix().determinant() < 0);
+
+	LDPolygon mainColoredPolygon;
+	mainColoredPolygon.type = LDPolygon::Type::Triangle;
+	mainColoredPolygon.color = MainColor;
+
+	for (VboSubclass subclass : iterateEnum<VboSubclass>())
+		instance.colors[static_cast<int>(subclass)] = getColorForPolygon(mainColoredPolygon, &owner, settings, subclass);
+
+	return true;
+}
+
+/*
+ * Compiles the geometry of a subfile to be shared by its instances, unless it is up to date already.
+ */
+void gl::Compiler::compileSharedGeometry(LDDocument* subfile, const CompilationSettings& settings)
+{
+	SharedGeometry& geometry = m_sharedGeometry[subfile];
+	QVector<LDPolygon> polygons = subfile->inlinePolygons();
+
+	// The subfile replaces its polygon data whenever it changes.
+	if (geometry.polygons.isSharedWith(polygons))
 		return;
 
-	ObjectVboData info;
-	dropObjectInfo(index);
+	ObjectVboData data;
+	geometry.polygons = polygons;
+	geometry.boundingBox = {};
 
-	switch (object->type())
+	// Main-colored polygons come first so that instances can draw them in their own colors.
+	for (bool mainColored : {true, false})
 	{
-	// Note: We cannot split quads into triangles here, it would mess up the
-	// wireframe view. Quads must go into separate vbos.
-	case LDObjectType::Triangle:
-	case LDObjectType::Quadrilateral:
-	case LDObjectType::EdgeLine:
-	case LDObjectType::ConditionalEdge:
+		for (LDPolygon polygon : polygons)
 		{
-			LDPolygon polygon = object->getPolygon();
-			compilePolygon(polygon, index, info);
+			if ((LDColor {polygon.color} == MainColor) == mainColored)
+				compilePolygon(polygon, nullptr, settings, data);
 		}
-		break;
 
-	default:
-		if (object->isRasterizable())
+		for (VboClass vboclass : iterateEnum<VboClass>())
 		{
-			auto data = object->rasterizePolygons(m_documents, m_renderer->model()->winding());
+			const QVector<VboVertex>& vertices = data.data[static_cast<int>(vboclass)];
 
-			for (LDPolygon& poly : data)
-				compilePolygon(poly, index, info);
+			if (mainColored)
+			{
+				geometry.mainColoredCounts[static_cast<int>(vboclass)] = countof(vertices);
+			}
+			else
+			{
+				for (const VboVertex& vertex : vertices)
+					geometry.boundingBox.consider({vertex.position[0], vertex.position[1], vertex.position[2]});
+			}
 		}
-		break;
 	}
 
-	m_objectInfo[index] = info;
-	needMerge();
+	placeVertices(m_sharedVbos, data, &geometry.data);
+	geometry.data = data;
+	m_dirtySharedGeometry.insert(subfile);
+	m_pickingTree.setSharedGeometry(subfile, data.data);
+}
+
+/*
+ * Releases an instance's hold of the shared geometry of its subfile. The geometry is dropped once nothing refers to
+ * it any more.
+ */
+void gl::Compiler::releaseInstance(const Instance& instance)
+{
+	auto iterator = m_sharedGeometry.find(instance.subfile);
+
+	if (iterator != m_sharedGeometry.end())
+	{
+		iterator->instanceCount -= 1;
+
+		if (iterator->instanceCount <= 0)
+		{
+			releaseVertices(m_sharedVbos, iterator->data);
+			m_dirtySharedGeometry.remove(instance.subfile);
+			m_pickingTree.removeSharedGeometry(instance.subfile);
+			m_sharedGeometry.erase(iterator);
+		}
+	}
+}
+
+/*
+ * Adds the transformed bounding box of an instance into the bounding box of the model.
+ */
+void gl::Compiler::considerInstance(const Instance& instance)
+{
+	auto iterator = m_sharedGeometry.constFind(instance.subfile);
+
+	if (iterator == m_sharedGeometry.constEnd() or iterator->boundingBox.isEmpty())
+		return;
+
+	const Vertex& minimum = iterator->boundingBox.minimumVertex();
+	const Vertex& maximum = iterator->boundingBox.maximumVertex();
+
+	for (int i = 0; i < 8; ++i)
+	{
+		Vertex corner {
+			(i & 1) ? maximum.x : minimum.x,
+			(i & 2) ? maximum.y : minimum.y,
+			(i & 4) ? maximum.z : minimum.z
+		};
+		this->boundingBox.consider(corner.transformed(instance.matrix));
+	}
+}
+
+/*
+ * Adds a compiled object into the bounding box of the model.
+ */
+void gl::Compiler::considerObject(const ObjectVboData& objectInfo)
+{
+	if (objectInfo.isInstance)
+	{
+		considerInstance(objectInfo.instance);
+		return;
+	}
+
+	for (VboClass vboclass : iterateEnum<VboClass>())
+	{
+		// Read in the vertices and add them to the bounding box.
+		for (const VboVertex& vertex : objectInfo.data[static_cast<int>(vboclass)])
+			this->boundingBox.consider({vertex.position[0], vertex.position[1], vertex.position[2]});
+	}
+}
+
+/*
+ * Packs a normal into the given type, which is either GL_INT_2_10_10_10_REV or GL_BYTE, as signed normalized
+ * components.
+ */
+static GLuint packNormal(const QVector3D& normal, GLenum type)
+{
+	if (type == GL_BYTE)
+	{
+		GLbyte components[4] = {0};
+		GLuint result;
+
+		for (int i = 0; i < 3; i += 1)
+			components[i] = static_cast<GLbyte>(qRound(qBound(-1.0f, normal[i], 1.0f) * 127.0f));
+
+		std::memcpy(&result, components, sizeof result);
+		return result;
+	}
+	else
+	{
+		auto packComponent = [](float value)
+		{
+			return static_cast<GLuint>(qRound(qBound(-1.0f, value, 1.0f) * 511.0f)) & 0x3ff;
+		};
+
+		return packComponent(normal.x()) | (packComponent(normal.y()) << 10) | (packComponent(normal.z()) << 20);
+	}
 }
 
 /*
- * Inserts a single polygon into VBOs.
+ * Inserts a single polygon into VBOs. This only reads its arguments, so it can be called from any thread.
  */
 void gl::Compiler::compilePolygon(
 	LDPolygon& poly,
-	const QModelIndex& polygonOwnerIndex,
+	const PolygonOwner* owner,
+	const CompilationSettings& settings,
 	ObjectVboData& objectInfo
 ) {
-	if (m_renderer->model()->winding() == Clockwise)
+	// Polygons without an owner belong to shared geometry, which stays in the winding of its subfile.
+	const bool isShared = (owner == nullptr);
+
+	if (not isShared and settings.winding == Clockwise)
 		::invertPolygon(poly);
 
 	VboClass surface;
@@ -439,55 +1065,45 @@ void gl::Compiler::compilePolygon(
 	{
 		poly.vertices[i].y = -poly.vertices[i].y;
 		poly.vertices[i].z = -poly.vertices[i].z;
-
-		// Add these vertices to the bounding box (unless we're going to do it over
-		// from scratch afterwards)
-		if (not this->needBoundingBoxRebuild)
-			this->boundingBox.consider(poly.vertices[i]);
 	}
 
+	// Every vertex carries its color in each subclass.
+	GLubyte colors[EnumLimits<VboSubclass>::Count][4] = {};
+
 	for (VboSubclass complement : iterateEnum<VboSubclass>())
 	{
-		const int vbonum = vboNumber (surface, complement);
-		QVector<GLfloat>& vbodata = objectInfo.data[vbonum];
-		const QColor color = getColorForPolygon (poly, polygonOwnerIndex, complement);
+		QColor color;
 
-		for (int vert = 0; vert < poly.numPolygonVertices(); ++vert)
-		{
-			if (complement == VboSubclass::Surfaces)
-			{
-				// Write coordinates. Apparently Z must be flipped too?
-				vbodata	<< poly.vertices[vert].x
-						<< poly.vertices[vert].y
-						<< poly.vertices[vert].z;
-			}
-			else if (complement == VboSubclass::Normals)
-			{
-				vbodata << normals[vert].x()
-				        << -normals[vert].y()
-				        << -normals[vert].z();
-			}
-			else if (complement == VboSubclass::InvertedNormals)
-			{
-				vbodata << -normals[vert].x();
-				vbodata << +normals[vert].y();
-				vbodata << +normals[vert].z();
-			}
-			else
-			{
-				vbodata	<< ((GLfloat) color.red()) / 255.0f
-						<< ((GLfloat) color.green()) / 255.0f
-						<< ((GLfloat) color.blue()) / 255.0f
-						<< ((GLfloat) color.alpha()) / 255.0f;
-			}
-		}
+		// Shared geometry only has colors of its own where they don't depend on the instance.
+		if (not isShared or (complement == VboSubclass::RegularColors and LDColor {poly.color} != MainColor))
+			color = getColorForPolygon(poly, owner, settings, complement);
+
+		GLubyte* rgba = colors[static_cast<int>(complement)];
+		rgba[0] = static_cast<GLubyte>(color.red());
+		rgba[1] = static_cast<GLubyte>(color.green());
+		rgba[2] = static_cast<GLubyte>(color.blue());
+		rgba[3] = static_cast<GLubyte>(color.alpha());
+	}
+
+	QVector<VboVertex>& vbodata = objectInfo.data[static_cast<int>(surface)];
+
+	for (int vert = 0; vert < poly.numPolygonVertices(); ++vert)
+	{
+		VboVertex vertex;
+		// Write coordinates. Apparently Z must be flipped too?
+		vertex.position[0] = poly.vertices[vert].x;
+		vertex.position[1] = poly.vertices[vert].y;
+		vertex.position[2] = poly.vertices[vert].z;
+		vertex.normal = packNormal({normals[vert].x(), -normals[vert].y(), -normals[vert].z()}, settings.normalType);
+		memcpy(vertex.colors, colors, sizeof colors);
+		vbodata.append(vertex);
 	}
 }
 
 /*
- * Returns the center point of the model.
+ * Returns the bounding box of the model, in GL coordinates.
  */
-Vertex gl::Compiler::modelCenter()
+const BoundingBox& gl::Compiler::modelBoundingBox()
 {
 	// If there's something still queued for compilation, we need to build those first so
 	// that they get into the bounding box.
@@ -502,51 +1118,109 @@ Vertex gl::Compiler::modelCenter()
 		while (iterator.hasNext())
 		{
 			iterator.next();
-
-			for (VboClass vboclass : {
-				VboClass::Lines,
-				VboClass::Triangles,
-				VboClass::Quads,
-				VboClass::ConditionalLines
-			}) {
-				// Read in the surface vertices and add them to the bounding box.
-				int vbonum = vboNumber(vboclass, VboSubclass::Surfaces);
-				const auto& vector = iterator.value().data[vbonum];
-
-				for (int i = 0; i + 2 < countof(vector); i += 3)
-					this->boundingBox.consider({vector[i], vector[i + 1], vector[i + 2]});
-			}
+			considerObject(iterator.value());
 		}
 
 		this->needBoundingBoxRebuild = false;
 	}
 
-	if (not this->boundingBox.isEmpty())
-		return this->boundingBox.center();
+	return this->boundingBox;
+}
+
+/*
+ * Returns the center point of the model.
+ */
+Vertex gl::Compiler::modelCenter()
+{
+	const BoundingBox& box = modelBoundingBox();
+
+	if (not box.isEmpty())
+		return box.center();
 	else
 		return {};
 }
 
-int gl::Compiler::vboNumber (VboClass surface, VboSubclass complement)
+/*
+ * Returns the type that the normals of the vertices are packed as, for glNormalPointer.
+ */
+GLenum gl::Compiler::normalType() const
+{
+	return m_normalType;
+}
+
+/*
+ * Returns the picking tree of the compiled model, with everything staged compiled into it.
+ */
+gl::PickingTree& gl::Compiler::pickingTree()
+{
+	compileStaged();
+	return m_pickingTree;
+}
+
+GLuint gl::Compiler::vbo(VboClass surface) const
 {
-	return (static_cast<int>(surface) * EnumLimits<VboSubclass>::Count) + static_cast<int>(complement);
+	return m_objectVbos.vbos[static_cast<int>(surface)];
 }
 
+/*
+ * Returns the VBO that holds the shared geometry of instances.
+ */
+GLuint gl::Compiler::sharedVbo(VboClass surface) const
+{
+	return m_sharedVbos.vbos[static_cast<int>(surface)];
+}
 
-GLuint gl::Compiler::vbo (int vbonum) const
+/*
+ * Returns the amount of vertices to draw from the given VBO. Released ranges within are cleared, so they draw
+ * nothing.
+ */
+int gl::Compiler::vboVertexCount(VboClass surface) const
 {
-	return m_vbo[vbonum];
+	return m_objectVbos.slots[static_cast<int>(surface)].size;
 }
 
+/*
+ * Returns the instanced subfile references to draw.
+ */
+const QHash<QPersistentModelIndex, gl::Compiler::Instance>& gl::Compiler::instances() const
+{
+	return m_instances;
+}
 
-int gl::Compiler::vboSize (int vbonum) const
+/*
+ * Returns where the shared geometry of the given instance lies within the VBOs of the given class.
+ */
+gl::Compiler::InstanceRange gl::Compiler::instanceRange(const Instance& instance, VboClass surface) const
 {
-	return m_vboSizes[vbonum];
+	InstanceRange range;
+	auto iterator = m_sharedGeometry.constFind(instance.subfile);
+
+	if (iterator != m_sharedGeometry.constEnd())
+	{
+		const int vboclass = static_cast<int>(surface);
+		range.first = iterator->data.firstVertices[vboclass];
+		range.mainColoredCount = iterator->mainColoredCounts[vboclass];
+		range.count = iterator->data.vertexCount(surface);
+	}
+
+	return range;
 }
 
 void gl::Compiler::fullUpdate()
 {
 	m_objectInfo.clear();
+	m_sharedGeometry.clear();
+	m_instances.clear();
+	m_dirtyObjects.clear();
+	m_dirtySharedGeometry.clear();
+	m_pickingTree.clear();
+
+	for (VboPool* pool : {&m_objectVbos, &m_sharedVbos})
+	{
+		for (VboSlots& slots : pool->slots)
+			slots = {};
+	}
+
 	recompile();
 }
 
@@ -555,9 +1229,14 @@ void gl::Compiler::fullUpdate()
  */
 void gl::Compiler::recompile()
 {
+	// Shared geometry has colors of its own, which may have changed as well.
+	for (SharedGeometry& geometry : m_sharedGeometry)
+		geometry.polygons = {};
+
 	for (QModelIndex index : m_renderer->model()->indices())
-		compileObject(index);
+		stageForCompilation(index);
 
+	compileStaged();
 	emit sceneChanged();
 }
 
@@ -20,10 +20,14 @@
 #include "main.h"
 #include "glrenderer.h"
 #include "glShared.h"
+#include "glpickingtree.h"
 #include "types/boundingbox.h"
+#include <map>
 #include <QMap>
 #include <QSet>
 
+class QThreadPool;
+
 namespace gl
 {
 	class Compiler;
@@ -38,20 +42,46 @@ class gl::Compiler : public QObject, public HierarchyElement, protected QOpenGLF
 	Q_OBJECT
 
 public:
+	/*
+	 * A subfile reference that is drawn from the shared geometry of its subfile instead of its own copy.
+	 */
+	struct Instance
+	{
+		LDDocument* subfile = nullptr;
+		QMatrix4x4 matrix; // Transformation of the reference in GL coordinates
+		bool invertedWinding = false; // The subfile is drawn with the opposite winding
+		bool invertedNormals = false; // The subfile is drawn with its inverted normals
+		QColor colors[EnumLimits<VboSubclass>::Count]; // Colors of the main-colored polygons of the subfile
+	};
+
+	/*
+	 * Where the shared geometry of an instance lies within the VBOs of one class.
+	 */
+	struct InstanceRange
+	{
+		int first = 0; // Index of the first vertex
+		int mainColoredCount = 0; // Vertices of the main-colored polygons, which come first
+		int count = 0; // All vertices
+	};
+
 	Compiler (Renderer* renderer);
 	~Compiler();
 
 	void initialize();
+	InstanceRange instanceRange(const Instance& instance, VboClass surface) const;
+	const QHash<QPersistentModelIndex, Instance>& instances() const;
+	const BoundingBox& modelBoundingBox();
 	Vertex modelCenter();
-	void prepareVBO (int vbonum);
-	GLuint vbo (int vbonum) const;
-	int vboSize (int vbonum) const;
+	GLenum normalType() const;
+	PickingTree& pickingTree();
+	void prepareVBOs();
+	GLuint sharedVbo(VboClass surface) const;
+	GLuint vbo(VboClass surface) const;
+	int vboVertexCount(VboClass surface) const;
 	QItemSelectionModel* selectionModel() const;
 	void setSelectionModel(QItemSelectionModel* _selectionModel);
 	void fullUpdate();
 
-	static int vboNumber (VboClass surface, VboSubclass complement);
-
 public slots:
 	void selectionChanged(const QItemSelection& selected, const QItemSelection& deselected);
 
@@ -59,29 +89,141 @@ signals:
 	void sceneChanged();
 
 private:
+	/*
+	 * Ranges of vertices within the VBOs of one class. A compiled object keeps its range until it is recompiled with
+	 * a different number of vertices or dropped, so that a change only needs to upload the ranges it touched.
+	 */
+	struct VboSlots
+	{
+		int capacity = 0; // Vertices allocated for the VBOs
+		int size = 0; // Vertices up to the end of the last range in use
+		int freeCount = 0; // Vertices in free ranges
+		std::map<int, int> freeRanges; // Free ranges below size, from the first vertex to the vertex count
+		QVector<QPair<int, int>> rangesToClear; // Released ranges that still hold the old vertices
+		bool needsRebuild = true; // The VBOs need to be reallocated and uploaded in full
+
+		int allocate(int count);
+		bool isFragmented() const;
+		void release(int first, int count);
+	};
+
+	/*
+	 * A set of VBOs, one for each VBO class, along with their ranges.
+	 */
+	struct VboPool
+	{
+		GLuint vbos[NumVbos];
+		VboSlots slots[EnumLimits<VboClass>::Count];
+	};
+
 	struct ObjectVboData
 	{
-		QVector<GLfloat> data[NumVbos];
+		QVector<VboVertex> data[NumVbos];
+		int firstVertices[EnumLimits<VboClass>::Count] = {0}; // Where the vertices of each class lie in the VBOs
+		bool isHidden = false;
+		bool isInstance = false;
+		Instance instance;
+
+		int vertexCount(VboClass vboclass) const;
+	};
+
+	/*
+	 * What the colors of the polygons of an object depend on, gathered from the object and the state of the
+	 * renderer before compiling.
+	 */
+	struct PolygonOwner
+	{
+		LDColor color = MainColor;
+		QColor randomColor;
+		double blendAlpha = 0.0; // How much of the selection color to blend in
+	};
+
+	/*
+	 * The configuration that compiling depends on.
+	 */
+	struct CompilationSettings
+	{
+		Winding winding = NoWinding;
+		QColor mainColor;
+		QColor edgeColor;
+		QColor selectionColor;
+		GLenum normalType = GL_BYTE;
+	};
+
+	/*
+	 * An object being compiled. Its polygons are turned into vertices on the thread pool.
+	 */
+	struct Compilation
+	{
+		QPersistentModelIndex index;
+		LDObject* object = nullptr;
+		PolygonOwner owner;
+		QVector<LDPolygon> polygons;
+		ObjectVboData info;
+	};
+
+	/*
+	 * Geometry of a subfile, compiled once and shared by all of its instances.
+	 */
+	struct SharedGeometry
+	{
+		QVector<LDPolygon> polygons; // The inlined polygons this geometry was compiled from
+		ObjectVboData data;
+		int mainColoredCounts[EnumLimits<VboClass>::Count] = {0};
+		BoundingBox boundingBox;
+		int instanceCount = 0;
 	};
 
+	CompilationSettings compilationSettings() const;
 	void compileStaged();
-	void compilePolygon(LDPolygon& poly, const QModelIndex& polygonOwnerIndex, ObjectVboData& objectInfo);
-	Q_SLOT void compileObject(const QModelIndex &index);
-	QColor getColorForPolygon(const LDPolygon& polygon, const QModelIndex& polygonOwnerIndex, VboSubclass complement);
-	QColor indexColorForID (qint32 id) const;
-	void needMerge();
+	bool compileInstance(
+		const QModelIndex& index,
+		const PolygonOwner& owner,
+		const CompilationSettings& settings,
+		ObjectVboData& objectInfo
+	);
+	void compileSharedGeometry(LDDocument* subfile, const CompilationSettings& settings);
+	static void compileVertices(Compilation& compilation, const CompilationSettings& settings, DocumentManager* documents);
+	void considerInstance(const Instance& instance);
+	void considerObject(const ObjectVboData& objectInfo);
+	static void compilePolygon(
+		LDPolygon& poly,
+		const PolygonOwner* owner,
+		const CompilationSettings& settings,
+		ObjectVboData& objectInfo
+	);
+	static QColor getColorForPolygon(
+		const LDPolygon& polygon,
+		const PolygonOwner* owner,
+		const CompilationSettings& settings,
+		VboSubclass complement
+	);
+	void installCompilation(Compilation& compilation);
+	PolygonOwner polygonOwner(const QModelIndex& index) const;
+	void placeVertices(VboPool& pool, ObjectVboData& objectInfo, const ObjectVboData* previousInfo);
+	void rebuildVbos(VboPool& pool, VboClass vboclass, const QVector<const ObjectVboData*>& contents);
 	Q_SLOT void recompile();
+	void releaseInstance(const Instance& instance);
+	void releaseVertices(VboPool& pool, const ObjectVboData& objectInfo);
 	void dropObjectInfo (const QModelIndex &index);
 	Q_SLOT void forgetObject(QModelIndex index);
 	void stageForCompilation(const QModelIndex &index);
 	void unstage (const QModelIndex &index);
+	void uploadVertices(VboPool& pool, const ObjectVboData& objectInfo);
 
 	QMap<QPersistentModelIndex, ObjectVboData> m_objectInfo;
 	QSet<QPersistentModelIndex> m_staged; // Objects that need to be compiled
-	GLuint m_vbo[NumVbos];
-	bool m_vboChanged[NumVbos] = {true};
+	QSet<QPersistentModelIndex> m_dirtyObjects; // Objects that need to be uploaded
+	QMap<LDDocument*, SharedGeometry> m_sharedGeometry;
+	QSet<LDDocument*> m_dirtySharedGeometry; // Shared geometry that needs to be uploaded
+	QHash<QPersistentModelIndex, Instance> m_instances; // Instances that are not hidden
+	VboPool m_objectVbos;
+	VboPool m_sharedVbos;
+	QTimer* m_compactionTimer;
+	QThreadPool* m_threadPool;
+	PickingTree m_pickingTree;
 	bool needBoundingBoxRebuild = true;
-	int m_vboSizes[NumVbos] = {0};
+	GLenum m_normalType = GL_BYTE; // GL_INT_2_10_10_10_REV if the context supports it
 	gl::Renderer* m_renderer;
 	QItemSelectionModel* _selectionModel = nullptr;
 	BoundingBox boundingBox;
@@ -92,6 +234,7 @@ private slots:
 	void handleDataChange(const QModelIndex& topLeft, const QModelIndex &bottomRight);
 	void handleObjectHighlightingChanged(const QModelIndex& oldIndex, const QModelIndex& newIndex);
 	void clearSelectionModel();
+	void compactVbos();
 };
 
 #define CHECK_GL_ERROR() { checkGLError(__FILE__, __LINE__); }
@@ -0,0 +1,858 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <QVarLengthArray>
+#include <QtMath>
+#include "glpickingtree.h"
+
+// How many items a leaf of a hierarchy covers at most.
+static const int leafSize = 4;
+
+// Lines win over surfaces that lie this close behind them, so that edges can be picked off their own surfaces.
+static const qreal depthTolerance = 1e-6;
+
+QVector3D gl::PickingTree::Box::center() const
+{
+	return (minimum + maximum) / 2;
+}
+
+void gl::PickingTree::Box::consider(const QVector3D& point)
+{
+	minimum = {qMin(minimum.x(), point.x()), qMin(minimum.y(), point.y()), qMin(minimum.z(), point.z())};
+	maximum = {qMax(maximum.x(), point.x()), qMax(maximum.y(), point.y()), qMax(maximum.z(), point.z())};
+}
+
+void gl::PickingTree::Box::consider(const Box& other)
+{
+	if (not other.isEmpty())
+	{
+		consider(other.minimum);
+		consider(other.maximum);
+	}
+}
+
+bool gl::PickingTree::Box::isEmpty() const
+{
+	return minimum.x() > maximum.x();
+}
+
+/*
+ * Returns the box that bounds this box after it is transformed by the given matrix.
+ */
+gl::PickingTree::Box gl::PickingTree::Box::transformed(const QMatrix4x4& matrix) const
+{
+	Box result;
+
+	if (not isEmpty())
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			QVector3D corner {
+				(i & 1) ? maximum.x() : minimum.x(),
+				(i & 2) ? maximum.y() : minimum.y(),
+				(i & 4) ? maximum.z() : minimum.z()
+			};
+			result.consider(matrix.map(corner));
+		}
+	}
+
+	return result;
+}
+
+bool gl::PickingTree::Box::operator==(const Box& other) const
+{
+	return minimum == other.minimum and maximum == other.maximum;
+}
+
+gl::PickingTree::Box gl::PickingTree::Mesh::boundingBox() const
+{
+	if (nodes.isEmpty())
+		return {};
+	else
+		return nodes[0].box;
+}
+
+/*
+ * Constructs the frustum of a rectangle in window coordinates. Each plane keeps the points p for which
+ * plane · (p, 1) ≥ 0, so that the planes can be read off the rows of the clip space matrix.
+ */
+gl::PickingTree::Frustum::Frustum(const QMatrix4x4& matrix, const QSizeF& viewport, const QRectF& rectangle)
+{
+	const float left = 2 * rectangle.left() / viewport.width() - 1;
+	const float right = 2 * rectangle.right() / viewport.width() - 1;
+	const float top = 1 - 2 * rectangle.top() / viewport.height();
+	const float bottom = 1 - 2 * rectangle.bottom() / viewport.height();
+	planes[0] = matrix.row(0) - left * matrix.row(3);
+	planes[1] = right * matrix.row(3) - matrix.row(0);
+	planes[2] = matrix.row(1) - bottom * matrix.row(3);
+	planes[3] = top * matrix.row(3) - matrix.row(1);
+	planes[4] = matrix.row(2) + matrix.row(3); // The near plane
+}
+
+/*
+ * Returns whether the box may intersect the frustum. Boxes that merely come close to its corners pass as well.
+ */
+bool gl::PickingTree::Frustum::intersects(const Box& box) const
+{
+	if (box.isEmpty())
+		return false;
+
+	for (const QVector4D& plane : planes)
+	{
+		// Test the corner of the box that is the farthest along the normal of the plane.
+		QVector4D corner {
+			(plane.x() >= 0) ? box.maximum.x() : box.minimum.x(),
+			(plane.y() >= 0) ? box.maximum.y() : box.minimum.y(),
+			(plane.z() >= 0) ? box.maximum.z() : box.minimum.z(),
+			1
+		};
+
+		if (QVector4D::dotProduct(plane, corner) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Projects a primitive into window coordinates. Whatever lies behind the near plane is clipped away first, so lines
+ * project into at most two points and surfaces into a convex polygon, unless they vanish completely.
+ */
+gl::PickingTree::Projection::Projection(const Primitive& primitive, const QMatrix4x4& matrix, const QSizeF& viewport)
+{
+	QVector4D vertices[4];
+	QVector4D clipped[8];
+	int clippedCount = 0;
+	auto distance = [](const QVector4D& vertex) { return vertex.z() + vertex.w(); };
+
+	for (int i = 0; i < primitive.vertexCount; ++i)
+		vertices[i] = matrix * QVector4D {primitive.vertices[i], 1};
+
+	if (primitive.vertexCount == 2)
+	{
+		float distances[2] = {distance(vertices[0]), distance(vertices[1])};
+
+		if (distances[0] < 0 and distances[1] < 0)
+			return;
+
+		for (int i : {0, 1})
+		{
+			float t = distances[i] / (distances[i] - distances[1 - i]);
+
+			if (distances[i] < 0)
+				clipped[clippedCount++] = vertices[i] + t * (vertices[1 - i] - vertices[i]);
+			else
+				clipped[clippedCount++] = vertices[i];
+		}
+	}
+	else
+	{
+		for (int i = 0; i < primitive.vertexCount; ++i)
+		{
+			const QVector4D& current = vertices[i];
+			const QVector4D& next = vertices[(i + 1) % primitive.vertexCount];
+			float currentDistance = distance(current);
+			float nextDistance = distance(next);
+
+			if (currentDistance >= 0)
+				clipped[clippedCount++] = current;
+
+			if ((currentDistance >= 0) != (nextDistance >= 0))
+				clipped[clippedCount++] = current + currentDistance / (currentDistance - nextDistance) * (next - current);
+		}
+	}
+
+	for (int i = 0; i < clippedCount; ++i)
+	{
+		const QVector4D& vertex = clipped[i];
+
+		if (vertex.w() <= 0)
+		{
+			count = 0;
+			return;
+		}
+
+		points[i] = {
+			float((vertex.x() / vertex.w() + 1) / 2 * viewport.width()),
+			float((1 - vertex.y() / vertex.w()) / 2 * viewport.height()),
+			vertex.z() / vertex.w()
+		};
+	}
+
+	count = clippedCount;
+}
+
+/*
+ * Returns whether the projection overlaps the given rectangle, by looking for an axis that separates them.
+ */
+bool gl::PickingTree::Projection::overlaps(const QRectF& rectangle) const
+{
+	if (count == 0)
+		return false;
+
+	qreal left = inf;
+	qreal right = -inf;
+	qreal top = inf;
+	qreal bottom = -inf;
+
+	for (int i = 0; i < count; ++i)
+	{
+		left = qMin<qreal>(left, points[i].x());
+		right = qMax<qreal>(right, points[i].x());
+		top = qMin<qreal>(top, points[i].y());
+		bottom = qMax<qreal>(bottom, points[i].y());
+	}
+
+	if (right < rectangle.left() or left > rectangle.right() or bottom < rectangle.top() or top > rectangle.bottom())
+		return false;
+
+	const QPointF corners[] = {
+		rectangle.topLeft(),
+		rectangle.topRight(),
+		rectangle.bottomLeft(),
+		rectangle.bottomRight()
+	};
+
+	// The edges of the polygon give the rest of the axes to try. A line has just the one.
+	for (int i = 0; i < (count == 2 ? 1 : count); ++i)
+	{
+		const QVector3D& point = points[i];
+		const QVector3D& next = points[(i + 1) % count];
+		const QPointF axis {point.y() - next.y(), next.x() - point.x()};
+		qreal projectionMinimum = inf;
+		qreal projectionMaximum = -inf;
+		qreal rectangleMinimum = inf;
+		qreal rectangleMaximum = -inf;
+
+		for (int j = 0; j < count; ++j)
+		{
+			qreal projection = QPointF::dotProduct(axis, points[j].toPointF());
+			projectionMinimum = qMin(projectionMinimum, projection);
+			projectionMaximum = qMax(projectionMaximum, projection);
+		}
+
+		for (const QPointF& corner : corners)
+		{
+			qreal projection = QPointF::dotProduct(axis, corner);
+			rectangleMinimum = qMin(rectangleMinimum, projection);
+			rectangleMaximum = qMax(rectangleMaximum, projection);
+		}
+
+		if (projectionMaximum < rectangleMinimum or projectionMinimum > rectangleMaximum)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Finds out whether the projection lies under the given point, and if so, how deep. Lines only need to come within
+ * the given tolerance of the point.
+ */
+bool gl::PickingTree::Projection::depthAt(const QPointF& point, qreal tolerance, qreal& depth) const
+{
+	if (count == 2)
+	{
+		const QPointF start = points[0].toPointF();
+		const QPointF direction = points[1].toPointF() - start;
+		const qreal lengthSquared = QPointF::dotProduct(direction, direction);
+		qreal t = 0;
+
+		if (lengthSquared > 0)
+			t = qBound(0.0, QPointF::dotProduct(point - start, direction) / lengthSquared, 1.0);
+
+		const QPointF offset = point - (start + t * direction);
+
+		if (QPointF::dotProduct(offset, offset) > tolerance * tolerance)
+			return false;
+
+		depth = points[0].z() + t * (points[1].z() - points[0].z());
+		return true;
+	}
+
+	// Normalized depth is affine in window coordinates, so it can be interpolated across the triangles of the
+	// polygon.
+	for (int i = 1; i + 1 < count; ++i)
+	{
+		const QVector3D& a = points[0];
+		const QPointF edge1 = points[i].toPointF() - a.toPointF();
+		const QPointF edge2 = points[i + 1].toPointF() - a.toPointF();
+		const QPointF offset = point - a.toPointF();
+		const qreal denominator = edge1.x() * edge2.y() - edge2.x() * edge1.y();
+
+		if (qFuzzyIsNull(denominator))
+			continue;
+
+		const qreal u = (offset.x() * edge2.y() - edge2.x() * offset.y()) / denominator;
+		const qreal v = (edge1.x() * offset.y() - offset.x() * edge1.y()) / denominator;
+
+		if (u >= 0 and v >= 0 and u + v <= 1)
+		{
+			depth = a.z() + u * (points[i].z() - a.z()) + v * (points[i + 1].z() - a.z());
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Visits the items covered by the leaves whose boxes pass the test, and whose ancestors' boxes pass it as well.
+ */
+template<typename Test, typename Visit>
+void gl::PickingTree::traverse(const QVector<Node>& nodes, Test test, Visit visit)
+{
+	QVarLengthArray<int, 64> stack;
+
+	if (not nodes.isEmpty())
+		stack.append(0);
+
+	while (not stack.isEmpty())
+	{
+		const int nodeIndex = stack.last();
+		const Node& node = nodes[nodeIndex];
+		stack.removeLast();
+
+		if (not test(node.box))
+			continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; ++i)
+				visit(i);
+		}
+		else
+		{
+			stack.append(node.secondChild);
+			stack.append(nodeIndex + 1);
+		}
+	}
+}
+
+/*
+ * Builds a hierarchy over the given boxes. The order is filled with the indices of the boxes in the order that the
+ * leaves cover them.
+ */
+void gl::PickingTree::buildHierarchy(QVector<Node>& nodes, QVector<int>& order, const QVector<Box>& boxes)
+{
+	nodes.clear();
+	order.resize(countof(boxes));
+
+	for (int i = 0; i < countof(boxes); ++i)
+		order[i] = i;
+
+	if (not boxes.isEmpty())
+		buildNode(nodes, order, boxes, 0, countof(boxes));
+}
+
+/*
+ * Builds a node over a range of the order, splitting it at the median of the centers of the boxes along the axis
+ * that they spread out the most along.
+ */
+int gl::PickingTree::buildNode(QVector<Node>& nodes, QVector<int>& order, const QVector<Box>& boxes, int first, int count)
+{
+	Node node;
+	Box centers;
+	node.first = first;
+
+	for (int i = first; i < first + count; ++i)
+	{
+		node.box.consider(boxes[order[i]]);
+		centers.consider(boxes[order[i]].center());
+	}
+
+	const int nodeIndex = countof(nodes);
+
+	if (count <= leafSize)
+	{
+		node.count = count;
+		nodes.append(node);
+		return nodeIndex;
+	}
+
+	nodes.append(node);
+	const QVector3D spread = centers.maximum - centers.minimum;
+	int axis = 2;
+
+	if (spread.x() >= spread.y() and spread.x() >= spread.z())
+		axis = 0;
+	else if (spread.y() >= spread.z())
+		axis = 1;
+
+	const int middle = first + count / 2;
+	std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count, [&](int a, int b)
+	{
+		return boxes[a].center()[axis] < boxes[b].center()[axis];
+	});
+	buildNode(nodes, order, boxes, first, middle - first);
+	nodes[nodeIndex].secondChild = buildNode(nodes, order, boxes, middle, first + count - middle);
+	return nodeIndex;
+}
+
+/*
+ * Gathers the primitives in the given compiled vertex data and builds a hierarchy over them.
+ */
+gl::PickingTree::Mesh gl::PickingTree::buildMesh(const QVector<VboVertex> (&data)[NumVbos])
+{
+	QVector<Primitive> primitives;
+	QVector<Box> boxes;
+
+	for (VboClass surface : iterateEnum<VboClass>())
+	{
+		const QVector<VboVertex>& vertices = data[static_cast<int>(surface)];
+		int vertexCount = 2;
+
+		if (surface == VboClass::Triangles)
+			vertexCount = 3;
+		else if (surface == VboClass::Quads)
+			vertexCount = 4;
+
+		for (int i = 0; i + vertexCount <= countof(vertices); i += vertexCount)
+		{
+			Primitive primitive;
+			Box box;
+			primitive.vertexCount = vertexCount;
+			primitive.surface = surface;
+
+			for (int j = 0; j < vertexCount; ++j)
+			{
+				const GLfloat* position = vertices[i + j].position;
+				primitive.vertices[j] = {position[0], position[1], position[2]};
+				box.consider(primitive.vertices[j]);
+			}
+
+			primitives.append(primitive);
+			boxes.append(box);
+		}
+	}
+
+	Mesh mesh;
+	QVector<int> order;
+	buildHierarchy(mesh.nodes, order, boxes);
+	mesh.primitives.reserve(countof(primitives));
+
+	for (int i : order)
+		mesh.primitives.append(primitives[i]);
+
+	return mesh;
+}
+
+/*
+ * Sets the polygons of an object from its compiled vertex data.
+ */
+void gl::PickingTree::setGeometry(const QModelIndex& index, const QVector<VboVertex> (&data)[NumVbos])
+{
+	Entry entry;
+	entry.mesh = buildMesh(data);
+
+	if (entry.mesh.primitives.isEmpty())
+	{
+		remove(index);
+	}
+	else
+	{
+		entry.index = index;
+		entry.box = entry.mesh.boundingBox();
+		addEntry(index, std::move(entry));
+	}
+}
+
+/*
+ * Sets an object to be an instance of the shared geometry of a subfile.
+ */
+void gl::PickingTree::setInstance(const QModelIndex& index, LDDocument* subfile, const QMatrix4x4& matrix)
+{
+	Entry entry;
+	entry.index = index;
+	entry.subfile = subfile;
+	entry.matrix = matrix;
+	entry.box = instanceBox(subfile, matrix);
+	addEntry(index, std::move(entry));
+}
+
+/*
+ * Sets the shared geometry of a subfile from its compiled vertex data.
+ */
+void gl::PickingTree::setSharedGeometry(LDDocument* subfile, const QVector<VboVertex> (&data)[NumVbos])
+{
+	m_sharedMeshes[subfile] = buildMesh(data);
+
+	for (Entry& entry : m_entries)
+	{
+		if (entry.subfile == subfile)
+		{
+			Box box = instanceBox(subfile, entry.matrix);
+
+			if (not (box == entry.box))
+			{
+				entry.box = box;
+				m_needsRefit = true;
+				m_refitCount += 1;
+			}
+		}
+	}
+}
+
+/*
+ * Adds an entry for an object, or replaces its previous one. An entry that stays in place only needs its box
+ * refitted into the top-level hierarchy.
+ */
+void gl::PickingTree::addEntry(const QModelIndex& index, Entry&& entry)
+{
+	auto iterator = m_entryIndices.find(index);
+
+	if (iterator != m_entryIndices.end())
+	{
+		Entry& previous = m_entries[*iterator];
+
+		if (not (previous.box == entry.box))
+		{
+			m_needsRefit = true;
+			m_refitCount += 1;
+		}
+
+		previous = std::move(entry);
+	}
+	else
+	{
+		m_entryIndices.insert(index, countof(m_entries));
+		m_entries.append(std::move(entry));
+		m_needsRebuild = true;
+	}
+}
+
+/*
+ * Removes an object from the tree.
+ */
+void gl::PickingTree::remove(const QModelIndex& index)
+{
+	auto iterator = m_entryIndices.find(index);
+
+	if (iterator != m_entryIndices.end())
+	{
+		const int entryIndex = *iterator;
+		const int lastIndex = countof(m_entries) - 1;
+		m_entryIndices.erase(iterator);
+
+		// Fill the hole with the last entry.
+		if (entryIndex != lastIndex)
+		{
+			m_entries[entryIndex] = std::move(m_entries[lastIndex]);
+			m_entryIndices[m_entries[entryIndex].index] = entryIndex;
+		}
+
+		m_entries.removeLast();
+		m_needsRebuild = true;
+	}
+}
+
+/*
+ * Removes the shared geometry of a subfile. No instance may refer to it any more.
+ */
+void gl::PickingTree::removeSharedGeometry(LDDocument* subfile)
+{
+	m_sharedMeshes.remove(subfile);
+}
+
+void gl::PickingTree::clear()
+{
+	m_entries.clear();
+	m_entryIndices.clear();
+	m_sharedMeshes.clear();
+	m_nodes.clear();
+	m_order.clear();
+	m_needsRebuild = false;
+	m_needsRefit = false;
+	m_refitCount = 0;
+}
+
+gl::PickingTree::Box gl::PickingTree::instanceBox(LDDocument* subfile, const QMatrix4x4& matrix) const
+{
+	auto iterator = m_sharedMeshes.constFind(subfile);
+
+	if (iterator != m_sharedMeshes.constEnd())
+		return iterator->boundingBox().transformed(matrix);
+	else
+		return {};
+}
+
+/*
+ * Returns the mesh to query for an entry, along with the matrix that maps the mesh into clip space.
+ */
+gl::PickingTree::EntryQuery gl::PickingTree::queryFor(const Entry& entry, const QMatrix4x4& matrix) const
+{
+	static const Mesh emptyMesh;
+
+	if (entry.subfile == nullptr)
+	{
+		return {&entry.mesh, matrix};
+	}
+	else
+	{
+		auto iterator = m_sharedMeshes.constFind(entry.subfile);
+
+		if (iterator != m_sharedMeshes.constEnd())
+			return {&*iterator, matrix * entry.matrix};
+		else
+			return {&emptyMesh, matrix};
+	}
+}
+
+/*
+ * Brings the top-level hierarchy up to date. Refitting keeps its structure, so once many entries have moved it is
+ * rebuilt instead.
+ */
+void gl::PickingTree::updateHierarchy()
+{
+	if (m_needsRebuild or m_refitCount > countof(m_entries) / 2)
+	{
+		QVector<Box> boxes;
+		boxes.reserve(countof(m_entries));
+
+		for (const Entry& entry : m_entries)
+			boxes.append(entry.box);
+
+		buildHierarchy(m_nodes, m_order, boxes);
+		m_needsRebuild = false;
+		m_needsRefit = false;
+		m_refitCount = 0;
+	}
+	else if (m_needsRefit)
+	{
+		// Children come after their parents, so going backwards refits the children first.
+		for (int i = countof(m_nodes) - 1; i >= 0; --i)
+		{
+			Node& node = m_nodes[i];
+			node.box = {};
+
+			if (node.count > 0)
+			{
+				for (int j = node.first; j < node.first + node.count; ++j)
+					node.box.consider(m_entries[m_order[j]].box);
+			}
+			else
+			{
+				node.box.consider(m_nodes[i + 1].box);
+				node.box.consider(m_nodes[node.secondChild].box);
+			}
+		}
+
+		m_needsRefit = false;
+	}
+}
+
+/*
+ * Returns the object nearest to the camera under the given point. Lines are picked within the given tolerance.
+ * Only primitives of the given surfaces are considered.
+ */
+QModelIndex gl::PickingTree::pick(
+	const QMatrix4x4& matrix,
+	const QSizeF& viewport,
+	const QPointF& point,
+	qreal tolerance,
+	const QVector<VboClass>& surfaces
+) {
+	updateHierarchy();
+	const QRectF area {point.x() - tolerance, point.y() - tolerance, 2 * tolerance, 2 * tolerance};
+	const Frustum frustum {matrix, viewport, area};
+	QModelIndex result;
+	qreal nearestDepth = inf;
+	bool nearestIsLine = false;
+
+	traverse(m_nodes, [&](const Box& box) { return frustum.intersects(box); }, [&](int i)
+	{
+		const Entry& entry = m_entries[m_order[i]];
+		const EntryQuery query = queryFor(entry, matrix);
+		const Frustum entryFrustum {query.matrix, viewport, area};
+
+		traverse(query.mesh->nodes, [&](const Box& box) { return entryFrustum.intersects(box); }, [&](int j)
+		{
+			const Primitive& primitive = query.mesh->primitives[j];
+
+			if (not surfaces.contains(primitive.surface))
+				return;
+
+			const Projection projection {primitive, query.matrix, viewport};
+			const bool isLine = (primitive.vertexCount == 2);
+			qreal depth;
+
+			if (projection.depthAt(point, tolerance, depth)
+				and (depth < nearestDepth - depthTolerance
+					or (isLine and not nearestIsLine and depth <= nearestDepth + depthTolerance)))
+			{
+				result = entry.index;
+				nearestDepth = depth;
+				nearestIsLine = isLine;
+			}
+		});
+	});
+
+	return result;
+}
+
+/*
+ * Returns the objects that have primitives of the given surfaces within the given rectangle, whether they are in
+ * plain sight or not.
+ */
+QModelIndexList gl::PickingTree::pick(
+	const QMatrix4x4& matrix,
+	const QSizeF& viewport,
+	const QRectF& rectangle,
+	const QVector<VboClass>& surfaces
+) {
+	updateHierarchy();
+	const Frustum frustum {matrix, viewport, rectangle};
+	QModelIndexList result;
+
+	traverse(m_nodes, [&](const Box& box) { return frustum.intersects(box); }, [&](int i)
+	{
+		const Entry& entry = m_entries[m_order[i]];
+		const EntryQuery query = queryFor(entry, matrix);
+		const Frustum entryFrustum {query.matrix, viewport, rectangle};
+		bool found = false;
+
+		traverse(query.mesh->nodes, [&](const Box& box) { return not found and entryFrustum.intersects(box); }, [&](int j)
+		{
+			const Primitive& primitive = query.mesh->primitives[j];
+
+			if (not found
+				and surfaces.contains(primitive.surface)
+				and Projection {primitive, query.matrix, viewport}.overlaps(rectangle))
+			{
+				found = true;
+			}
+		});
+
+		if (found)
+			result.append(entry.index);
+	});
+
+	return result;
+}
+
+/*
+ * Returns the objects that are in plain sight within the given rectangle: those that are the nearest one at the
+ * center of some pixel of it, like on a rendering of the scene. Lines are as wide as twice the tolerance. The cost
+ * grows with the pixels that the primitives in the rectangle cover.
+ */
+QModelIndexList gl::PickingTree::pickVisible(
+	const QMatrix4x4& matrix,
+	const QSizeF& viewport,
+	const QRectF& rectangle,
+	qreal tolerance,
+	const QVector<VboClass>& surfaces
+) {
+	struct Sample
+	{
+		qreal depth = inf;
+		int entry = -1;
+		bool isLine = false;
+	};
+
+	updateHierarchy();
+	const int firstColumn = qFloor(rectangle.left());
+	const int firstRow = qFloor(rectangle.top());
+	const int columns = qCeil(rectangle.right()) - firstColumn;
+	const int rows = qCeil(rectangle.bottom()) - firstRow;
+	// Lines that pass just outside of the rectangle may still reach into it.
+	const QRectF area = rectangle.adjusted(-tolerance, -tolerance, tolerance, tolerance);
+	QModelIndexList result;
+
+	if (columns <= 0 or rows <= 0)
+		return result;
+
+	const Frustum frustum {matrix, viewport, area};
+	QVector<Sample> samples(columns * rows);
+
+	traverse(m_nodes, [&](const Box& box) { return frustum.intersects(box); }, [&](int i)
+	{
+		const int entryIndex = m_order[i];
+		const EntryQuery query = queryFor(m_entries[entryIndex], matrix);
+		const Frustum entryFrustum {query.matrix, viewport, area};
+
+		traverse(query.mesh->nodes, [&](const Box& box) { return entryFrustum.intersects(box); }, [&](int j)
+		{
+			const Primitive& primitive = query.mesh->primitives[j];
+
+			if (not surfaces.contains(primitive.surface))
+				return;
+
+			const Projection projection {primitive, query.matrix, viewport};
+
+			if (projection.count == 0)
+				return;
+
+			const bool isLine = (primitive.vertexCount == 2);
+			const qreal reach = isLine ? tolerance : 0;
+			qreal left = inf;
+			qreal right = -inf;
+			qreal top = inf;
+			qreal bottom = -inf;
+
+			for (int k = 0; k < projection.count; ++k)
+			{
+				left = qMin<qreal>(left, projection.points[k].x() - reach);
+				right = qMax<qreal>(right, projection.points[k].x() + reach);
+				top = qMin<qreal>(top, projection.points[k].y() - reach);
+				bottom = qMax<qreal>(bottom, projection.points[k].y() + reach);
+			}
+
+			// Visit only the pixels whose centers lie within the bounding rectangle of the projection.
+			const int columnStart = qMax(0, qCeil(left - 0.5) - firstColumn);
+			const int columnEnd = qMin(columns - 1, qFloor(right - 0.5) - firstColumn);
+			const int rowStart = qMax(0, qCeil(top - 0.5) - firstRow);
+			const int rowEnd = qMin(rows - 1, qFloor(bottom - 0.5) - firstRow);
+
+			for (int row = rowStart; row <= rowEnd; ++row)
+			{
+				for (int column = columnStart; column <= columnEnd; ++column)
+				{
+					Sample& sample = samples[row * columns + column];
+					const QPointF center {firstColumn + column + 0.5, firstRow + row + 0.5};
+					qreal depth;
+
+					if (projection.depthAt(center, tolerance, depth)
+						and (depth < sample.depth - depthTolerance
+							or (isLine and not sample.isLine and depth <= sample.depth + depthTolerance)))
+					{
+						sample.depth = depth;
+						sample.entry = entryIndex;
+						sample.isLine = isLine;
+					}
+				}
+			}
+		});
+	});
+
+	QVector<bool> isVisible(m_entries.size(), false);
+
+	for (const Sample& sample : samples)
+	{
+		if (sample.entry != -1)
+			isVisible[sample.entry] = true;
+	}
+
+	for (int i = 0; i < m_entries.size(); ++i)
+	{
+		if (isVisible[i])
+			result.append(m_entries[i].index);
+	}
+
+	return result;
+}
@@ -0,0 +1,164 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QAbstractItemModel>
+#include <QHash>
+#include <QMap>
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QVector4D>
+#include "main.h"
+#include "glShared.h"
+
+class LDDocument;
+
+/*
+ * Bounding volume hierarchies over the compiled polygons of the model, so that the renderer can find the objects
+ * under the cursor or within a rectangle without drawing anything.
+ *
+ * Each object has a hierarchy of its own polygons, except for instanced subfile references, which share the
+ * hierarchy of their subfile and are queried through their transformation. A top-level hierarchy over the bounding
+ * boxes of the objects ties them together. It is refitted when an object changes in place and rebuilt when objects
+ * come and go.
+ *
+ * Queries take the matrix that maps the GL coordinates of the compiler into clip space, and work in window
+ * coordinates of a viewport of the given size.
+ */
+class gl::PickingTree
+{
+public:
+	QModelIndex pick(const QMatrix4x4& matrix, const QSizeF& viewport, const QPointF& point, qreal tolerance,
+		const QVector<VboClass>& surfaces);
+	QModelIndexList pick(const QMatrix4x4& matrix, const QSizeF& viewport, const QRectF& rectangle,
+		const QVector<VboClass>& surfaces);
+	QModelIndexList pickVisible(const QMatrix4x4& matrix, const QSizeF& viewport, const QRectF& rectangle,
+		qreal tolerance, const QVector<VboClass>& surfaces);
+	void clear();
+	void remove(const QModelIndex& index);
+	void removeSharedGeometry(LDDocument* subfile);
+	void setGeometry(const QModelIndex& index, const QVector<VboVertex> (&data)[NumVbos]);
+	void setInstance(const QModelIndex& index, LDDocument* subfile, const QMatrix4x4& matrix);
+	void setSharedGeometry(LDDocument* subfile, const QVector<VboVertex> (&data)[NumVbos]);
+
+private:
+	struct Box
+	{
+		QVector3D minimum = QVector3D(inf, inf, inf);
+		QVector3D maximum = QVector3D(-inf, -inf, -inf);
+
+		QVector3D center() const;
+		void consider(const QVector3D& point);
+		void consider(const Box& other);
+		bool isEmpty() const;
+		Box transformed(const QMatrix4x4& matrix) const;
+		bool operator==(const Box& other) const;
+	};
+
+	/*
+	 * A node of a hierarchy. Leaves cover a range of items, inner nodes are followed by their first child.
+	 */
+	struct Node
+	{
+		Box box;
+		int first = 0;
+		int count = 0; // Zero for inner nodes
+		int secondChild = 0;
+	};
+
+	struct Primitive
+	{
+		QVector3D vertices[4];
+		int vertexCount;
+		VboClass surface;
+	};
+
+	/*
+	 * The polygons of an object or a subfile, with a hierarchy over them.
+	 */
+	struct Mesh
+	{
+		QVector<Primitive> primitives;
+		QVector<Node> nodes;
+
+		Box boundingBox() const;
+	};
+
+	struct Entry
+	{
+		QPersistentModelIndex index;
+		Mesh mesh; // Polygons of the object, unless it is an instance
+		LDDocument* subfile = nullptr; // Subfile of an instance
+		QMatrix4x4 matrix; // Transformation of an instance
+		Box box;
+	};
+
+	/*
+	 * The part of clip space that lies within a rectangle of the viewport and in front of the camera.
+	 */
+	struct Frustum
+	{
+		QVector4D planes[5];
+
+		Frustum(const QMatrix4x4& matrix, const QSizeF& viewport, const QRectF& rectangle);
+		bool intersects(const Box& box) const;
+	};
+
+	/*
+	 * A primitive projected into window coordinates, with its normalized depth as the z coordinate.
+	 */
+	struct Projection
+	{
+		QVector3D points[8];
+		int count = 0;
+
+		Projection(const Primitive& primitive, const QMatrix4x4& matrix, const QSizeF& viewport);
+		bool overlaps(const QRectF& rectangle) const;
+		bool depthAt(const QPointF& point, qreal tolerance, qreal& depth) const;
+	};
+
+	/*
+	 * Where a query looks into an entry: in the coordinates of its mesh, which for instances differ from those of
+	 * the model.
+	 */
+	struct EntryQuery
+	{
+		const Mesh* mesh;
+		QMatrix4x4 matrix;
+	};
+
+	static void buildHierarchy(QVector<Node>& nodes, QVector<int>& order, const QVector<Box>& boxes);
+	static int buildNode(QVector<Node>& nodes, QVector<int>& order, const QVector<Box>& boxes, int first, int count);
+	static Mesh buildMesh(const QVector<VboVertex> (&data)[NumVbos]);
+	void addEntry(const QModelIndex& index, Entry&& entry);
+	Box instanceBox(LDDocument* subfile, const QMatrix4x4& matrix) const;
+	EntryQuery queryFor(const Entry& entry, const QMatrix4x4& matrix) const;
+	void updateHierarchy();
+
+	template<typename Test, typename Visit>
+	static void traverse(const QVector<Node>& nodes, Test test, Visit visit);
+
+	QVector<Entry> m_entries;
+	QHash<QPersistentModelIndex, int> m_entryIndices;
+	QMap<LDDocument*, Mesh> m_sharedMeshes;
+	QVector<Node> m_nodes;
+	QVector<int> m_order; // Entries in the order that the leaves of the top-level hierarchy cover them
+	bool m_needsRebuild = false;
+	bool m_needsRefit = false;
+	int m_refitCount = 0; // Entries that have changed their bounding box since the last rebuild
+};
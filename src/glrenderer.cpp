@@ -22,6 +22,7 @@
 #include <QContextMenuEvent>
 #include <QToolTip>
 #include <QTimer>
+#include <QtMath>
 #include <GL/glu.h>
 #include "main.h"
 #include "lddocument.h"
@@ -189,13 +190,12 @@ void gl::Renderer::initializeGL()
 void gl::Renderer::initializeLighting()
 {
 	GLfloat materialShininess[] = {5.0};
-	GLfloat lightPosition[] = {1.0, 1.0, 1.0, 0.0};
 	GLfloat ambientLightingLevel[] = {0.5, 0.5, 0.5, 1.0};
 	glShadeModel(GL_SMOOTH);
 	glMaterialfv(GL_FRONT, GL_SHININESS, materialShininess);
 	glLightfv(GL_LIGHT0, GL_AMBIENT, ambientLightingLevel);
 	glLightfv(GL_LIGHT0, GL_DIFFUSE, ambientLightingLevel);
-	glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+	setLightInverted(false);
 	glEnable(GL_LIGHTING);
 	glEnable(GL_LIGHT0);
 	glEnable(GL_COLOR_MATERIAL);
@@ -240,23 +240,14 @@ void gl::Renderer::initializeAxes()
 //
 void gl::Renderer::setBackground()
 {
-	if (not m_isDrawingSelectionScene)
-	{
-		// Otherwise use the background that the user wants.
-		QColor color = config::backgroundColor();
+	QColor color = config::backgroundColor();
 
-		if (color.isValid())
-		{
-			color.setAlpha(255);
-			m_useDarkBackground = luma(color) < 80;
-			m_backgroundColor = color;
-			qglClearColor(color);
-		}
-	}
-	else
+	if (color.isValid())
 	{
-		// The picking scene requires a black background.
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		color.setAlpha(255);
+		m_useDarkBackground = luma(color) < 80;
+		m_backgroundColor = color;
+		qglClearColor(color);
 	}
 }
 
@@ -302,13 +293,13 @@ void gl::Renderer::drawGLScene()
 		zoomAllToFit();
 	}
 
-	if (config::drawWireframe() and not m_isDrawingSelectionScene)
+	if (config::drawWireframe())
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
 
-	if (config::lighting() and not m_isDrawingSelectionScene)
+	if (config::lighting())
 		glEnable(GL_LIGHTING);
 	else
 		glDisable(GL_LIGHTING);
@@ -326,69 +317,55 @@ void gl::Renderer::drawGLScene()
 	{
 		glMatrixMode(GL_MODELVIEW);
 		glPushMatrix();
-		glLoadIdentity();
-		glTranslatef(0.0f, 0.0f, -2.0f);
-		glTranslatef(panning (X), panning (Y), -zoom());
-		glMultMatrixf(padMatrix(m_rotation.toRotationMatrix()).constData());
-		xyz(glTranslatef, -m_compiler->modelCenter());
+		glLoadMatrixf(modelviewMatrix().constData());
 	}
 
 	glEnableClientState (GL_NORMAL_ARRAY);
 	glEnableClientState (GL_VERTEX_ARRAY);
 	glEnableClientState (GL_COLOR_ARRAY);
 
-	if (m_isDrawingSelectionScene)
+	if (config::bfcRedGreenView())
 	{
-		drawVbos (VboClass::Triangles, VboSubclass::PickColors);
-		drawVbos (VboClass::Quads, VboSubclass::PickColors);
-		drawVbos (VboClass::Lines, VboSubclass::PickColors);
-		drawVbos (VboClass::ConditionalLines, VboSubclass::PickColors);
+		glEnable (GL_CULL_FACE);
+		glCullFace (GL_BACK);
+		drawVbos (VboClass::Triangles, VboSubclass::BfcFrontColors);
+		drawVbos (VboClass::Quads, VboSubclass::BfcFrontColors);
+		glCullFace (GL_FRONT);
+		drawVbos (VboClass::Triangles, VboSubclass::BfcBackColors);
+		drawVbos (VboClass::Quads, VboSubclass::BfcBackColors);
+		glDisable (GL_CULL_FACE);
 	}
 	else
 	{
-		if (config::bfcRedGreenView())
-		{
-			glEnable (GL_CULL_FACE);
-			glCullFace (GL_BACK);
-			drawVbos (VboClass::Triangles, VboSubclass::BfcFrontColors);
-			drawVbos (VboClass::Quads, VboSubclass::BfcFrontColors);
-			glCullFace (GL_FRONT);
-			drawVbos (VboClass::Triangles, VboSubclass::BfcBackColors);
-			drawVbos (VboClass::Quads, VboSubclass::BfcBackColors);
-			glDisable (GL_CULL_FACE);
-		}
-		else
-		{
-			VboSubclass colors;
+		VboSubclass colors;
 
-			if (config::randomColors())
-				colors = VboSubclass::RandomColors;
-			else
-				colors = VboSubclass::RegularColors;
+		if (config::randomColors())
+			colors = VboSubclass::RandomColors;
+		else
+			colors = VboSubclass::RegularColors;
 
-			drawVbos (VboClass::Triangles, colors);
-			drawVbos (VboClass::Quads, colors);
-		}
+		drawVbos (VboClass::Triangles, colors);
+		drawVbos (VboClass::Quads, colors);
+	}
 
-		drawVbos (VboClass::Lines, VboSubclass::RegularColors);
+	drawVbos (VboClass::Lines, VboSubclass::RegularColors);
 
-		if (config::useLineStipple())
-			glEnable (GL_LINE_STIPPLE);
+	if (config::useLineStipple())
+		glEnable (GL_LINE_STIPPLE);
 
-		drawVbos (VboClass::ConditionalLines, VboSubclass::RegularColors);
-		glDisable (GL_LINE_STIPPLE);
+	drawVbos (VboClass::ConditionalLines, VboSubclass::RegularColors);
+	glDisable (GL_LINE_STIPPLE);
 
-		if (config::drawAxes())
-		{
-			glDisableClientState (GL_NORMAL_ARRAY);
-			glBindBuffer (GL_ARRAY_BUFFER, m_axesVbo);
-			glVertexPointer (3, GL_FLOAT, 0, NULL);
-			glBindBuffer (GL_ARRAY_BUFFER, m_axesVbo);
-			glColorPointer (3, GL_FLOAT, 0, NULL);
-			glDrawArrays (GL_LINES, 0, 6);
-			glEnableClientState (GL_NORMAL_ARRAY);
-			CHECK_GL_ERROR();
-		}
+	if (config::drawAxes())
+	{
+		glDisableClientState (GL_NORMAL_ARRAY);
+		glBindBuffer (GL_ARRAY_BUFFER, m_axesVbo);
+		glVertexPointer (3, GL_FLOAT, 0, NULL);
+		glBindBuffer (GL_ARRAY_BUFFER, m_axesVbo);
+		glColorPointer (3, GL_FLOAT, 0, NULL);
+		glDrawArrays (GL_LINES, 0, 6);
+		glEnableClientState (GL_NORMAL_ARRAY);
+		CHECK_GL_ERROR();
 	}
 
 	glPopMatrix();
@@ -402,6 +379,88 @@ void gl::Renderer::drawGLScene()
 	glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
 }
 
+/*
+ * Returns the modelview matrix of the free camera.
+ */
+QMatrix4x4 gl::Renderer::modelviewMatrix()
+{
+	QMatrix4x4 matrix;
+	matrix.translate(0.0f, 0.0f, -2.0f);
+	matrix.translate(panning(X), panning(Y), -zoom());
+	matrix *= padMatrix(m_rotation.toRotationMatrix());
+	matrix.translate(-m_compiler->modelCenter().toVector());
+	return matrix;
+}
+
+/*
+ * Returns the matrix that maps the GL coordinates of the compiled model into clip space, as the scene is drawn.
+ */
+QMatrix4x4 gl::Renderer::sceneMatrix()
+{
+	QMatrix4x4 matrix;
+
+	if (not m_cameraInfo.isModelview())
+	{
+		matrix = currentCamera().realMatrix() * ldrawToGLAdapterMatrix;
+	}
+	else
+	{
+		matrix.perspective(45.0f, static_cast<float>(width()) / height(), near, far);
+		matrix *= modelviewMatrix();
+	}
+
+	return matrix;
+}
+
+/*
+ * Returns whether the configuration lets the given kind of surface be drawn.
+ */
+static bool isSurfaceShown(VboClass surface)
+{
+	switch (surface)
+	{
+	case VboClass::Triangles:
+	case VboClass::Quads:
+		return config::drawSurfaces();
+
+	case VboClass::Lines:
+		return config::drawEdgeLines();
+
+	case VboClass::ConditionalLines:
+		return config::drawConditionalLines();
+
+	case VboClass::_End:
+		break;
+	}
+
+	return false;
+}
+
+/*
+ * Returns the kinds of surfaces that can be picked, which are the ones that are drawn.
+ */
+static QVector<VboClass> pickableSurfaces()
+{
+	QVector<VboClass> result;
+
+	for (VboClass surface : iterateEnum<VboClass>())
+	{
+		if (isSurfaceShown(surface))
+			result.append(surface);
+	}
+
+	return result;
+}
+
+/*
+ * Returns how far from a line a pick may be and still hit it. Thin lines would be hard to hit exactly, so they are
+ * picked with a width of at least 6.5 pixels.
+ */
+static qreal pickingTolerance()
+{
+	return qMax<double>(config::lineThickness(), 6.5) / 2;
+}
+
 /*
  * Draws a set of VBOs onto the scene. Renders surfaces with appropriate normals and colors.
  *
@@ -412,12 +471,8 @@ void gl::Renderer::drawGLScene()
 void gl::Renderer::drawVbos(VboClass surface, VboSubclass colors)
 {
 	// Filter this through some configuration options
-	if ((isOneOf(surface, VboClass::Quads, VboClass::Triangles) and config::drawSurfaces() == false)
-		or (surface == VboClass::Lines and config::drawEdgeLines() == false)
-		or (surface == VboClass::ConditionalLines and config::drawConditionalLines() == false))
-	{
+	if (not isSurfaceShown(surface))
 		return;
-	}
 
 	GLenum type;
 
@@ -438,38 +493,105 @@ void gl::Renderer::drawVbos(VboClass surface, VboSubclass colors)
 		break;
 	}
 
-	VboSubclass normals;
+	m_compiler->prepareVBOs();
+	GLsizei count = m_compiler->vboVertexCount(surface);
 
-	if (colors != VboSubclass::BfcBackColors)
-		normals = VboSubclass::Normals;
-	else
-		normals = VboSubclass::InvertedNormals;
-
-	int surfaceVboNumber = m_compiler->vboNumber(surface, VboSubclass::Surfaces);
-	int colorVboNumber = m_compiler->vboNumber(surface, colors);
-	int normalVboNumber = m_compiler->vboNumber(surface, normals);
-	m_compiler->prepareVBO(surfaceVboNumber);
-	m_compiler->prepareVBO(colorVboNumber);
-	m_compiler->prepareVBO(normalVboNumber);
-	GLuint surfaceVbo = m_compiler->vbo(surfaceVboNumber);
-	GLuint colorVbo = m_compiler->vbo(colorVboNumber);
-	GLuint normalVbo = m_compiler->vbo(normalVboNumber);
-	GLsizei count = m_compiler->vboSize(surfaceVboNumber) / 3;
+	// Back faces are drawn with inverted normals.
+	const bool drawingInvertedNormals = (colors == VboSubclass::BfcBackColors);
+	setLightInverted(drawingInvertedNormals);
 
 	if (count > 0)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, surfaceVbo);
-		glVertexPointer(3, GL_FLOAT, 0, nullptr);
-		CHECK_GL_ERROR();
-		glBindBuffer(GL_ARRAY_BUFFER, colorVbo);
-		glColorPointer(4, GL_FLOAT, 0, nullptr);
-		CHECK_GL_ERROR();
-		glBindBuffer(GL_ARRAY_BUFFER, normalVbo);
-		glNormalPointer(GL_FLOAT, 0, nullptr);
-		CHECK_GL_ERROR();
+		bindVbo(m_compiler->vbo(surface), colors);
 		glDrawArrays(type, 0, count);
 		CHECK_GL_ERROR();
 	}
+
+	drawInstances(surface, colors, type);
+	setLightInverted(false);
+}
+
+/*
+ * Binds a VBO of the compiler for drawing, with the colors of the given subclass.
+ */
+void gl::Renderer::bindVbo(GLuint vbo, VboSubclass colors)
+{
+	const GLsizei stride = sizeof(VboVertex);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glVertexPointer(3, GL_FLOAT, stride, reinterpret_cast<const GLvoid*>(offsetof(VboVertex, position)));
+	glNormalPointer(m_compiler->normalType(), stride, reinterpret_cast<const GLvoid*>(offsetof(VboVertex, normal)));
+	glColorPointer(4, GL_UNSIGNED_BYTE, stride, reinterpret_cast<const GLvoid*>(VboVertex::colorOffset(colors)));
+	CHECK_GL_ERROR();
+}
+
+/*
+ * Points the light the other way, or back. The light is directional and has no specular part, so this lights the
+ * polygons exactly as if their normals were inverted, without the VBOs having to store the inverted normals.
+ */
+void gl::Renderer::setLightInverted(bool inverted)
+{
+	const GLfloat direction = inverted ? -1.0f : 1.0f;
+	const GLfloat lightPosition[] = {direction, direction, direction, 0.0f};
+	GLint matrixMode;
+	glGetIntegerv(GL_MATRIX_MODE, &matrixMode);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+	glPopMatrix();
+	glMatrixMode(matrixMode);
+}
+
+/*
+ * Draws the subfile references that the compiler has instanced. Each instance is drawn from the shared geometry of
+ * its subfile, transformed with the modelview matrix. The colors that depend on the instance are constant over its
+ * polygons, so they are given with glColor instead of the color VBO.
+ */
+void gl::Renderer::drawInstances(VboClass surface, VboSubclass colors, GLenum type)
+{
+	const QHash<QPersistentModelIndex, gl::Compiler::Instance>& instances = m_compiler->instances();
+
+	if (instances.isEmpty())
+		return;
+
+	bindVbo(m_compiler->sharedVbo(surface), colors);
+	const bool drawingInvertedNormals = (colors == VboSubclass::BfcBackColors);
+	GLint matrixMode;
+	glGetIntegerv(GL_MATRIX_MODE, &matrixMode);
+	glMatrixMode(GL_MODELVIEW);
+
+	// Instance matrices may scale, so the normals need to be normalized after the transformation.
+	glEnable(GL_NORMALIZE);
+
+	for (const gl::Compiler::Instance& instance : instances)
+	{
+		gl::Compiler::InstanceRange range = m_compiler->instanceRange(instance, surface);
+
+		if (range.count == 0)
+			continue;
+
+		// With regular colors, only the main-colored polygons take the color of the instance.
+		const QColor& color = instance.colors[static_cast<int>(colors)];
+		int constantColorCount = (colors == VboSubclass::RegularColors) ? range.mainColoredCount : range.count;
+		setLightInverted(instance.invertedNormals != drawingInvertedNormals);
+		glFrontFace(instance.invertedWinding ? GL_CW : GL_CCW);
+		glPushMatrix();
+		glMultMatrixf(instance.matrix.constData());
+		glDisableClientState(GL_COLOR_ARRAY);
+		glColor4f(color.redF(), color.greenF(), color.blueF(), color.alphaF());
+		glDrawArrays(type, range.first, constantColorCount);
+		glEnableClientState(GL_COLOR_ARRAY);
+
+		if (range.count > constantColorCount)
+			glDrawArrays(type, range.first + constantColorCount, range.count - constantColorCount);
+
+		glPopMatrix();
+	}
+
+	glFrontFace(GL_CCW);
+	glDisable(GL_NORMALIZE);
+	glMatrixMode(matrixMode);
+	CHECK_GL_ERROR();
 }
 
 QPen gl::Renderer::textPen() const
@@ -487,10 +609,6 @@ void gl::Renderer::paintEvent(QPaintEvent*)
 	makeCurrent();
 	initGLData();
 	drawGLScene();
-
-	if (isDrawingSelectionScene())
-		return;
-
 	QPainter painter {this};
 	painter.setRenderHint(QPainter::Antialiasing);
 	overpaint(painter);
@@ -599,71 +717,25 @@ void gl::Renderer::leaveEvent(QEvent*)
 }
 
 /*
- * Resolves a pixel pointer to an RGB color.
- * pixel[0..2] must be valid.
- */
-static QRgb colorFromPixel(uint8_t* pixel)
-{
-	return pixel[0] << 16 | pixel[1] << 8 | pixel[2] | 0xff000000;
-}
-
-/*
- * Returns the set of objects found in the specified pixel area.
+ * Returns the set of objects found in the specified pixel area. Only the objects that can be seen there are found,
+ * unless hidden objects are configured to be selected as well.
  */
 QItemSelection gl::Renderer::pick(const QRect& range)
 {
-	makeCurrent();
 	QItemSelection result;
+	QRectF area = QRectF {range}.intersected(QRectF {rect()});
+	QModelIndexList indices;
 
-	// Paint the picking scene
-	setPicking(true);
-	drawGLScene();
-
-	int x0 = range.left();
-	int y0 = range.top();
-	int x1 = x0 + range.width();
-	int y1 = y0 + range.height();
-
-	// Clamp the values to ensure they're within bounds
-	x0 = qMax (0, x0);
-	y0 = qMax (0, y0);
-	x1 = qMin (x1, width());
-	y1 = qMin (y1, height());
-	const int areawidth = (x1 - x0);
-	const int areaheight = (y1 - y0);
-	const qint32 numpixels = areawidth * areaheight;
-
-	// Allocate space for the pixel data.
-	QVector<unsigned char> pixelData;
-	pixelData.resize(4 * numpixels);
-
-	// Read pixels from the color buffer.
-	glReadPixels(x0, height() - y1, areawidth, areaheight, GL_RGBA, GL_UNSIGNED_BYTE, pixelData.data());
-
-	QSet<QRgb> pixelColors;
-
-	// Go through each pixel read and add them to the selection.
-	// Each pixel maps to an LDObject injectively.
-	// Note: black is background, those indices are skipped.
-	for (int i : ::range(0, 4, pixelData.size() - 4))
-	{
-		QRgb color = colorFromPixel(&pixelData[i]);
-
-		if (color != BlackRgb)
-			pixelColors.insert(color);
-	}
-
-	// For each index read, resolve the LDObject behind it and add it to the selection.
-	for (QRgb color : pixelColors)
-	{
-		QModelIndex index = m_model->objectByPickingColor(color);
+	if (area.isEmpty())
+		return result;
+	else if (config::selectHiddenObjects())
+		indices = m_compiler->pickingTree().pick(sceneMatrix(), size(), area, pickableSurfaces());
+	else
+		indices = m_compiler->pickingTree().pickVisible(sceneMatrix(), size(), area, pickingTolerance(), pickableSurfaces());
 
-		if (index.isValid())
-			result.select(index, index);
-	}
+	for (const QModelIndex& index : indices)
+		result.select(index, index);
 
-	setPicking(false);
-	repaint();
 	return result;
 }
 
@@ -672,38 +744,8 @@ QItemSelection gl::Renderer::pick(const QRect& range)
  */
 QModelIndex gl::Renderer::pick(int mouseX, int mouseY)
 {
-	makeCurrent();
-	setPicking(true);
-	drawGLScene();
-	unsigned char pixel[4];
-	glReadPixels(mouseX, height() - mouseY, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
-	QModelIndex result = m_model->objectByPickingColor(colorFromPixel(pixel));
-	setPicking(false);
-	repaint();
-	return result;
-}
-
-// =============================================================================
-//
-void gl::Renderer::setPicking(bool picking)
-{
-	m_isDrawingSelectionScene = picking;
-	setBackground();
-
-	if (m_isDrawingSelectionScene)
-	{
-		glDisable(GL_DITHER);
-
-		// Use particularly thick lines while picking ease up selecting lines.
-		glLineWidth(qMax<double>(config::lineThickness(), 6.5));
-	}
-	else
-	{
-		glEnable(GL_DITHER);
-
-		// Restore line thickness
-		glLineWidth(config::lineThickness());
-	}
+	const qreal tolerance = pickingTolerance();
+	return m_compiler->pickingTree().pick(sceneMatrix(), size(), QPointF(mouseX, mouseY), tolerance, pickableSurfaces());
 }
 
 /*
@@ -723,89 +765,62 @@ QImage gl::Renderer::screenCapture()
 	return image.rgbSwapped().mirrored();
 }
 
-// =============================================================================
-//
+/*
+ * Pans and zooms the camera so that the model is centered and just fits into the view. Both are solved from the
+ * corners of the bounding box of the model, projected as the scene is drawn.
+ */
 void gl::Renderer::zoomToFit()
 {
-	currentCamera().setZoom(30.0f);
-	bool lastfilled = false;
-	bool firstrun = true;
-	bool inward = true;
-	int runaway = 50;
-
-	// Use the pick list while drawing the scene, this way we can tell whether borders
-	// are background or not.
-	setPicking (true);
+	const BoundingBox& box = m_compiler->modelBoundingBox();
 
-	while (--runaway)
+	if (box.isEmpty() or width() <= 0 or height() <= 0)
 	{
-		if (zoom() > 10000.0 or zoom() < 0.0)
-		{
-			// Nothing to draw if we get here.
-			currentCamera().setZoom(30.0);
-			break;
-		}
-
-		currentCamera().zoomNotch(inward);
-		QVector<unsigned char> capture (4 * width() * height());
-		drawGLScene();
-		glReadPixels (0, 0, width(), height(), GL_RGBA, GL_UNSIGNED_BYTE, capture.data());
-		QImage image (capture.constData(), width(), height(), QImage::Format_ARGB32);
-		bool filled = false;
+		// Nothing to draw if we get here.
+		currentCamera().setZoom(30.0);
+		return;
+	}
 
-		// Check the top and bottom rows
-		for (int i = 0; i < image.width(); ++i)
-		{
-			if (image.pixel (i, 0) != BlackRgb or image.pixel (i, height() - 1) != BlackRgb)
-			{
-				filled = true;
-				break;
-			}
-		}
+	const Vertex& minimum = box.minimumVertex();
+	const Vertex& maximum = box.maximumVertex();
+	QVector<QVector3D> corners;
 
-		// Left and right edges
-		if (filled == false)
-		{
-			for (int i = 0; i < image.height(); ++i)
-			{
-				if (image.pixel (0, i) != BlackRgb or image.pixel (width() - 1, i) != BlackRgb)
-				{
-					filled = true;
-					break;
-				}
-			}
-		}
+	for (int i = 0; i < 8; ++i)
+	{
+		corners.append({
+			float((i & 1) ? maximum.x : minimum.x),
+			float((i & 2) ? maximum.y : minimum.y),
+			float((i & 4) ? maximum.z : minimum.z)
+		});
+	}
 
-		if (firstrun)
-		{
-			// If this is the first run, we don't know enough to determine
-			// whether the zoom was to fit, so we mark in our knowledge so
-			// far and start over.
-			inward = not filled;
-			firstrun = false;
-		}
-		else
+	if (not m_cameraInfo.isModelview())
+	{
+		currentCamera().fitToView(corners);
+	}
+	else
+	{
+		// The free camera rotates the model about the center of its bounding box, so that center is brought onto
+		// the view axis by clearing the panning. A corner q, in the rotated coordinates of the model, then lies at
+		// q + (0, 0, -2 - zoom) in eye coordinates. Solve for the zoom that brings it onto the edges of the
+		// perspective projection, and in front of the near plane.
+		const QMatrix4x4 rotation = padMatrix(m_rotation.toRotationMatrix());
+		const QVector3D center = box.center().toVector();
+		const double focalLength = 1 / tan(qDegreesToRadians(45.0 / 2));
+		const double aspectRatio = double(width()) / height();
+		double zoom = -inf;
+
+		for (const QVector3D& corner : corners)
 		{
-			// If this run filled the screen and the last one did not, the
-			// last run had ideal zoom - zoom a bit back and we should reach it.
-			if (filled and not lastfilled)
-			{
-				currentCamera().zoomNotch(false);
-				break;
-			}
-
-			// If this run did not fill the screen and the last one did, we've
-			// now reached ideal zoom so we're done here.
-			if (not filled and lastfilled)
-				break;
-
-			inward = not filled;
+			QVector3D rotated = rotation.map(corner - center);
+			double depth = rotated.z() - 2;
+			zoom = qMax(zoom, focalLength / aspectRatio * qAbs(rotated.x()) + depth);
+			zoom = qMax(zoom, focalLength * qAbs(rotated.y()) + depth);
+			zoom = qMax(zoom, near + depth);
 		}
 
-		lastfilled = filled;
+		currentCamera().setPanning(0, 0);
+		currentCamera().setZoom(qBound(0.01, zoom, 10000.0));
 	}
-
-	setPicking (false);
 }
 
 // =============================================================================
@@ -826,22 +841,7 @@ void gl::Renderer::highlightCursorObject()
 	QModelIndex oldIndex = m_objectAtCursor;
 
 	if (not m_isCameraMoving and config::highlightObjectBelowCursor())
-	{
-		setPicking (true);
-		drawGLScene();
-		setPicking (false);
-		unsigned char pixel[4];
-		glReadPixels(
-			m_mousePosition.x(),
-			height() - m_mousePosition.y(),
-			1,
-			1,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			&pixel[0]
-		);
-		newIndex = model()->objectByPickingColor(colorFromPixel(pixel));
-	}
+		newIndex = pick(m_mousePosition.x(), m_mousePosition.y());
 
 	if (newIndex != oldIndex)
 	{
@@ -887,11 +887,6 @@ double gl::Renderer::zoom()
 	return currentCamera().zoom();
 }
 
-bool gl::Renderer::isDrawingSelectionScene() const
-{
-	return m_isDrawingSelectionScene;
-}
-
 Qt::MouseButtons gl::Renderer::lastButtons() const
 {
 	return m_lastButtons;
@@ -71,7 +71,6 @@ protected:
 
 	QColor backgroundColor() const;
 	virtual bool freeCameraAllowed() const;
-	bool isDrawingSelectionScene() const;
 	Qt::MouseButtons lastButtons() const;
 	bool mouseHasMoved() const;
 	virtual void overpaint(QPainter& painter);
@@ -97,7 +96,6 @@ private:
 	bool m_useDarkBackground = false;
 	bool m_panning = false;
 	bool m_initialized = false;
-	bool m_isDrawingSelectionScene = false;
 	bool m_isCameraMoving = false;
 	bool m_needZoomToFit = true;
 	bool m_axesInitialized = false;
@@ -111,15 +109,19 @@ private:
 	GLuint m_axesColorVbo;
 
 	void calcCameraIcons();
+	void bindVbo(GLuint vbo, VboSubclass colors);
 	void drawGLScene();
+	void drawInstances(VboClass surface, VboSubclass colors, GLenum type);
 	void drawVbos(VboClass surface, VboSubclass colors);
 	void freeAxes();
 	void highlightCursorObject();
 	void initializeAxes();
 	void initializeLighting();
 	void initGLData();
+	QMatrix4x4 modelviewMatrix();
 	void needZoomToFit();
-	void setPicking(bool picking);
+	QMatrix4x4 sceneMatrix();
+	void setLightInverted(bool inverted);
 	void zoomToFit();
 	void zoomAllToFit();
 };
@@ -18,11 +18,13 @@
 
 #include <QMetaObject>
 #include "hierarchyelement.h"
+#include "documentmanager.h"
 #include "mainwindow.h"
 
 
 HierarchyElement::HierarchyElement (QObject* parent) :
-	m_window (nullptr)
+	m_window (nullptr),
+	m_documents (nullptr)
 {
 	if (parent)
 	{
@@ -30,20 +32,35 @@ HierarchyElement::HierarchyElement (QObject* parent) :
 			parent = parent->parent();
 
 		m_window = qobject_cast<MainWindow*> (parent);
+
+		// In batch mode there is no MainWindow, and the document manager is at the top of the hierarchy instead.
+		if (m_window == nullptr)
+			m_documents = qobject_cast<DocumentManager*> (parent);
 	}
 
-	if (m_window == nullptr)
+	if (m_window)
+	{
+		m_documents = m_window->documents();
+	}
+	else if (parent and m_documents == nullptr)
 	{
-		// The MainWindow relation should have been found.
-		QString error = format("Hierarchy element instance %1 should have a MainWindow parent, but it is %2 (%3).\n",
-		                       this, parent, parent ? parent->metaObject()->className() : "nullptr");
+		// The MainWindow or DocumentManager relation should have been found.
+		QString error = format("Hierarchy element instance %1 should have a MainWindow or DocumentManager parent, "
+		                       "but it is %2 (%3).\n", this, parent, parent->metaObject()->className());
 		throw std::runtime_error {error.toUtf8().constData()};
 	}
-
-	m_documents = m_window->documents();
 }
 
 
+/*
+ * Constructs an element from hierarchy pointers that have already been resolved. Unlike the constructor above, this
+ * does not walk the parent chain, so it is safe to use outside the GUI thread.
+ */
+HierarchyElement::HierarchyElement (MainWindow* window, DocumentManager* documents) :
+	m_window (window),
+	m_documents (documents) {}
+
+
 LDDocument* HierarchyElement::currentDocument() const
 {
 	return m_window->currentDocument();
@@ -68,6 +85,12 @@ Grid* HierarchyElement::grid() const
 }
 
 
+MainWindow* HierarchyElement::window() const
+{
+	return m_window;
+}
+
+
 QString HierarchyElement::preferredLicenseText() const
 {
 	QString caLicenseText = "!LICENSE Redistributable under CCAL version 2.0 : see CAreadme.txt";
@@ -32,15 +32,20 @@ class MainWindow;
 // Objects that are to take part in the MainWindow's hierarchy multiple-inherit from this class to get a pointer back
 // to the MainWindow class along with a few useful pointers and methods.
 //
+// In batch mode there is no MainWindow. The window pointer is then null, and the elements may only use the document
+// manager, which is either the element's top-level parent or the element itself when it has no parent.
+//
 class HierarchyElement
 {
 public:
 	HierarchyElement (QObject* parent);
+	HierarchyElement (MainWindow* window, DocumentManager* documents);
 
 	QSet<LDObject *> selectedObjects();
 	LDDocument* currentDocument() const;
 	PrimitiveManager* primitives();
 	Grid* grid() const;
+	MainWindow* window() const;
 
 	// Utility functions
 	QString preferredLicenseText() const;
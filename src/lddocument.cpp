@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <QMessageBox>
 #include <QFileDialog>
 #include "lddocument.h"
@@ -26,16 +27,18 @@
 
 LDDocument::LDDocument (DocumentManager* parent) :
     Model {parent},
-	HierarchyElement (parent),
+	// Documents are also built by the subfile loaders in worker threads, so the pointers are taken from the manager,
+	// which resolved them in the GUI thread, instead of walking the parent chain.
+	HierarchyElement (parent->window(), parent),
     m_history (new EditHistory (this)),
 	m_savePosition(-1),
     m_tabIndex(-1)
 {
 	connect(
 		this,
-		SIGNAL(objectAdded(QModelIndex)),
+		SIGNAL(rowsInserted(QModelIndex, int, int)),
 		this,
-		SLOT(handleNewObject(QModelIndex))
+		SLOT(handleRowInsertion(QModelIndex, int, int))
 	);
 
 	connect(
@@ -48,9 +51,9 @@ LDDocument::LDDocument (DocumentManager* parent) :
 	);
 	connect(
 		this,
-		SIGNAL(aboutToRemoveObject(QModelIndex)),
+		SIGNAL(rowsAboutToBeRemoved(QModelIndex, int, int)),
 		this,
-		SLOT(handleImminentObjectRemoval(QModelIndex)),
+		SLOT(handleRowRemoval(QModelIndex, int, int)),
 		Qt::DirectConnection
 	);
 	connect(
@@ -67,6 +70,9 @@ LDDocument::~LDDocument()
 {
 	m_isBeingDestroyed = true;
 	delete m_history;
+
+	for (const QString& name : m_referenceNames)
+		documentManager()->removeDependency(this, name);
 }
 
 QString LDDocument::name() const
@@ -77,6 +83,7 @@ QString LDDocument::name() const
 void LDDocument::setName (QString value)
 {
 	this->header.name = value;
+	emit renamed();
 }
 
 EditHistory* LDDocument::history() const
@@ -127,6 +134,7 @@ QString LDDocument::defaultName() const
 void LDDocument::setDefaultName (QString value)
 {
 	m_defaultName = value;
+	emit renamed();
 }
 
 void LDDocument::setFrozen(bool value)
@@ -353,7 +361,7 @@ bool LDDocument::save (QString path, qint64* sizeptr)
 
 	if (this->header.type != LDHeader::NoHeader)
 	{
-		header.name = LDDocument::shortenName(path);
+		setName(LDDocument::shortenName(path));
 		data += headerToString(*this, this->header).toUtf8();
 	}
 
@@ -381,21 +389,120 @@ bool LDDocument::save (QString path, qint64* sizeptr)
 	setSavePosition (history()->position());
 	setFullPath (path);
 	setName (shortenName (path));
-	m_window->updateDocumentListItem (this);
-	m_window->updateTitle();
+
+	if (m_window)
+	{
+		m_window->updateDocumentListItem (this);
+		m_window->updateTitle();
+	}
+
 	return true;
 }
 
-void LDDocument::handleNewObject(const QModelIndex& index)
+void LDDocument::handleRowInsertion(const QModelIndex&, int first, int last)
 {
-	LDObject* object = lookup(index);
-	history()->add<AddHistoryEntry>(index);
-	connect(
-		object,
-		SIGNAL(modified(LDObjectState, LDObjectState)),
-		this,
-		SLOT(objectChanged(LDObjectState, LDObjectState))
-	);
+	history()->add<AddHistoryEntry>(first, last);
+
+	for (int row = first; row <= last; row += 1)
+	{
+		m_staleVertexObjects.insert(getObject(row));
+		updateReference(getObject(row));
+		connect(
+			getObject(row),
+			SIGNAL(modified(LDObjectState, LDObjectState)),
+			this,
+			SLOT(objectChanged(LDObjectState, LDObjectState))
+		);
+	}
+}
+
+/*
+ * Records the changes of an edit transaction in the history, and announces each run of consecutive changed rows as one
+ * change of data.
+ */
+void LDDocument::commitChanges(const QVector<EditTransaction::Change>& changes)
+{
+	Model::commitChanges(changes);
+
+	QVector<int> rows;
+
+	for (const EditTransaction::Change& change : changes)
+	{
+		history()->add<EditHistoryEntry>(index(change.row), change.before, change.after);
+		m_staleVertexObjects.insert(change.object);
+		updateReference(change.object);
+		rows.append(change.row);
+	}
+
+	announceChangedRows(rows);
+}
+
+/*
+ * Emits one change of data for each run of consecutive rows.
+ */
+void LDDocument::announceChangedRows(QVector<int> rows)
+{
+	std::sort(rows.begin(), rows.end());
+	int first = 0;
+
+	for (int i = 1; i <= rows.size(); i += 1)
+	{
+		if (i == rows.size() or rows[i] != rows[i - 1] + 1)
+		{
+			emit dataChanged(index(rows[first]), index(rows[i - 1]));
+			first = i;
+		}
+	}
+}
+
+/*
+ * Keeps the document manager informed of the subfile that an object refers to, if any.
+ */
+void LDDocument::updateReference(LDObject* object)
+{
+	QString oldName = m_referenceNames.value(object);
+	QString newName;
+
+	if (object->type() == LDObjectType::SubfileReference)
+		newName = DocumentManager::normalizedName(static_cast<LDSubfileReference*>(object)->referenceName());
+
+	if (newName != oldName)
+	{
+		if (not oldName.isEmpty())
+			documentManager()->removeDependency(this, oldName);
+
+		if (newName.isEmpty())
+		{
+			m_referenceNames.remove(object);
+		}
+		else
+		{
+			m_referenceNames[object] = newName;
+			documentManager()->addDependency(this, newName);
+		}
+	}
+}
+
+/*
+ * Called when the subfile of the given normalized name, or a subfile of it, has changed. Drops what has been cached from it and
+ * announces the references to it as changed, so that they are drawn again.
+ */
+void LDDocument::invalidateSubfile(const QString& name)
+{
+	QVector<int> rows;
+	m_needsRecache = true;
+	_needsTriangleRecount = true;
+
+	for (auto iterator = m_referenceNames.begin(); iterator != m_referenceNames.end(); ++iterator)
+	{
+		if (iterator.value() == name)
+		{
+			m_staleVertexObjects.insert(iterator.key());
+			rows.append(indexOf(iterator.key()).row());
+		}
+	}
+
+	announceChangedRows(rows);
 }
 
 void LDDocument::objectChanged(const LDObjectState& before, const LDObjectState& after)
@@ -406,20 +513,33 @@ void LDDocument::objectChanged(const LDObjectState& before, const LDObjectState&
 	{
 		QModelIndex index = this->indexOf(object);
 		history()->add<EditHistoryEntry>(index, before, after);
-		redoVertices();
+		m_staleVertexObjects.insert(object);
+		updateReference(object);
 		emit objectModified(object);
 		emit dataChanged(index, index);
 	}
 }
 
-void LDDocument::handleImminentObjectRemoval(const QModelIndex& index)
+void LDDocument::handleRowRemoval(const QModelIndex&, int first, int last)
 {
-	LDObject* object = lookup(index);
-
 	if (not isFrozen() and not m_isBeingDestroyed)
+		history()->add<DelHistoryEntry>(first, last);
+
+	if (not m_isBeingDestroyed)
 	{
-		history()->add<DelHistoryEntry>(index);
-		m_objectVertices.remove(object);
+		for (int row = first; row <= last; row += 1)
+		{
+			LDObject* object = getObject(row);
+			m_vertexIndex.remove(object);
+			m_staleVertexObjects.remove(object);
+			auto iterator = m_referenceNames.find(object);
+
+			if (iterator != m_referenceNames.end())
+			{
+				documentManager()->removeDependency(this, *iterator);
+				m_referenceNames.erase(iterator);
+			}
+		}
 	}
 }
 
@@ -445,66 +565,62 @@ QString LDDocument::getDisplayName()
 
 // =============================================================================
 //
-void LDDocument::initializeCachedData()
+QVector<LDPolygon> LDDocument::inlinePolygons()
 {
-	if (m_needsRecache)
-	{
-		this->m_polygonData.clear();
-		Model model {m_documents};
-		this->inlineContents(model, true, true);
-
-		for (LDObject* obj : model.objects())
-		{
-			if (obj->type() == LDObjectType::SubfileReference)
-			{
-				print ("Warning: unable to inline %1 into %2",
-					static_cast<LDSubfileReference*> (obj)->referenceName(),
-					getDisplayName());
-				continue;
-			}
+	updatePolygonData();
+	return polygonData();
+}
 
-			LDPolygon data = obj->getPolygon();
+/*
+ * Rebuilds the stored polygon data if the document has changed. The polygons are collected straight into a flat
+ * buffer: subfile references contribute the stored polygon data of their subfiles, transformed with their matrices,
+ * so no objects are created in the process.
+ */
+void LDDocument::updatePolygonData()
+{
+	// Protect against circular references the same way inlineContents does.
+	if (not m_needsRecache or m_isInlining)
+		return;
 
-			if (data.isValid())
-				m_polygonData << data;
-		}
+	m_isInlining = true;
+	m_polygonData.clear();
+	LDDocument* logoedStud = documentManager()->logoedStudFor(this);
 
-		m_needsRecache = false;
+	if (logoedStud != nullptr)
+	{
+		m_polygonData = logoedStud->inlinePolygons();
 	}
-
-	if (m_verticesOutdated)
+	else
 	{
-		m_objectVertices.clear();
-		Model model {m_documents};
-		inlineContents(model, true, false);
-
-		for (LDObject* object : model)
+		for (LDObject* object : objects())
 		{
-			auto iterator = m_objectVertices.find (object);
+			if (not object->isScemantic())
+				continue;
 
-			if (iterator == m_objectVertices.end())
-				iterator = m_objectVertices.insert (object, QSet<Vertex>());
+			if (object->isRasterizable())
+			{
+				int firstPolygon = m_polygonData.size();
+				m_polygonData += object->rasterizePolygons(documentManager(), winding());
+
+				// Main color in the rasterized polygons stands for the color of the object.
+				for (int i = firstPolygon; i < m_polygonData.size(); ++i)
+				{
+					if (m_polygonData[i].color == MainColor)
+						m_polygonData[i].color = object->color();
+				}
+			}
 			else
-				iterator->clear();
+			{
+				LDPolygon polygon = object->getPolygon();
 
-			object->getVertices(documentManager(), *iterator);
+				if (polygon.isValid())
+					m_polygonData.append(polygon);
+			}
 		}
-
-		m_vertices.clear();
-
-		for (const QSet<Vertex>& vertices : m_objectVertices)
-			m_vertices.unite(vertices);
-
-		m_verticesOutdated = false;
 	}
-}
 
-// =============================================================================
-//
-QVector<LDPolygon> LDDocument::inlinePolygons()
-{
-	initializeCachedData();
-	return polygonData();
+	m_isInlining = false;
+	m_needsRecache = false;
 }
 
 /*
@@ -563,17 +679,44 @@ QString LDDocument::shortenName(const QFileInfo& path) // [static]
 		return shortname;
 }
 
-// =============================================================================
-//
-const QSet<Vertex>& LDDocument::inlineVertices()
+/*
+ * Returns the vertices of this document, including those of its subfiles.
+ */
+QSet<Vertex> LDDocument::inlineVertices()
 {
-	initializeCachedData();
-	return m_vertices;
+	return vertexIndex().vertices();
 }
 
-void LDDocument::redoVertices()
+/*
+ * Returns the index of the vertices of this document, including those of its subfiles. Only the objects that have been
+ * added or changed since the index was last used are indexed again.
+ */
+const VertexIndex& LDDocument::vertexIndex()
 {
-	m_verticesOutdated = true;
+	// Protect against circular references, like when inlining.
+	if (not m_isIndexingVertices)
+	{
+		m_isIndexingVertices = true;
+
+		for (LDObject* object : m_staleVertexObjects)
+		{
+			QSet<Vertex> vertices;
+
+			// Skip those without effect on the model meaning
+			if (object->isScemantic())
+				object->getVertices(documentManager(), vertices);
+
+			if (vertices.isEmpty())
+				m_vertexIndex.remove(object);
+			else
+				m_vertexIndex.insert(object, vertices);
+		}
+
+		m_staleVertexObjects.clear();
+		m_isIndexingVertices = false;
+	}
+
+	return m_vertexIndex;
 }
 
 decltype(LDHeader::license) LDHeader::defaultLicense()
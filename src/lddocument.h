@@ -20,6 +20,7 @@
 #include <QObject>
 #include "model.h"
 #include "hierarchyelement.h"
+#include "vertexindex.h"
 
 struct LDGLData;
 class DocumentManager;
@@ -93,15 +94,16 @@ public:
 	void addHistoryStep();
 	void clearHistory();
 	void close();
+	void commitChanges(const QVector<EditTransaction::Change>& changes) override;
 	QString defaultName() const;
 	QString fullPath();
 	QString getDisplayName();
 	bool hasUnsavedChanges() const;
 	EditHistory* history() const;
-	void initializeCachedData();
 	void inlineContents(Model& model, bool deep, bool renderinline);
 	QVector<LDPolygon> inlinePolygons();
-	const QSet<Vertex>& inlineVertices();
+	QSet<Vertex> inlineVertices();
+	void invalidateSubfile(const QString& name);
 	bool isFrozen() const;
 	bool isSafeToClose();
 	QString name() const;
@@ -109,7 +111,6 @@ public:
 	const QVector<LDPolygon>& polygonData() const;
 	void recountTriangles();
 	void redo();
-	void redoVertices();
 	bool save (QString path = "", qint64* sizeptr = nullptr);
 	long savePosition() const;
 	void setDefaultName (QString value);
@@ -120,6 +121,7 @@ public:
 	void setTabIndex (int value);
 	int tabIndex() const;
 	void undo();
+	const VertexIndex& vertexIndex();
 	void vertexChanged (const Vertex& a, const Vertex& b);
 
 	static QString shortenName(const class QFileInfo& path); // Turns a full path into a relative path
@@ -128,25 +130,33 @@ protected:
 	LDObject* withdrawAt(int position);
 
 private:
+	void announceChangedRows(QVector<int> rows);
+	void updatePolygonData();
+	void updateReference(LDObject* object);
+
 	QString m_fullPath;
 	QString m_defaultName;
 	EditHistory* m_history;
 	bool m_isFrozen = true; // Document may not be modified
-	bool m_verticesOutdated = true;
 	bool m_isBeingDestroyed = false;
 	bool m_needsRecache = true; // The next polygon inline of this document rebuilds stored polygon data.
 	bool m_isInlining = false;
+	bool m_isIndexingVertices = false;
 	long m_savePosition;
 	int m_tabIndex;
 	int m_triangleCount;
 	QVector<LDPolygon> m_polygonData;
-	QMap<LDObject*, QSet<Vertex>> m_objectVertices;
-	QSet<Vertex> m_vertices;
+	VertexIndex m_vertexIndex;
+	QSet<LDObject*> m_staleVertexObjects; // Objects whose vertices are missing from the index or outdated
+	QHash<LDObject*, QString> m_referenceNames; // Normalized names of the subfiles that the subfile references refer to
+
+signals:
+	void renamed();
 
 private slots:
 	void objectChanged(const LDObjectState &before, const LDObjectState &after);
-	void handleNewObject(const QModelIndex& index);
-	void handleImminentObjectRemoval(const QModelIndex& index);
+	void handleRowInsertion(const QModelIndex&, int first, int last);
+	void handleRowRemoval(const QModelIndex&, int first, int last);
 };
 
 // Parses a string line containing an LDraw object and returns the object parsed.
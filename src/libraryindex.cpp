@@ -0,0 +1,213 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include "libraryindex.h"
+
+enum
+{
+	// Increase this when the format of the cache file changes.
+	CacheVersion = 1,
+};
+
+QDataStream& operator<<(QDataStream& out, const LibraryIndex::Directory& directory)
+{
+	return out << directory.modified << directory.files << directory.subdirectories;
+}
+
+QDataStream& operator>>(QDataStream& in, LibraryIndex::Directory& directory)
+{
+	return in >> directory.modified >> directory.files >> directory.subdirectories;
+}
+
+LibraryIndex::LibraryIndex(const QString& cachePath) :
+	m_cachePath {cachePath} {}
+
+/*
+ * Returns the absolute path of the library file of the given name, or an empty string if there is no such file.
+ */
+QString LibraryIndex::find(const QString& name) const
+{
+	return m_paths.value(normalizedName(name));
+}
+
+/*
+ * Returns a number that changes whenever files appear in or disappear from the index.
+ */
+int LibraryIndex::revision() const
+{
+	return m_revision;
+}
+
+/*
+ * Brings the index up to date with the given libraries. The parts and p directories of the libraries are searched in
+ * order, and the first file of each name wins. Only directories whose modification time has changed are scanned.
+ */
+void LibraryIndex::update(const Libraries& libraries)
+{
+	if (not m_isLoaded)
+	{
+		load();
+		m_isLoaded = true;
+	}
+
+	QStringList roots;
+	QHash<QString, Directory> directories;
+	m_hasChanged = false;
+
+	for (const Library& library : libraries)
+	{
+		for (const QString& subdirectory : {"parts", "p"})
+		{
+			QString root = QDir::cleanPath(library.path + "/" + subdirectory);
+
+			if (not roots.contains(root))
+			{
+				roots.append(root);
+				validate(root, directories);
+			}
+		}
+	}
+
+	// Directories that are no longer part of any library are a change as well.
+	if (directories.size() != m_directories.size())
+		m_hasChanged = true;
+
+	m_directories = directories;
+
+	if (m_hasChanged or m_paths.isEmpty())
+	{
+		QHash<QString, QString> oldPaths = m_paths;
+		m_paths.clear();
+
+		for (const QString& root : roots)
+			addFiles(root, "");
+
+		if (m_paths != oldPaths)
+			m_revision += 1;
+
+		if (m_hasChanged)
+			save();
+	}
+}
+
+/*
+ * Normalizes a subfile name into a key of the index: LDraw names are case-insensitive and may use either slash.
+ */
+QString LibraryIndex::normalizedName(const QString& name)
+{
+	return QString {name}.replace("\\", "/").toLower();
+}
+
+/*
+ * Adds the files of the given indexed directory and its subdirectories to the paths, unless an earlier directory
+ * already has a file of the same name.
+ */
+void LibraryIndex::addFiles(const QString& path, const QString& prefix)
+{
+	auto iterator = m_directories.find(path);
+
+	if (iterator == m_directories.end())
+		return;
+
+	for (const QString& file : iterator->files)
+	{
+		QString name = normalizedName(prefix + file);
+
+		if (not m_paths.contains(name))
+			m_paths.insert(name, path + "/" + file);
+	}
+
+	for (const QString& subdirectory : iterator->subdirectories)
+		addFiles(path + "/" + subdirectory, prefix + subdirectory + "/");
+}
+
+/*
+ * Checks the given directory against the index, scanning it if it is new or has changed, and recurses into its
+ * subdirectories. The up-to-date entries are collected into the given hash.
+ */
+void LibraryIndex::validate(const QString& path, QHash<QString, Directory>& directories)
+{
+	QFileInfo info {path};
+
+	if (not info.isDir() or directories.contains(path))
+		return;
+
+	qint64 modified = info.lastModified().toMSecsSinceEpoch();
+	Directory directory = m_directories.value(path);
+
+	if (directory.modified != modified)
+	{
+		QDir dir {path};
+		directory.modified = modified;
+		directory.files = dir.entryList({"*.dat"}, QDir::Files);
+		directory.subdirectories = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+		m_hasChanged = true;
+	}
+
+	directories.insert(path, directory);
+
+	for (const QString& subdirectory : directory.subdirectories)
+		validate(path + "/" + subdirectory, directories);
+}
+
+/*
+ * Reads the index from the cache file. A missing or outdated cache file leaves the index empty.
+ */
+void LibraryIndex::load()
+{
+	QFile file {m_cachePath};
+
+	if (file.open(QIODevice::ReadOnly))
+	{
+		QDataStream stream {&file};
+		qint32 version;
+		QHash<QString, Directory> directories;
+		stream >> version;
+
+		if (version == CacheVersion)
+		{
+			stream >> directories;
+
+			if (stream.status() == QDataStream::Ok)
+				m_directories = directories;
+		}
+	}
+}
+
+/*
+ * Writes the index into the cache file.
+ */
+void LibraryIndex::save() const
+{
+	QFile file {m_cachePath};
+
+	if (file.open(QIODevice::WriteOnly))
+	{
+		QDataStream stream {&file};
+		stream << qint32 {CacheVersion} << m_directories;
+	}
+	else
+	{
+		print(QObject::tr("Couldn't write the library index to %1: %2"), m_cachePath, file.errorString());
+	}
+}
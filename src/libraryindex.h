@@ -0,0 +1,64 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include "main.h"
+#include "types/library.h"
+
+/*
+ * An index of the .dat files in the parts and p directories of the libraries, so that subfile names can be resolved
+ * without asking the file system. The index is stored in a file and revalidated against the modification times of the
+ * directories, so that only directories that have had files added or removed since are scanned again.
+ */
+class LibraryIndex
+{
+public:
+	LibraryIndex(const QString& cachePath);
+
+	QString find(const QString& name) const;
+	int revision() const;
+	void update(const Libraries& libraries);
+
+	static QString normalizedName(const QString& name);
+
+private:
+	struct Directory
+	{
+		qint64 modified = -1;
+		QStringList files;
+		QStringList subdirectories;
+	};
+
+	friend QDataStream& operator<<(QDataStream& out, const Directory& directory);
+	friend QDataStream& operator>>(QDataStream& in, Directory& directory);
+
+	void addFiles(const QString& path, const QString& prefix);
+	void load();
+	void save() const;
+	void validate(const QString& path, QHash<QString, Directory>& directories);
+
+	const QString m_cachePath;
+	QHash<QString, Directory> m_directories; // By absolute path
+	QHash<QString, QString> m_paths; // Absolute paths of the files by normalized name
+	int m_revision = 0; // Changes whenever the contents of the index change
+	bool m_isLoaded = false;
+	bool m_hasChanged = false;
+};
@@ -1,3 +1,5 @@
+#include <QHash>
+#include <QMutex>
 #include "../algorithms/geometry.h"
 #include "../glShared.h"
 #include "../model.h"
@@ -27,6 +29,93 @@ QString LDCircularPrimitive::buildFilename() const
 	return format("%1%2-%3%4.dat", prefix, numerator, denominator, stem());
 }
 
+namespace
+{
+	struct UnitBodyKey
+	{
+		PrimitiveModel::Type type;
+		int segments;
+		int divisions;
+
+		bool operator==(const UnitBodyKey& other) const
+		{
+			return type == other.type and segments == other.segments and divisions == other.divisions;
+		}
+
+		friend uint qHash(const UnitBodyKey& key, uint seed = 0)
+		{
+			return ::qHash((static_cast<int>(key.type) << 24) ^ (key.segments << 12) ^ key.divisions, seed);
+		}
+	};
+}
+
+/*
+ * Returns the polygons of a circular primitive of the given shape, before it is transformed. The polygons only depend
+ * on the shape, so they are generated once and shared by every primitive of that shape from then on. Primitives are
+ * rasterized by the compiler in worker threads as well, hence the mutex.
+ */
+static QVector<LDPolygon> unitPolygons(PrimitiveModel::Type type, int segments, int divisions)
+{
+	static QMutex mutex;
+	static QHash<UnitBodyKey, QVector<LDPolygon>> cache;
+	const UnitBodyKey key {type, segments, divisions};
+
+	{
+		QMutexLocker locker {&mutex};
+		auto iterator = cache.find(key);
+
+		if (iterator != cache.end())
+			return *iterator;
+	}
+
+	Model body {nullptr};
+	PrimitiveModel primitive;
+	primitive.type = type;
+	primitive.segments = segments;
+	primitive.divisions = divisions;
+	primitive.ringNumber = 0;
+	primitive.generateBody(body, true);
+	QVector<LDPolygon> polygons;
+
+	for (LDObject* object : body.objects())
+	{
+		LDPolygon polygon = object->getPolygon();
+
+		if (polygon.isValid())
+			polygons.append(polygon);
+	}
+
+	QMutexLocker locker {&mutex};
+	cache.insert(key, polygons);
+	return polygons;
+}
+
+/*
+ * Transforms every vertex of the given polygons by the given matrix. The matrix is read out once, and every polygon
+ * has room for four vertices, so the loop has a fixed shape that the compiler can vectorize.
+ */
+static void transformPolygons(QVector<LDPolygon>& polygons, const QMatrix4x4& matrix)
+{
+	double m[3][4];
+
+	for (int i = 0; i < 3; ++i)
+	for (int j = 0; j < 4; ++j)
+		m[i][j] = matrix(i, j);
+
+	for (LDPolygon& polygon : polygons)
+	{
+		for (Vertex& vertex : polygon.vertices)
+		{
+			const double x = vertex.x;
+			const double y = vertex.y;
+			const double z = vertex.z;
+			vertex.x = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+			vertex.y = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+			vertex.z = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+		}
+	}
+}
+
 LDCircularPrimitive::LDCircularPrimitive(PrimitiveModel::Type type,
 	int segments,
 	int divisions,
@@ -106,29 +195,13 @@ void LDCircularPrimitive::rasterize(
 
 QVector<LDPolygon> LDCircularPrimitive::rasterizePolygons(DocumentManager* context, Winding winding)
 {
-	Model cylinderBody {context};
-	buildPrimitiveBody(cylinderBody, true);
-	QVector<LDPolygon> result;
-	bool cachedShouldInvert = shouldInvert(winding, context);
+	QVector<LDPolygon> result = unitPolygons(m_type, segments(), divisions());
+	transformPolygons(result, transformationMatrix());
 
-	for (LDObject* object : cylinderBody.objects())
+	if (shouldInvert(winding, context))
 	{
-		for (int i = 0; i < object->numVertices(); i += 1)
-		{
-			Vertex vertex = object->vertex(i);
-			vertex.transform(transformationMatrix());
-			object->setVertex(i, vertex);
-		}
-
-		LDPolygon polygon = object->getPolygon();
-
-		if (polygon.isValid())
-		{
-			if (cachedShouldInvert)
-				invertPolygon(polygon);
-
-			result.append(polygon);
-		}
+		for (LDPolygon& polygon : result)
+			invertPolygon(polygon);
 	}
 
 	return result;
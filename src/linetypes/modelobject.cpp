@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QAtomicInteger>
 #include "../documentmanager.h"
 #include "../linetypes/modelobject.h"
 #include "../lddocument.h"
@@ -38,13 +39,27 @@ QMap<qint32, LDObject*> g_allObjects;
 
 enum { MAX_LDOBJECT_IDS = (1 << 24) };
 
+/*
+ * Returns a pseudo-random number for the random color of a new object. Objects are also created by the subfile loaders
+ * in worker threads, where rand() cannot be used, so this scrambles an atomic counter instead.
+ */
+static quint32 nextRandomColorSeed()
+{
+	static QAtomicInteger<quint32> counter;
+	quint32 seed = counter.fetchAndAddRelaxed(1);
+	seed = (seed ^ (seed >> 16)) * 0x85ebca6bu;
+	seed = (seed ^ (seed >> 13)) * 0xc2b2ae35u;
+	return seed ^ (seed >> 16);
+}
+
 // =============================================================================
 // LDObject constructors
 //
 LDObject::LDObject() :
 	m_isHidden {false}
 {
-	m_randomColor = QColor::fromHsv (rand() % 360, rand() % 256, rand() % 96 + 128);
+	quint32 seed = nextRandomColorSeed();
+	m_randomColor = QColor::fromHsv (seed % 360, (seed >> 9) % 256, (seed >> 17) % 96 + 128);
 }
 
 // =============================================================================
@@ -297,6 +312,7 @@ QVector<LDPolygon> LDSubfileReference::rasterizePolygons(DocumentManager* contex
 void LDSubfileReference::setReferenceName(const QString& newReferenceName)
 {
 	changeProperty(&this->m_referenceName, newReferenceName);
+	m_resolvedContext = nullptr;
 }
 
 // =============================================================================
@@ -534,9 +550,22 @@ LDSubfileReference::LDSubfileReference(
 
 // =============================================================================
 //
+/*
+ * Returns the subfile that this reference refers to. The subfile is looked up again only after documents have been
+ * added, removed or renamed.
+ */
 LDDocument* LDSubfileReference::fileInfo(DocumentManager* context) const
 {
-	return context->getDocumentByName(m_referenceName);
+	if (context != m_resolvedContext or context->generation() != m_resolvedGeneration)
+	{
+		m_resolvedSubfile = context->getDocumentByName(m_referenceName);
+
+		// Looking up the subfile may have loaded it, so take the generation afterwards.
+		m_resolvedContext = context;
+		m_resolvedGeneration = context->generation();
+	}
+
+	return m_resolvedSubfile;
 }
 
 QString LDSubfileReference::referenceName() const
@@ -552,7 +581,13 @@ void LDObject::getVertices(DocumentManager*, QSet<Vertex>& verts) const
 
 void LDSubfileReference::getVertices (DocumentManager* context, QSet<Vertex>& verts) const
 {
-	verts.unite(fileInfo(context)->inlineVertices());
+	LDDocument* subfile = fileInfo(context);
+
+	if (subfile)
+	{
+		for (const Vertex& vertex : subfile->inlineVertices())
+			verts.insert(vertex.transformed(transformationMatrix()));
+	}
 }
 
 QString LDObject::objectListText() const
@@ -646,4 +681,7 @@ void LDSubfileReference::serialize(Serializer& serializer)
 {
 	LDMatrixObject::serialize(serializer);
 	serializer << m_referenceName;
+
+	// Restoring may have changed the reference name.
+	m_resolvedContext = nullptr;
 }
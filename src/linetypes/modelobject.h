@@ -19,6 +19,7 @@
 #pragma once
 #include "../main.h"
 #include "../colors.h"
+#include "../edittransaction.h"
 #include "../serializer.h"
 
 class Model;
@@ -201,6 +202,11 @@ protected:
 
 private:
 	QString m_referenceName;
+
+	// The subfile that the reference name was last resolved to, and the generation of the documents at the time.
+	mutable DocumentManager* m_resolvedContext = nullptr;
+	mutable LDDocument* m_resolvedSubfile = nullptr;
+	mutable quint64 m_resolvedGeneration = 0;
 };
 
 /*
@@ -243,15 +249,26 @@ enum
 };
 
 /*
- * Changes a property in a manner that emits the appropriate signal to notify that the object changed.
+ * Changes a property in a manner that emits the appropriate signal to notify that the object changed. Within an edit
+ * transaction, the change is announced when the transaction ends.
  */
 template<typename T>
 void LDObject::changeProperty(T* property, const T& value)
 {
 	if (*property != value)
 	{
-		Serializer::Archive before = Serializer::store(this);
-		*property = value;
-		emit modified(before, Serializer::store(this));
+		EditTransaction* transaction = EditTransaction::current();
+
+		if (transaction)
+		{
+			transaction->recordObject(this);
+			*property = value;
+		}
+		else
+		{
+			Serializer::Archive before = Serializer::store(this);
+			*property = value;
+			emit modified(before, Serializer::store(this));
+		}
 	}
 }
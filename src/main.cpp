@@ -17,14 +17,17 @@
  */
 
 #include <QApplication>
+#include "batchmode.h"
 #include "crashCatcher.h"
 #include "documentmanager.h"
 #include "mainwindow.h"
 #include "generics/reverse.h"
 
-int main (int argc, char* argv[])
+/*
+ * Sets up what both the user interface and the batch mode need.
+ */
+static void initialize(QCoreApplication& app)
 {
-	QApplication app (argc, argv);
 	app.setOrganizationName (APPNAME);
 	app.setApplicationName (APPNAME);
 	qRegisterMetaType<Library>("Library");
@@ -35,6 +38,21 @@ int main (int argc, char* argv[])
 	qRegisterMetaTypeStreamOperators<Vertex>("Vertex");
 	initializeCrashHandler();
 	LDColor::initColors();
+}
+
+int main (int argc, char* argv[])
+{
+	// Batch mode needs no display, so it must not create a QApplication.
+	if (BatchMode::isRequested(argc, argv))
+	{
+		QCoreApplication app (argc, argv);
+		initialize(app);
+		BatchMode batchMode;
+		return batchMode.run(app.arguments());
+	}
+
+	QApplication app (argc, argv);
+	initialize(app);
 	MainWindow* mainWindow = new MainWindow;
 	mainWindow->show();
 
@@ -16,6 +16,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <QMdiArea>
 #include <QMdiSubWindow>
 #include <QMessageBox>
@@ -24,7 +25,6 @@
 #include <QFileDialog>
 #include <QPushButton>
 #include <QSettings>
-#include "generics/reverse.h"
 #include "main.h"
 #include "canvas.h"
 #include "mainwindow.h"
@@ -344,19 +344,29 @@ void MainWindow::updateTitle()
 //
 int MainWindow::deleteSelection()
 {
-	int count = 0;
-	QModelIndexList thingsToRemove = ui.objectList->selectionModel()->selectedIndexes();
+	QVector<int> rows;
 
-	for (QModelIndex index : reverse(thingsToRemove))
+	for (const QModelIndex& index : ui.objectList->selectionModel()->selectedIndexes())
 	{
 		if (m_currentDocument->hasIndex(index.row(), index.column()))
-		{
-			m_currentDocument->removeAt(index);
+			rows.append(index.row());
+	}
+
+	// Remove runs of consecutive rows at once, starting from the bottom so that the rows above stay put.
+	std::sort(rows.begin(), rows.end(), std::greater<int>());
+
+	for (int i = 0; i < rows.size();)
+	{
+		int count = 1;
+
+		while (i + count < rows.size() and rows[i + count] == rows[i] - count)
 			count += 1;
-		}
+
+		m_currentDocument->removeRows(rows[i + count - 1], count);
+		i += count;
 	}
 
-	return count;
+	return rows.size();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -692,6 +702,16 @@ void MainWindow::updateDocumentListItem (LDDocument* doc)
 	// If the document.has unsaved changes, draw a little icon next to it to mark that.
 	m_tabs->setTabIcon (doc->tabIndex(), doc->hasUnsavedChanges() ? getIcon ("file-save") : QIcon());
 	m_tabs->setTabData (doc->tabIndex(), doc->name());
+
+	// Show how much the undo history of the document takes.
+	m_tabs->setTabToolTip(
+		doc->tabIndex(),
+		format(
+			tr("Undo history: %1 KiB in memory, %2 KiB spilled to disk"),
+			int(doc->history()->memoryUsage() / 1024),
+			int(doc->history()->spilledSize() / 1024)
+		)
+	);
 	m_updatingTabs = oldUpdatingTabs;
 }
 
@@ -862,11 +882,18 @@ void MainWindow::newDocument(LDDocument* document, bool cache)
 
 void MainWindow::settingsChanged()
 {
+	m_documents->refreshLibraries();
 	m_documents->loadLogoedStuds();
 	updateColorToolbar();
 	renderer()->setBackground();
-	doFullRefresh();
 	updateDocumentList();
+
+	// The colors of the compiled objects depend on the settings.
+	for (const QStack<Canvas*>& canvases : m_renderers)
+	{
+		for (Canvas* canvas : canvases)
+			canvas->fullUpdate();
+	}
 }
 
 /*
@@ -931,8 +958,9 @@ void MainWindow::changeDocument(LDDocument* document)
 		ui.objectList->setModel(document);
 		ui.header->setDocument(document);
 
+		// The renderers of the document have been kept up to date, changes of its subfiles included.
 		for (Canvas* canvas : m_renderers[document])
-			canvas->fullUpdate();
+			canvas->update();
 
 		QItemSelectionModel* selection = m_selectionModels.value(document);
 		ui.objectList->setSelectionModel(selection);
@@ -1048,6 +1076,18 @@ void MainWindow::select(const QModelIndex &objectIndex)
 		m_selectionModels[m_currentDocument]->select(objectIndex, QItemSelectionModel::Select);
 }
 
+/*
+ * Selects a range of rows of the current document at once.
+ */
+void MainWindow::selectRows(int first, int last)
+{
+	if (m_currentDocument and first <= last)
+	{
+		QItemSelection selection {m_currentDocument->index(first), m_currentDocument->index(last)};
+		m_selectionModels[m_currentDocument]->select(selection, QItemSelectionModel::Select);
+	}
+}
+
 /*
  * Selects a camera of the specified type for the specified document.
  * If the camera does not exist, it will be created.
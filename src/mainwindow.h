@@ -22,6 +22,7 @@
 #include <QAction>
 #include <QListWidget>
 #include <QRadioButton>
+#include <QStack>
 #include <QTreeWidget>
 #include <QMetaMethod>
 #include "linetypes/modelobject.h"
@@ -73,6 +74,7 @@ public:
 	CircularSection circleToolSection() const;
 	bool save (LDDocument* doc, bool saveAs);
 	void select(const QModelIndex& objectIndex);
+	void selectRows(int first, int last);
 	Canvas* selectCameraForDocument(LDDocument* document, gl::CameraType cameraType);
 	QModelIndexList selectedIndexes() const;
 	QSet<LDObject*> selectedObjects() const;
@@ -16,6 +16,8 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cmath>
+#include <QThread>
 #include "model.h"
 #include "linetypes/modelobject.h"
 #include "documentmanager.h"
@@ -24,7 +26,8 @@
 #include "lddocument.h"
 
 Model::Model(DocumentManager* manager) :
-	QAbstractListModel {manager},
+	// Models built by worker threads cannot be children of the manager; they are reparented when adopted.
+	QAbstractListModel {(manager and manager->thread() == QThread::currentThread()) ? manager : nullptr},
     _manager {manager} {}
 
 Model::~Model()
@@ -34,31 +37,36 @@ Model::~Model()
 }
 
 void Model::installObject(int row, LDObject* object)
+{
+	insertObjects(row, {object});
+}
+
+/*
+ * Connects a newly inserted object to this model and accounts for it.
+ */
+void Model::adoptObject(LDObject* object)
 {
 	connect(
 		object,
 		&LDObject::modified,
-		[&]()
+		this,
+		[this, object]()
 		{
+			this->markAdjacencyStale(object);
 			this->recountTriangles();
-			emit objectModified(static_cast<LDObject*>(sender()));
+			emit objectModified(object);
 			emit modelChanged();
 		}
 	);
 
-	beginInsertRows({}, row, row);
-	_objects.insert(row, object);
+	markAdjacencyStale(object);
 
-	if (this->pickingColorCursor <= 0xffffff)
-	{
-		this->pickingColors[object] = this->pickingColorCursor;
-		this->pickingColorCursor += 1;
-	}
-
-	_triangleCount += object->triangleCount(documentManager());
-	emit objectAdded(index(row));
-	emit modelChanged();
-	endInsertRows();
+	// Counting the triangles of a subfile reference would have to load the subfile right now. Defer it until the
+	// count is actually asked for, so that subfiles can be loaded all at once after the model has been parsed.
+	if (object->type() == LDObjectType::SubfileReference)
+		_needsTriangleRecount = true;
+	else
+		_triangleCount += object->triangleCount(documentManager());
 }
 
 /*
@@ -93,6 +101,79 @@ void Model::insertFromArchive(int row, Serializer::Archive& archive)
 		installObject(row, object);
 }
 
+/*
+ * Restores the given objects and inserts them into the model as a single block of rows, starting at the specified
+ * position.
+ */
+void Model::insertFromArchives(int row, QVector<Serializer::Archive>& archives)
+{
+	QVector<LDObject*> objects;
+	objects.reserve(archives.size());
+
+	for (Serializer::Archive& archive : archives)
+	{
+		LDObject* object = Serializer::restore(archive);
+
+		if (object)
+			objects.append(object);
+	}
+
+	insertObjects(row, objects);
+}
+
+/*
+ * Inserts the given objects into the model at the specified position, taking ownership of them. The objects are
+ * inserted as a single block of rows. They must belong to the thread of this model.
+ */
+void Model::insertObjects(int row, const QVector<LDObject*>& objects)
+{
+	if (not objects.isEmpty())
+	{
+		beginInsertRows({}, row, row + objects.size() - 1);
+		recordRowShift(row, objects.size());
+		_objects.insert(row, objects.size(), nullptr);
+
+		for (int i = 0; i < objects.size(); i += 1)
+		{
+			_objects[row + i] = objects[i];
+			_rows[objects[i]] = {row + i, _rowShifts.size()};
+			adoptObject(objects[i]);
+		}
+
+		endInsertRows();
+		emit modelChanged();
+	}
+}
+
+/*
+ * Removes all objects from the model without deleting them, and hands them over to the caller.
+ */
+QVector<LDObject*> Model::takeObjects()
+{
+	QVector<LDObject*> objects;
+
+	if (not _objects.isEmpty())
+	{
+		beginRemoveRows({}, 0, size() - 1);
+
+		for (LDObject* object : _objects)
+			disconnect(object, nullptr, this, nullptr);
+
+		_adjacency.clear();
+		_staleAdjacency.clear();
+
+		objects.swap(_objects);
+		_rows.clear();
+		_rowShifts.clear();
+		_triangleCount = 0;
+		_needsTriangleRecount = false;
+		endRemoveRows();
+		emit modelChanged();
+	}
+
+	return objects;
+}
+
 bool Model::moveRows(
 	const QModelIndex&,
 	int sourceRow,
@@ -107,6 +188,13 @@ bool Model::moveRows(
 	) {
 		beginMoveRows({}, sourceRow, sourceRowLast, {}, destinationRow);
 		migrate(_objects, sourceRow, sourceRowLast, destinationRow);
+
+		// Only the rows between the source and the destination are affected.
+		if (destinationRow < sourceRow)
+			renumberRows(destinationRow, sourceRowLast);
+		else
+			renumberRows(sourceRow, destinationRow - 1);
+
 		endMoveRows();
 		return true;
 	}
@@ -125,12 +213,12 @@ bool Model::setObjectAt(int row, Serializer::Archive& archive)
 
 	if (object and row >= 0 and row < countof(_objects))
 	{
-		removeAt(row);
-		insertCopy(row, object);
+		replaceRows(row, 1, {object});
 		return true;
 	}
 	else
 	{
+		delete object;
 		return false;
 	}
 }
@@ -151,10 +239,10 @@ LDObject* Model::getObject(int position) const
  */
 void Model::remove(LDObject* object)
 {
-	int position = indexOf(object).row();
+	QModelIndex index = indexOf(object);
 
-	if (_objects[position] == object)
-		removeAt(position);
+	if (index.isValid())
+		removeAt(index.row());
 }
 
 /*
@@ -162,14 +250,7 @@ void Model::remove(LDObject* object)
  */
 void Model::removeAt(int position)
 {
-	beginRemoveRows({}, position, position);
-	LDObject* object = _objects[position];
-	emit aboutToRemoveObject(this->index(position));
-	_objects.removeAt(position);
-	_needsTriangleRecount = true;
-	endRemoveRows();
-	emit modelChanged();
-	delete object;
+	removeRows(position, 1);
 }
 
 void Model::removeAt(const QModelIndex& index)
@@ -178,20 +259,72 @@ void Model::removeAt(const QModelIndex& index)
 }
 
 /*
- * Replaces the given object with the contents of a model.
+ * Removes and deletes the given amount of objects starting at the given row, as a single block of rows.
  */
-void Model::replace(LDObject* object, Model& model)
+bool Model::removeRows(int row, int count, const QModelIndex& parent)
 {
-	QModelIndex index = this->indexOf(object);
+	if (not parent.isValid() and row >= 0 and count > 0 and count <= size() - row)
+	{
+		beginRemoveRows({}, row, row + count - 1);
+		QVector<LDObject*> removedObjects = _objects.mid(row, count);
+		recordRowShift(row + count, -count);
+		_objects.remove(row, count);
 
-	if (index.isValid())
+		for (LDObject* object : removedObjects)
+		{
+			_rows.remove(object);
+			_adjacency.remove(object);
+			_staleAdjacency.remove(object);
+		}
+
+		_needsTriangleRecount = true;
+		endRemoveRows();
+		emit modelChanged();
+		qDeleteAll(removedObjects);
+		return true;
+	}
+	else
 	{
-		removeAt(index.row());
-		int position = index.row();
+		return false;
+	}
+}
+
+/*
+ * Announces the changes of an edit transaction, ordered by row, as a whole.
+ */
+void Model::commitChanges(const QVector<EditTransaction::Change>& changes)
+{
+	recountTriangles();
 
-		for (signed int i = 0; i < countof(model); i += 1)
-			insertCopy(position + i, model.objects()[i]);
+	for (const EditTransaction::Change& change : changes)
+	{
+		markAdjacencyStale(change.object);
+		emit objectModified(change.object);
 	}
+
+	emit modelChanged();
+}
+
+/*
+ * Replaces the given amount of objects starting at the given row with the given objects. The old objects are removed
+ * and the new ones inserted as one block of rows each.
+ */
+void Model::replaceRows(int row, int count, const QVector<LDObject*>& objects)
+{
+	removeRows(row, count);
+	insertObjects(row, objects);
+}
+
+/*
+ * Replaces the given object with the contents of a model. Like with merge, the objects are moved over and the model
+ * is emptied in the process.
+ */
+void Model::replace(LDObject* object, Model& model)
+{
+	QModelIndex index = this->indexOf(object);
+
+	if (index.isValid())
+		replaceRows(index.row(), 1, model.takeObjects());
 }
 
 /*
@@ -221,24 +354,15 @@ int Model::triangleCount() const
 }
 
 /*
- * Merges the given model into this model, starting at the given position. The other model is emptied in the process.
+ * Merges the given model into this model, starting at the given position. The objects are moved over as they are, so
+ * the other model is emptied in the process. Both models must belong to the same thread.
  */
 void Model::merge(Model& other, int position)
 {
 	if (position < 0)
 		position = countof(_objects);
 
-	// Copy the vector of objects to copy, so that we don't change the vector while iterating over it.
-	QVector<LDObject*> objectsCopy = other._objects;
-
-	// Inform the contents of their new owner
-	for (LDObject* object : objectsCopy)
-	{
-		insertCopy(position, object);
-		position += 1;
-	}
-
-	other.clear();
+	insertObjects(position, other.takeObjects());
 }
 
 /*
@@ -262,8 +386,7 @@ QVector<LDObject*>::iterator Model::end()
  */
 void Model::clear()
 {
-	for (int i = _objects.size() - 1; i >= 0; i -= 1)
-		removeAt(i);
+	removeRows(0, size());
 
 	_triangleCount = 0;
 	_needsTriangleRecount = false;
@@ -282,15 +405,55 @@ bool Model::isEmpty() const
  */
 QModelIndex Model::indexOf(LDObject* object) const
 {
-	for (int i = 0; i < this->size(); ++i)
+	// Applying the recorded shifts gets slower as they pile up, so once there are more than max(16, √n), renumber all
+	// rows instead. Each edit thus costs O(√n) amortized, counting both the shifts and the renumbering.
+	if (_rowShifts.size() > qMax(16, int(std::sqrt(size()))))
 	{
-		if (this->getObject(i) == object)
-			return index(i);
+		_rowShifts.clear();
+		renumberRows(0, size() - 1);
+	}
+
+	auto iterator = _rows.find(object);
+
+	if (iterator != _rows.end())
+	{
+		RowEntry& entry = *iterator;
+
+		for (int i = entry.shiftCount; i < _rowShifts.size(); i += 1)
+		{
+			if (entry.row >= _rowShifts[i].firstRow)
+				entry.row += _rowShifts[i].delta;
+		}
+
+		entry.shiftCount = _rowShifts.size();
+
+		if (entry.row >= 0 and entry.row < size() and _objects[entry.row] == object)
+			return index(entry.row);
 	}
 
 	return {};
 }
 
+/*
+ * Records that the rows from the given row onwards are about to move by the given amount. Call this before
+ * changing the vector of objects.
+ */
+void Model::recordRowShift(int firstRow, int delta)
+{
+	// Nothing moves when objects are added to or removed from the end.
+	if (firstRow < size())
+		_rowShifts.append({firstRow, delta});
+}
+
+/*
+ * Stores the current rows of the objects in the given range of rows.
+ */
+void Model::renumberRows(int first, int last) const
+{
+	for (int row = first; row <= last; row += 1)
+		_rows[_objects[row]] = {row, _rowShifts.size()};
+}
+
 /*
  * Returns the model's associated document manager. This pointer is used to resolve subfile references.
  */
@@ -394,26 +557,6 @@ QVariant Model::data(const QModelIndex& index, int role) const
 	}
 }
 
-/*
-bool Model::removeRows(int row, int count, const QModelIndex& parent)
-{
-	if (row >= 0 and row < size() and count <= size() - row)
-	{
-		beginRemoveRows(parent, row, row + count - 1);
-
-		for (signed int i = row + count - 1; i >= row; i -= 1)
-			this->removeAt(i);
-
-		endRemoveRows();
-		return true;
-	}
-	else
-	{
-		return false;
-	}
-}
-*/
-
 /*
  * Looks up an object by the given index.
  */
@@ -425,27 +568,31 @@ LDObject* Model::lookup(const QModelIndex &index) const
 		return nullptr;
 }
 
-QColor Model::pickingColorForObject(const QModelIndex& objectIndex) const
-{
-	return QColor::fromRgba(this->pickingColors.value(this->lookup(objectIndex)) | 0xff000000);
-}
-
-QModelIndex Model::objectByPickingColor(const QColor& color) const
+/*
+ * Returns the graph of the edges that the objects of this model share. The first call builds the graph, after which it
+ * is kept up to date as objects come, go and change.
+ */
+const AdjacencyGraph& Model::adjacency() const
 {
-	if (color != qRgb(0, 0, 0))
+	if (not _isAdjacencyTracked)
 	{
-		for (int row = 0; row < this->size(); row += 1)
-		{
-			if (this->pickingColorForObject(this->index(row)) == color)
-				return this->index(row);
-		}
+		_isAdjacencyTracked = true;
 
-		return {};
-	}
-	else
-	{
-		return {};
+		for (LDObject* object : _objects)
+			_staleAdjacency.insert(object);
 	}
+
+	for (LDObject* object : _staleAdjacency)
+		_adjacency.insert(object);
+
+	_staleAdjacency.clear();
+	return _adjacency;
+}
+
+void Model::markAdjacencyStale(LDObject* object)
+{
+	if (_isAdjacencyTracked)
+		_staleAdjacency.insert(object);
 }
 
 Winding Model::winding() const
@@ -19,6 +19,7 @@
 #pragma once
 #include <QAbstractListModel>
 #include "main.h"
+#include "adjacencygraph.h"
 #include "serializer.h"
 #include "linetypes/modelobject.h"
 
@@ -82,8 +83,11 @@ public:
 	Model(const Model& other) = delete;
 	~Model();
 
+	const AdjacencyGraph& adjacency() const;
 	void insertCopy(int position, LDObject* object);
 	void insertFromArchive(int row, Serializer::Archive& archive);
+	void insertFromArchives(int row, QVector<Serializer::Archive>& archives);
+	void insertObjects(int row, const QVector<LDObject*>& objects);
 	bool setObjectAt(int idx, Serializer::Archive& archive);
 	template<typename T, typename... Args> T* emplace(Args&& ...args);
 	template<typename T, typename... Args> T* emplaceAt(int position, Args&& ...args);
@@ -91,8 +95,10 @@ public:
 	void removeAt(const QModelIndex& index);
 	void remove(LDObject* object);
 	void replace(LDObject *object, Model& model);
+	void replaceRows(int row, int count, const QVector<LDObject*>& objects);
 	void clear();
 	void merge(Model& other, int position = -1);
+	QVector<LDObject*> takeObjects();
 	int size() const;
 	const QVector<LDObject*>& objects() const;
 	LDObject* getObject(int position) const;
@@ -105,8 +111,6 @@ public:
 	class DocumentManager* documentManager() const;
 	IndexGenerator indices() const;
 	LDObject* lookup(const QModelIndex& index) const;
-	QColor pickingColorForObject(const QModelIndex& objectIndex) const;
-	QModelIndex objectByPickingColor(const QColor& color) const;
 	Winding winding() const;
 	void setWinding(Winding winding);
 
@@ -118,12 +122,12 @@ public:
 		int destinationChild
 	) override;
 
+	bool removeRows(int row, int count, const QModelIndex& parent = {}) override;
+	virtual void commitChanges(const QVector<EditTransaction::Change>& changes);
 	int rowCount(const QModelIndex& parent) const override;
 	QVariant data(const QModelIndex& index, int role) const override;
 
 signals:
-	void objectAdded(const QModelIndex& object);
-	void aboutToRemoveObject(const QModelIndex& index);
 	void objectModified(LDObject* object);
 	void windingChanged(Winding newWinding);
 	void modelChanged();
@@ -132,15 +136,48 @@ protected:
 	template<typename T, typename... Args> T* constructObject(Args&& ...args);
 
 	QVector<LDObject*> _objects;
-	QMap<LDObject*, QRgb> pickingColors;
-	QRgb pickingColorCursor = 0x000001;
 	class DocumentManager* _manager;
 	mutable int _triangleCount = 0;
-	mutable bool _needsTriangleRecount;
+	mutable bool _needsTriangleRecount = false;
 	Winding _winding = NoWinding;
 
 private:
+	/*
+	 * The row of an object, as of when the given amount of row shifts had been recorded.
+	 */
+	struct RowEntry
+	{
+		int row;
+		int shiftCount;
+	};
+
+	/*
+	 * Rows from the given row onwards have moved by the given amount.
+	 */
+	struct RowShift
+	{
+		int firstRow;
+		int delta;
+	};
+
+	void adoptObject(LDObject* object);
 	void installObject(int row, LDObject* object);
+	void markAdjacencyStale(LDObject* object);
+	void recordRowShift(int firstRow, int delta);
+	void renumberRows(int first, int last) const;
+
+	// Rows of the objects, for finding them quickly. Instead of renumbering the following rows whenever objects are
+	// inserted or removed, the shifts are recorded and applied to the rows when they are looked up. A lookup applies
+	// at most max(16, √n) shifts before all n rows are renumbered, so a burst of k edits with lookups in between
+	// costs O(k·√n) rather than O(k·n). Lookups with no edits in between cost O(1).
+	mutable QHash<LDObject*, RowEntry> _rows;
+	mutable QVector<RowShift> _rowShifts;
+
+	// The graph is only kept up to date once it has been asked for. Objects that have been added or changed since are
+	// put into it the next time it is asked for.
+	mutable AdjacencyGraph _adjacency;
+	mutable QSet<LDObject*> _staleAdjacency;
+	mutable bool _isAdjacencyTracked = false;
 };
 
 int countof(Model& model);
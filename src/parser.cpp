@@ -16,7 +16,10 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
 #include "parser.h"
+#include "parsertokens.h"
 #include "lddocument.h"
 #include "linetypes/comment.h"
 #include "linetypes/conditionaledge.h"
@@ -117,7 +120,8 @@ Parser::HeaderParseResult Parser::parseHeaderLine(
 	}
 	else if (line.startsWith("0 !HISTORY "))
 	{
-		static const QRegExp historyRegexp {
+		// Not static: QRegExp keeps its match state internally, and headers may be parsed by several threads at once.
+		QRegExp historyRegexp {
 			R"(0 !HISTORY\s+(\d{4}-\d{2}-\d{2})\s+)"
 			R"((\{[^}]+|\[[^]]+)[\]}]\s+(.+))"
 		};
@@ -237,105 +241,115 @@ LDHeader Parser::parseHeader(Winding& winding)
 	return header;
 }
 
-/*
- * Parses the model body into the given model.
- */
-void Parser::parseBody(Model& model)
-{
-	bool invertNext = false;
-
-	while (not this->device.atEnd())
-		this->bag.append(this->readLine());
-
-	for (const QString& line : this->bag)
-	{
-		if (line == "0 BFC INVERTNEXT" or line == "0 BFC CERTIFY INVERTNEXT")
-		{
-			invertNext = true;
-			continue;
-		}
-
-		LDObject* object = parseFromString(model, model.size(), line);
-
-		/*
-		// Check for parse errors and warn about them
-		if (obj->type() == LDObjectType::Error)
-		{
-			emit parseErrorMessage(format(
-				tr("Couldn't parse line #%1: %2"),
-				progress() + 1, static_cast<LDError*> (obj)->reason()));
-			++m_warningCount;
-		}
-		*/
-
-		if (invertNext and object->isRasterizable())
-			object->setInverted(true);
-
-		invertNext = false;
-	}
-}
-
 // =============================================================================
 //
-static void CheckTokenCount (const QStringList& tokens, int num)
+static void CheckTokenCount (const LineTokens& tokens, int num)
 {
-	if (countof(tokens) != num)
-		throw QString (format ("Bad amount of tokens, expected %1, got %2", num, countof(tokens)));
+	if (tokens.count() != num)
+		throw QString (format ("Bad amount of tokens, expected %1, got %2", num, tokens.count()));
 }
 
 // =============================================================================
 //
-static void CheckTokenNumbers (const QStringList& tokens, int min, int max)
+// Note that the check finishes at the first token that is found to be a number.
+//
+static void CheckTokenNumbers (const LineTokens& tokens, int min, int max)
 {
 	bool ok;
-	QRegExp scientificRegex ("\\-?[0-9]+\\.[0-9]+e\\-[0-9]+");
 
 	for (int i = min; i <= max; ++i)
 	{
 		// Check for floating point
-		tokens[i].toDouble (&ok);
+		parseDouble (tokens[i], &ok);
 		if (ok)
 			return;
 
 		// Check hex
 		if (tokens[i].startsWith ("0x"))
 		{
-			tokens[i].mid (2).toInt (&ok, 16);
+			parseInteger ({tokens[i].begin + 2, tokens[i].end}, 16, &ok);
 
 			if (ok)
 				return;
 		}
 
 		// Check scientific notation, e.g. 7.99361e-15
-		if (scientificRegex.exactMatch (tokens[i]))
+		QRegExp scientificRegex ("\\-?[0-9]+\\.[0-9]+e\\-[0-9]+");
+		QString token = tokens[i].toString();
+
+		if (scientificRegex.exactMatch (token))
 			return;
 
 		throw QString (format ("Token #%1 was `%2`, expected a number (matched length: %3)",
-			(i + 1), tokens[i], scientificRegex.matchedLength()));
+			(i + 1), token, scientificRegex.matchedLength()));
 	}
 }
 
-static Vertex parseVertex(QStringList& tokens, const int n)
+static Vertex parseVertex(const LineTokens& tokens, const int n)
 {
-	return {tokens[n].toDouble(), tokens[n + 1].toDouble(), tokens[n + 2].toDouble()};
+	return {parseDouble(tokens[n]), parseDouble(tokens[n + 1]), parseDouble(tokens[n + 2])};
 }
 
+static const char* skipDigits(const char* cursor, const char* end)
+{
+	while (cursor != end and isAsciiDigit(*cursor))
+		cursor += 1;
+
+	return cursor;
+}
+
+struct CircularPrimitiveName
+{
+	ByteView resolution;
+	ByteView numerator;
+	ByteView denominator;
+	ByteView stem;
+};
+
 /*
- * Parses the given model body line and inserts the result into the given model.
- * The resulting object is also returned.
- *
- * If an error happens, an error object is created. Result is guaranteed to be a valid pointer.
- *
- * TODO: rewrite this using regular expressions
+ * Matches a reference name against the file names of circular primitives, e.g. 48\1-4cyli.dat.
+ * This is equivalent to matching the regular expression
+ *     (?:(\d+)\\)?(\d+)-(\d+)(cyli|edge|disc|ndis|cylc|cylo|chrd)\.dat
  */
-LDObject* Parser::parseFromString(Model& model, int position, QString line)
+static bool matchCircularPrimitiveName(const ByteView& name, CircularPrimitiveName& result)
 {
-	if (position == EndOfModel)
-		position = model.size();
+	const char* cursor = name.begin;
+	const char* digitsEnd = skipDigits(cursor, name.end);
+	result.resolution = {cursor, cursor};
 
+	if (digitsEnd != cursor and digitsEnd != name.end and *digitsEnd == '\\')
+	{
+		result.resolution = {cursor, digitsEnd};
+		cursor = digitsEnd + 1;
+		digitsEnd = skipDigits(cursor, name.end);
+	}
+
+	if (digitsEnd == cursor or digitsEnd == name.end or *digitsEnd != '-')
+		return false;
+
+	result.numerator = {cursor, digitsEnd};
+	cursor = digitsEnd + 1;
+	digitsEnd = skipDigits(cursor, name.end);
+
+	if (digitsEnd == cursor or name.end - digitsEnd != 8)
+		return false;
+
+	result.denominator = {cursor, digitsEnd};
+	result.stem = {digitsEnd, digitsEnd + 4};
+	return isOneOf(result.stem, "cyli", "edge", "disc", "ndis", "cylc", "cylo", "chrd")
+		and ByteView {digitsEnd + 4, name.end} == ".dat";
+}
+
+/*
+ * Parses a single line, given as UTF-8 bytes, and inserts the result into the given model.
+ * The line is tokenized in place, so apart from the object itself, only the strings that end
+ * up being stored in the object are allocated.
+ */
+static LDObject* parseLine(Model& model, int position, const ByteView& line)
+{
 	try
 	{
-		QStringList tokens = line.split(" ", QString::SkipEmptyParts);
+		LineTokens tokens {line};
 
 		if (tokens.isEmpty())
 		{
@@ -343,19 +357,23 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 			return model.emplaceAt<LDEmpty>(position);
 		}
 
-		if (countof(tokens[0]) != 1 or not tokens[0][0].isDigit())
+		if (tokens[0].size() != 1 or not isAsciiDigit(*tokens[0].begin))
 			throw QString ("Illogical line code");
 
-		int num = tokens[0][0].digitValue();
+		int num = *tokens[0].begin - '0';
 
 		switch (num)
 		{
 			case 0:
 			{
 				// Comment
-				QString commentText = line.mid(line.indexOf("0") + 2);
+				const char* lineCode = std::find(line.begin, line.end, '0');
+				QString commentText;
 
-				if (countof(tokens) > 2 and tokens[1] == "!LDFORGE")
+				if (line.end - lineCode > 2)
+					commentText = ByteView {lineCode + 2, line.end}.toString();
+
+				if (tokens.count() > 2 and tokens[1] == "!LDFORGE")
 				{
 					// Handle LDForge-specific types, they're embedded into comments too
 					if (tokens[2] == "BEZIER_CURVE")
@@ -363,7 +381,7 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 						CheckTokenCount (tokens, 16);
 						CheckTokenNumbers (tokens, 3, 15);
 						LDBezierCurve* obj = model.emplaceAt<LDBezierCurve>(position);
-						obj->setColor(LDColor {tokens[3].toInt(nullptr, 0)});
+						obj->setColor(LDColor {parseInteger(tokens[3], 0)});
 
 						for (int i = 0; i < 4; ++i)
 							obj->setVertex (i, parseVertex (tokens, 4 + (i * 3)));
@@ -385,27 +403,24 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 				Vertex displacement = parseVertex (tokens, 2);  // 2 - 4
 				QMatrix4x4 matrix;
 				matrix.translate(displacement.toVector());
-				QString referenceName = tokens[14];
 
 				for (int i = 0; i < 9; ++i)
-					matrix(i / 3, i % 3) = tokens[i + 5].toDouble(); // 5 - 13
+					matrix(i / 3, i % 3) = parseDouble(tokens[i + 5]); // 5 - 13
 
 				matrix.optimize();
-				static const QRegExp circularPrimitiveRegexp {
-					R"((?:(\d+)\\)?(\d+)-(\d+)(cyli|edge|disc|ndis|cylc|cylo|chrd)\.dat)"
-				};
+				CircularPrimitiveName circularPrimitiveName;
 				LDObject* obj;
 
-				if (circularPrimitiveRegexp.exactMatch(referenceName))
+				if (matchCircularPrimitiveName(tokens[14], circularPrimitiveName))
 				{
 					int resolution = MediumResolution;
 
-					if (not circularPrimitiveRegexp.capturedTexts()[1].isEmpty())
-						resolution = circularPrimitiveRegexp.capturedTexts()[1].toInt();
+					if (circularPrimitiveName.resolution.size() > 0)
+						resolution = parseInteger(circularPrimitiveName.resolution, 10);
 
-					int numerator = circularPrimitiveRegexp.capturedTexts()[2].toInt();
-					int denominator = circularPrimitiveRegexp.capturedTexts()[3].toInt();
-					QString stem = circularPrimitiveRegexp.capturedTexts()[4];
+					int numerator = parseInteger(circularPrimitiveName.numerator, 10);
+					int denominator = parseInteger(circularPrimitiveName.denominator, 10);
+					const ByteView& stem = circularPrimitiveName.stem;
 					int segments = (numerator * resolution) / denominator;
 					PrimitiveModel::Type type = PrimitiveModel::Cylinder;
 
@@ -432,10 +447,10 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 				}
 				else
 				{
-					obj = model.emplaceAt<LDSubfileReference>(position, referenceName, matrix);
+					obj = model.emplaceAt<LDSubfileReference>(position, tokens[14].toString(), matrix);
 				}
 
-				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+				obj->setColor(LDColor {parseInteger(tokens[1], 0)});
 				return obj;
 			}
 
@@ -446,7 +461,7 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 
 				// Line
 				LDEdgeLine* obj = model.emplaceAt<LDEdgeLine>(position);
-				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+				obj->setColor(LDColor {parseInteger(tokens[1], 0)});
 
 				for (int i = 0; i < 2; ++i)
 					obj->setVertex (i, parseVertex (tokens, 2 + (i * 3)));   // 2 - 7
@@ -461,7 +476,7 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 
 				// Triangle
 				LDTriangle* obj = model.emplaceAt<LDTriangle>(position);
-				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+				obj->setColor(LDColor {parseInteger(tokens[1], 0)});
 
 				for (int i = 0; i < 3; ++i)
 					obj->setVertex (i, parseVertex (tokens, 2 + (i * 3)));   // 2 - 10
@@ -483,7 +498,7 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 				else
 					obj = model.emplaceAt<LDConditionalEdge>(position);
 
-				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+				obj->setColor(LDColor {parseInteger(tokens[1], 0)});
 
 				for (int i = 0; i < 4; ++i)
 					obj->setVertex (i, parseVertex (tokens, 2 + (i * 3)));   // 2 - 13
@@ -498,6 +513,106 @@ LDObject* Parser::parseFromString(Model& model, int position, QString line)
 	catch (QString& errorMessage)
 	{
 		// Strange line we couldn't parse
-		return model.emplaceAt<LDError>(position, line, errorMessage);
+		return model.emplaceAt<LDError>(position, line.toString(), errorMessage);
 	}
 }
+
+/*
+ * Parses the model body into the given model.
+ *
+ * The body is read from the device in one go and parsed straight from its bytes. Lines that consist
+ * of ASCII only, which is nearly all of them, are trimmed and tokenized in place. Other lines are
+ * trimmed through QString so that they are treated exactly like before.
+ */
+void Parser::parseBody(Model& model)
+{
+	parseBody(model, 0, {});
+}
+
+/*
+ * Parses the body like above, but passes the model to the callback after every batch of lines and once more at the
+ * end, so that the objects can be moved elsewhere while the rest of the body is still being parsed.
+ */
+void Parser::parseBody(Model& model, int batchSize, const BatchCallback& callback)
+{
+	bool invertNext = false;
+	int lineCount = 0;
+
+	auto parseBodyLine = [&](const ByteView& line)
+	{
+		if (line == "0 BFC INVERTNEXT" or line == "0 BFC CERTIFY INVERTNEXT")
+		{
+			invertNext = true;
+			return;
+		}
+
+		LDObject* object = parseLine(model, model.size(), line);
+
+		if (invertNext and object->isRasterizable())
+			object->setInverted(true);
+
+		invertNext = false;
+	};
+
+	// Lines that were set aside while parsing the header come first.
+	for (const QString& line : this->bag)
+	{
+		QByteArray bytes = line.toUtf8();
+		parseBodyLine({bytes.constData(), bytes.constData() + bytes.size()});
+	}
+
+	const QByteArray contents = this->device.readAll();
+	const char* cursor = contents.constData();
+	const char* const end = cursor + contents.size();
+
+	while (cursor != end)
+	{
+		if (callback and lineCount > 0 and lineCount % batchSize == 0)
+		{
+			qreal progress = qreal(cursor - contents.constData()) / contents.size();
+
+			if (not callback(model, progress))
+				return;
+		}
+
+		lineCount += 1;
+		const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+		ByteView line = {cursor, (lineEnd != nullptr) ? lineEnd : end};
+		cursor = (lineEnd != nullptr) ? lineEnd + 1 : end;
+		bool isAscii = std::all_of(line.begin, line.end, [](char c) { return (c & 0x80) == 0; });
+
+		if (isAscii)
+		{
+			while (line.begin != line.end and isAsciiSpace(*line.begin))
+				line.begin += 1;
+
+			while (line.end != line.begin and isAsciiSpace(line.end[-1]))
+				line.end -= 1;
+
+			parseBodyLine(line);
+		}
+		else
+		{
+			QByteArray trimmed = line.toString().trimmed().toUtf8();
+			parseBodyLine({trimmed.constData(), trimmed.constData() + trimmed.size()});
+		}
+	}
+
+	if (callback)
+		callback(model, 1.0);
+}
+
+/*
+ * Parses the given model body line and inserts the result into the given model.
+ * The resulting object is also returned.
+ *
+ * If an error happens, an error object is created. Result is guaranteed to be a valid pointer.
+ */
+LDObject* Parser::parseFromString(Model& model, int position, QString line)
+{
+	if (position == EndOfModel)
+		position = model.size();
+
+	QByteArray bytes = line.toUtf8();
+	return parseLine(model, position, {bytes.constData(), bytes.constData() + bytes.size()});
+}
@@ -17,6 +17,7 @@
  */
 
 #pragma once
+#include <functional>
 #include "main.h"
 #include "lddocument.h"
 
@@ -30,10 +31,15 @@ class Parser : public QObject
 public:
 	enum { EndOfModel = -1 };
 
+	// Receives the objects parsed so far and the fraction of the input that has been read. Returning false stops the
+	// parsing.
+	using BatchCallback = std::function<bool(Model& model, qreal progress)>;
+
 	Parser(QIODevice& device, QObject* parent = nullptr);
 
 	LDHeader parseHeader(Winding& winding);
 	void parseBody(Model& model);
+	void parseBody(Model& model, int batchSize, const BatchCallback& callback);
 
 	static LDObject* parseFromString(Model& model, int position, QString line);
 
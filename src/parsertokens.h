@@ -0,0 +1,224 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#include <cstring>
+#include <QString>
+
+/*
+ * A non-owning view into a range of bytes, used to tokenize lines without copying them.
+ */
+struct ByteView
+{
+	const char* begin;
+	const char* end;
+
+	int size() const
+	{
+		return static_cast<int>(end - begin);
+	}
+
+	bool startsWith(const char* prefix) const
+	{
+		int length = static_cast<int>(strlen(prefix));
+		return size() >= length and memcmp(begin, prefix, length) == 0;
+	}
+
+	QString toString() const
+	{
+		return QString::fromUtf8(begin, size());
+	}
+
+	bool operator==(const char* string) const
+	{
+		return size() == static_cast<int>(strlen(string)) and startsWith(string);
+	}
+
+	bool operator!=(const char* string) const
+	{
+		return not (*this == string);
+	}
+};
+
+/*
+ * Splits a line into tokens separated by spaces, skipping empty tokens. No line type needs more than
+ * a handful of tokens, so only the first ones are stored, but all of them are counted.
+ */
+class LineTokens
+{
+public:
+	enum { Capacity = 16 };
+
+	LineTokens(const ByteView& line)
+	{
+		const char* cursor = line.begin;
+
+		while (cursor != line.end)
+		{
+			if (*cursor == ' ')
+			{
+				cursor += 1;
+				continue;
+			}
+
+			const char* tokenEnd = cursor;
+
+			while (tokenEnd != line.end and *tokenEnd != ' ')
+				tokenEnd += 1;
+
+			if (m_count < Capacity)
+				m_tokens[m_count] = {cursor, tokenEnd};
+
+			m_count += 1;
+			cursor = tokenEnd;
+		}
+	}
+
+	int count() const
+	{
+		return m_count;
+	}
+
+	bool isEmpty() const
+	{
+		return m_count == 0;
+	}
+
+	const ByteView& operator[](int index) const
+	{
+		return m_tokens[index];
+	}
+
+private:
+	ByteView m_tokens[Capacity];
+	int m_count = 0;
+};
+
+inline bool isAsciiDigit(char character)
+{
+	return character >= '0' and character <= '9';
+}
+
+inline bool isAsciiSpace(char character)
+{
+	return character == ' ' or (character >= '\t' and character <= '\r');
+}
+
+/*
+ * Converts a token into a floating point number with the semantics of QString::toDouble.
+ *
+ * Plain decimal numbers such as -12.5 make up nearly all LDraw data and are converted directly from
+ * the bytes. With at most 15 digits the digits form an exact double and so does the power of ten,
+ * so the division rounds to the same result as Qt's conversion. Anything else is left to Qt.
+ */
+inline double parseDouble(const ByteView& token, bool* ok = nullptr)
+{
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+	};
+	const char* cursor = token.begin;
+	bool negative = false;
+	bool isSimple = true;
+	qint64 mantissa = 0;
+	int digits = 0;
+	int decimals = 0;
+
+	if (cursor != token.end and *cursor == '-')
+	{
+		negative = true;
+		cursor += 1;
+	}
+
+	for (; cursor != token.end and isAsciiDigit(*cursor); cursor += 1)
+	{
+		if (digits < 15)
+			mantissa = (mantissa * 10) + (*cursor - '0');
+
+		digits += 1;
+	}
+
+	if (digits == 0)
+		isSimple = false;
+
+	if (cursor != token.end and *cursor == '.')
+	{
+		cursor += 1;
+
+		for (; cursor != token.end and isAsciiDigit(*cursor); cursor += 1)
+		{
+			if (digits < 15)
+				mantissa = (mantissa * 10) + (*cursor - '0');
+
+			digits += 1;
+			decimals += 1;
+		}
+
+		if (decimals == 0)
+			isSimple = false;
+	}
+
+	if (isSimple and cursor == token.end and digits <= 15)
+	{
+		if (ok)
+			*ok = true;
+
+		double result = static_cast<double>(mantissa) / powersOfTen[decimals];
+		return negative ? -result : result;
+	}
+	else
+	{
+		return token.toString().toDouble(ok);
+	}
+}
+
+/*
+ * Converts a token into an integer with the semantics of QString::toInt. Base 0 deduces the base
+ * from the prefix of the token, like colour codes do. Plain decimal numbers are converted directly
+ * from the bytes, everything else is left to Qt.
+ */
+inline int parseInteger(const ByteView& token, int base, bool* ok = nullptr)
+{
+	if ((base == 0 or base == 10) and token.size() > 0 and token.size() <= 9)
+	{
+		const char* cursor = token.begin;
+		bool negative = (*cursor == '-');
+
+		if (negative)
+			cursor += 1;
+
+		// A leading zero means octal notation in base 0, so let Qt deal with those.
+		if (cursor != token.end and (*cursor != '0' or cursor + 1 == token.end))
+		{
+			int result = 0;
+
+			for (; cursor != token.end and isAsciiDigit(*cursor); cursor += 1)
+				result = (result * 10) + (*cursor - '0');
+
+			if (cursor == token.end)
+			{
+				if (ok)
+					*ok = true;
+
+				return negative ? -result : result;
+			}
+		}
+	}
+
+	return token.toString().toInt(ok, base);
+}
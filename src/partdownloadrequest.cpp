@@ -219,7 +219,9 @@ void PartDownloadRequest::downloadFinished()
 		return;
 	}
 
-	// Try to load this file now.
+	// Try to load this file now. Make the library index aware of it first, since it may be a library file that other
+	// documents have failed to find so far.
+	m_documents->refreshLibraries();
 	LDDocument* document = m_documents->openDocument (filePath(), false, not isPrimary());
 
 	if (document == nullptr)
@@ -16,8 +16,15 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <memory>
+#include <vector>
 #include <QApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
 #include <QMessageBox>
+#include <QRunnable>
+#include <QThreadPool>
 #include "lddocument.h"
 #include "mainwindow.h"
 #include "primitives.h"
@@ -53,49 +60,28 @@ QString PrimitiveManager::getPrimitivesCfgPath() const
 }
 
 
+/*
+ * Loads the primitives from prims.cfg in the background, scanning only the primitives folders that have changed.
+ */
 void PrimitiveManager::loadPrimitives()
 {
-	// Try to load prims.cfg
-	QFile primitivesFile = {getPrimitivesCfgPath()};
-
-	if (not primitivesFile.open (QIODevice::ReadOnly))
-	{
-		// No prims.cfg, build it
-		startScan();
-	}
-	else
-	{
-		emit layoutAboutToBeChanged();
-		m_primitives.clear();
-
-		while (not primitivesFile.atEnd())
-		{
-			QString line = primitivesFile.readLine().simplified();
-			int space = line.indexOf(" ");
-
-			if (space != -1)
-			{
-				Primitive info;
-				info.name = line.left(space);
-				info.title = line.mid(space + 1);
-				m_primitives.append(info);
-			}
-		}
-
-		populateCategories();
-		emit layoutChanged();
-		print(tr("%1 primitives loaded.") + "\n", countof(m_primitives));
-	}
+	startScan(false);
 }
 
 
-void PrimitiveManager::startScan()
+/*
+ * Starts scanning the primitives in the background, unless a scan is already in progress. By default every
+ * primitives folder is scanned again, otherwise only those that have changed since prims.cfg was written.
+ */
+void PrimitiveManager::startScan(bool rescanAll)
 {
 	if (m_activeScanner == nullptr)
 	{
-		loadCategories();
-		m_activeScanner = new PrimitiveScanner {this};
-		m_activeScanner->work();
+		// The categories come from a resource file, so they only need to be loaded once.
+		if (m_categoryMatchOrder.isEmpty())
+			loadCategories();
+
+		m_activeScanner = new PrimitiveScanner {this, m_categoryMatchOrder, rescanAll};
 		connect(m_activeScanner, &PrimitiveScanner::workDone, this, [&]()
 		{
 			if (m_activeScanner)
@@ -105,10 +91,11 @@ void PrimitiveManager::startScan()
 				populateCategories();
 				emit layoutChanged();
 				print(tr("%1 primitives scanned"), countof(m_primitives));
-				delete m_activeScanner;
+				m_activeScanner->deleteLater();
 				m_activeScanner = nullptr;
 			}
 		});
+		m_activeScanner->start();
 	}
 }
 
@@ -119,66 +106,27 @@ void PrimitiveManager::clearCategories()
 		delete category;
 
 	m_categories.clear();
+	m_categoryMatchOrder.clear();
 }
 
 
+/*
+ * Adds the primitives to the categories that the scanner has matched them to.
+ */
 void PrimitiveManager::populateCategories()
 {
-	loadCategories();
-
 	for (PrimitiveCategory* category : m_categories)
 		category->primitives.clear();
 
-	for (Primitive& primitive : m_primitives)
+	for (const Primitive& primitive : m_primitives)
 	{
-		bool matched = false;
-		primitive.category = nullptr;
-
-		// Go over the categories and their regexes, if and when there's a match,
-		// the primitive's category is set to the category the regex beloings to.
-		for (PrimitiveCategory* category : m_categories)
-		{
-			for (PrimitiveCategory::RegexEntry& entry : category->patterns)
-			{
-				switch (entry.type)
-				{
-				case PrimitiveCategory::FilenamePattern:
-					// f-regex, check against filename
-					matched = entry.regex.exactMatch (primitive.name);
-					break;
-
-				case PrimitiveCategory::TitlePattern:
-					// t-regex, check against title
-					matched = entry.regex.exactMatch (primitive.title);
-					break;
-				}
-
-				if (matched)
-				{
-					primitive.category = category;
-					break;
-				}
-			}
-
-			// Drop off if a category was decided on.
-			if (primitive.category)
-				break;
-		}
-
 		// If there was a match, add the primitive to the category.
 		// Otherwise, add it to the list of unmatched primitives.
 		if (primitive.category)
 			primitive.category->primitives << primitive;
-		else
+		else if (m_unmatched)
 			m_unmatched->primitives << primitive;
 	}
-
-	// Sort the categories. Note that we only do this here because we needed the original order for pattern matching.
-	::sort(m_categories.begin(), m_categories.end(),
-		[](PrimitiveCategory* const& one, PrimitiveCategory* const& other) -> bool
-		{
-			return one->name() < other->name();
-		});
 }
 
 
@@ -257,6 +205,15 @@ void PrimitiveManager::loadCategories()
 	m_unmatched = new PrimitiveCategory {tr("Other")};
 	m_categories.append(m_unmatched);
 	categoriesFile.close();
+
+	// Primitives are matched to the first category in the file that accepts them, but the categories are listed
+	// by name.
+	m_categoryMatchOrder = m_categories;
+	::sort(m_categories.begin(), m_categories.end(),
+		[](PrimitiveCategory* const& one, PrimitiveCategory* const& other) -> bool
+		{
+			return one->name() < other->name();
+		});
 }
 
 // Length of a single LDraw edge circle segment. Ideally, it is sqrt(2 - 2 * cos(π / 8)), but
@@ -636,7 +593,7 @@ LDDocument* PrimitiveManager::generatePrimitive(const PrimitiveModel& spec)
 	}
 
 	document->setFrozen(false);
-	document->header.name = fileName;
+	document->setName(fileName);
 	document->header.description = description;
 
 	if (spec.divisions == HighResolution)
@@ -862,25 +819,103 @@ QString PrimitiveCategory::name() const
 }
 
 
+enum
+{
+	// Files read by a single task of the primitive scanner.
+	PrimitiveScanChunkSize = 256,
+};
+
+/*
+ * Runs the scan of a primitive scanner in its thread pool.
+ */
+class PrimitiveScanner::Worker : public QRunnable
+{
+public:
+	Worker(PrimitiveScanner* scanner) :
+		m_scanner {scanner} {}
+
+	void run() override
+	{
+		m_scanner->scan();
+	}
+
+private:
+	PrimitiveScanner* const m_scanner;
+};
+
+/*
+ * Reads the titles of a range of primitive files.
+ */
+class PrimitiveTitleReader : public QRunnable
+{
+public:
+	PrimitiveTitleReader(const QStringList& paths, QVector<Primitive>& primitives) :
+		m_paths {paths},
+		m_primitives {primitives}
+	{
+		setAutoDelete(false);
+	}
+
+	void run() override
+	{
+		for (const QString& path : m_paths)
+		{
+			QFile file {path};
+
+			if (file.open(QIODevice::ReadOnly))
+			{
+				// Only the first line is needed, which the buffering of the file reads in one go.
+				Primitive primitive;
+				primitive.name = LDDocument::shortenName(path);
+				primitive.category = nullptr;
+				primitive.title = QString::fromUtf8(file.readLine().simplified());
+
+				if (primitive.title.startsWith('0'))
+				{
+					primitive.title.remove(0, 1);  // remove 0
+					primitive.title = primitive.title.trimmed();
+				}
+
+				m_primitives << primitive;
+			}
+		}
+	}
+
+private:
+	const QStringList m_paths;
+	QVector<Primitive>& m_primitives;
+};
+
 /*
  * PrimitiveScanner :: PrimitiveScanner
  *
- * Constructs a primitive scanner.
+ * Constructs a primitive scanner. The patterns of the categories are copied, since the regular expressions are
+ * matched in another thread.
  */
-PrimitiveScanner::PrimitiveScanner(PrimitiveManager* parent) :
+PrimitiveScanner::PrimitiveScanner(
+	PrimitiveManager* parent,
+	const QVector<PrimitiveCategory*>& categories,
+	bool rescanAll
+) :
 	QObject(parent),
 	HierarchyElement(parent),
-	m_manager(parent)
+	m_threadPool(new QThreadPool {this}),
+	m_cachePath(parent->getPrimitivesCfgPath()),
+	m_rescanAll(rescanAll)
 {
+	m_threadPool->setMaxThreadCount(1);
+
+	for (PrimitiveCategory* category : categories)
+		m_categories.append({category, category->patterns});
+
 	for (const Library& library : config::libraries())
 	{
-		QDir dir {library.path};
-		if (dir.exists("p") and QFileInfo {dir.filePath("p")}.isDir())
+		for (const QString& subdirectory : {"p", "p/48"})
 		{
-			directories.push(dir.filePath("p"));
+			QString path = QDir::cleanPath(library.path + "/" + subdirectory);
 
-			if (dir.exists("p/48") and QFileInfo {dir.filePath("p/48")}.isDir())
-				directories.push(dir.filePath("p/48"));
+			if (not m_directories.contains(path))
+				m_directories.append(path);
 		}
 	}
 
@@ -889,7 +924,7 @@ PrimitiveScanner::PrimitiveScanner(PrimitiveManager* parent) :
 
 PrimitiveScanner::~PrimitiveScanner()
 {
-	delete this->currentIterator;
+	m_threadPool->waitForDone();
 }
 
 /*
@@ -903,84 +938,225 @@ const QVector<Primitive> &PrimitiveScanner::scannedPrimitives() const
 }
 
 /*
- * PrimitiveScanner :: work
- *
- * Does one step of work, processes up to 100 primitives.
- * If the scanner does not finish work by this function call, it will ask the event loop to call this method again.
+ * Starts the scan. The workDone signal is emitted once it is complete.
+ */
+void PrimitiveScanner::start()
+{
+	m_threadPool->start(new Worker {this});
+}
+
+/*
+ * Scans the folders that have changed since prims.cfg was written, or every folder if so requested, and then sorts the
+ * primitives by title and matches them to categories. Runs in the thread pool.
+ */
+void PrimitiveScanner::scan()
+{
+	QHash<QString, Directory> cache = loadCache();
+	QHash<QString, Directory> directories;
+	bool hasChanged = false;
+
+	for (const QString& path : m_directories)
+	{
+		QFileInfo info {path};
+
+		if (not info.isDir())
+			continue;
+
+		qint64 modified = info.lastModified().toMSecsSinceEpoch();
+		auto cached = cache.find(path);
+
+		if (not m_rescanAll and cached != cache.end() and cached->modified == modified)
+		{
+			directories.insert(path, *cached);
+		}
+		else
+		{
+			directories.insert(path, {modified, scanDirectory(path)});
+			hasChanged = true;
+		}
+	}
+
+	// Folders that are no longer scanned are a change as well.
+	if (directories.size() != cache.size())
+		hasChanged = true;
+
+	for (const QString& path : m_directories)
+		m_scannedPrimitives += directories.value(path).primitives;
+
+	std::sort(
+		m_scannedPrimitives.begin(),
+		m_scannedPrimitives.end(),
+		[](const Primitive& one, const Primitive& other) -> bool
+		{
+			return one.title < other.title;
+		}
+	);
+	categorize();
+
+	if (hasChanged)
+		saveCache(directories);
+
+	QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+}
+
+/*
+ * Reads the titles of the primitives of the given folder, in parallel.
+ */
+QVector<Primitive> PrimitiveScanner::scanDirectory(const QString& path)
+{
+	QDir directory {path};
+	QStringList files = directory.entryList({"*.dat"}, QDir::Files);
+	QVector<QVector<Primitive>> chunks ((files.size() + PrimitiveScanChunkSize - 1) / PrimitiveScanChunkSize);
+	std::vector<std::unique_ptr<PrimitiveTitleReader>> readers;
+	QThreadPool pool;
+
+	for (int i = 0; i < chunks.size(); i += 1)
+	{
+		QStringList paths;
+
+		for (const QString& file : files.mid(i * PrimitiveScanChunkSize, PrimitiveScanChunkSize))
+			paths.append(directory.filePath(file));
+
+		readers.emplace_back(std::make_unique<PrimitiveTitleReader>(paths, chunks[i]));
+		pool.start(readers.back().get());
+	}
+
+	pool.waitForDone();
+	QVector<Primitive> primitives;
+
+	for (const QVector<Primitive>& chunk : chunks)
+		primitives += chunk;
+
+	return primitives;
+}
+
+/*
+ * Matches each primitive to the first category that accepts either its file name or its title.
  */
-void PrimitiveScanner::work()
+void PrimitiveScanner::categorize()
 {
-	while (this->currentIterator == nullptr or not this->currentIterator->hasNext())
+	for (Primitive& primitive : m_scannedPrimitives)
 	{
-		delete this->currentIterator;
-		this->currentIterator = nullptr;
+		primitive.category = nullptr;
 
-		if (this->directories.isEmpty())
+		for (CategoryPatterns& category : m_categories)
 		{
-			// If there are no more primitives to iterate, we're done. Now save this information into a cache file.
-			std::sort(
-				m_scannedPrimitives.begin(),
-				m_scannedPrimitives.end(),
-				[](const Primitive& one, const Primitive& other) -> bool
+			for (PrimitiveCategory::RegexEntry& entry : category.patterns)
+			{
+				bool matched = false;
+
+				switch (entry.type)
 				{
-					return one.title < other.title;
-				}
-			);
-			QString path = m_manager->getPrimitivesCfgPath();
-			QFile configFile = {path};
+				case PrimitiveCategory::FilenamePattern:
+					// f-regex, check against filename
+					matched = entry.regex.exactMatch (primitive.name);
+					break;
 
-			if (configFile.open(QIODevice::WriteOnly | QIODevice::Text))
-			{
-				for (Primitive& primitive : m_scannedPrimitives)
-					fprint(configFile, "%1 %2\r\n", primitive.name, primitive.title);
+				case PrimitiveCategory::TitlePattern:
+					// t-regex, check against title
+					matched = entry.regex.exactMatch (primitive.title);
+					break;
+				}
 
-				configFile.close();
-			}
-			else
-			{
-				QMessageBox::critical(
-					m_window,
-					tr("Error"),
-					format(
-						tr("Couldn't write primitive list %1: %2"),
-						path,
-						configFile.errorString()
-					)
-				);
+				if (matched)
+				{
+					primitive.category = category.category;
+					break;
+				}
 			}
 
-			emit workDone();
-			return;
-		}
-		else
-		{
-			this->currentIterator = new QDirIterator {this->directories.pop()};
-			this->m_basePathLength = this->currentIterator->path().length();
+			// Drop off if a category was decided on.
+			if (primitive.category)
+				break;
 		}
 	}
+}
+
+/*
+ * Reads prims.cfg. Each folder is listed on a line of its own with its modification time, followed by its primitives.
+ * Primitives that are not preceded by a folder, such as those of older versions of the file, are ignored, so that
+ * their folders are scanned again.
+ */
+QHash<QString, PrimitiveScanner::Directory> PrimitiveScanner::loadCache() const
+{
+	QHash<QString, Directory> directories;
+	QFile file {m_cachePath};
 
-	for (int i = 0; this->currentIterator->hasNext() and i < 100; ++i)
+	if (file.open(QIODevice::ReadOnly))
 	{
-		QString filename = this->currentIterator->next();
-		QFile file = {filename};
+		Directory* directory = nullptr;
 
-		if (file.open (QIODevice::ReadOnly))
+		while (not file.atEnd())
 		{
-			Primitive primitive;
-			primitive.name = LDDocument::shortenName(filename);
-			primitive.category = nullptr;
-			primitive.title = QString::fromUtf8(file.readLine().simplified());
+			QString line = QString::fromUtf8(file.readLine()).trimmed();
 
-			if (primitive.title[0] == '0')
+			if (line.startsWith("# "))
 			{
-				primitive.title.remove(0, 1);  // remove 0
-				primitive.title = primitive.title.trimmed();
+				int space = line.indexOf(" ", 2);
+
+				if (space != -1)
+				{
+					directory = &directories[line.mid(space + 1)];
+					directory->modified = line.mid(2, space - 2).toLongLong();
+				}
+			}
+			else if (directory)
+			{
+				line = line.simplified();
+				int space = line.indexOf(" ");
+
+				if (space != -1)
+				{
+					Primitive primitive;
+					primitive.name = line.left(space);
+					primitive.title = line.mid(space + 1);
+					primitive.category = nullptr;
+					directory->primitives.append(primitive);
+				}
 			}
+		}
+	}
+
+	return directories;
+}
+
+/*
+ * Writes the given folders and their primitives into prims.cfg.
+ */
+void PrimitiveScanner::saveCache(const QHash<QString, Directory>& directories)
+{
+	QFile configFile = {m_cachePath};
+
+	if (configFile.open(QIODevice::WriteOnly | QIODevice::Text))
+	{
+		for (const QString& path : m_directories)
+		{
+			auto iterator = directories.find(path);
 
-			m_scannedPrimitives << primitive;
+			if (iterator == directories.end())
+				continue;
+
+			fprint(configFile, "# %1 %2\r\n", QString::number(iterator->modified), path);
+
+			for (const Primitive& primitive : iterator->primitives)
+				fprint(configFile, "%1 %2\r\n", primitive.name, primitive.title);
 		}
+
+		configFile.close();
+	}
+	else
+	{
+		m_errorString = format(tr("Couldn't write primitive list %1: %2"), m_cachePath, configFile.errorString());
 	}
+}
+
+/*
+ * Reports the outcome of the scan in the thread of the scanner.
+ */
+void PrimitiveScanner::finish()
+{
+	if (not m_errorString.isEmpty())
+		QMessageBox::critical(m_window, tr("Error"), m_errorString);
 
-	// Defer to event loop, pick up the work later.
-	QMetaObject::invokeMethod (this, "work", Qt::QueuedConnection);
+	emit workDone();
 }
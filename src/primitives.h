@@ -20,8 +20,7 @@
 #include <QRegExp>
 #include <QDialog>
 #include <QTreeWidgetItem>
-#include <QDirIterator>
-#include <QStack>
+#include <QHash>
 #include "main.h"
 #include "model.h"
 #include "hierarchyelement.h"
@@ -30,6 +29,7 @@ class LDDocument;
 class Ui_GeneratePrimitiveDialog;
 class PrimitiveCategory;
 class PrimitiveScanner;
+class QThreadPool;
 
 struct Primitive
 {
@@ -119,7 +119,7 @@ public:
 	LDDocument* getPrimitive(const PrimitiveModel &spec);
 	QString getPrimitivesCfgPath() const;
 	void loadPrimitives();
-	void startScan();
+	void startScan(bool rescanAll = true);
 
 	int	columnCount(const QModelIndex &parent = {}) const override;
 	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
@@ -129,7 +129,8 @@ public:
 	QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
 
 private:
-	QVector<PrimitiveCategory*> m_categories;
+	QVector<PrimitiveCategory*> m_categories; // Sorted by name
+	QVector<PrimitiveCategory*> m_categoryMatchOrder; // In the order of the categories file
 	PrimitiveScanner* m_activeScanner;
 	QVector<Primitive> m_primitives;
 	PrimitiveCategory* m_unmatched;
@@ -142,27 +143,50 @@ private:
 /*
  * PrimitiveScanner
  *
- * Worker object that scans the primitives folder for primitives and builds an index of them.
+ * Scans the primitives folders of the libraries for primitives and sorts them into categories in a thread pool, so
+ * that the interface stays responsive. The primitives are cached in prims.cfg along with the modification times of
+ * their folders, and only the folders that have changed since are scanned again.
  */
 class PrimitiveScanner : public QObject, HierarchyElement
 {
 	Q_OBJECT
 
 public:
-	PrimitiveScanner(PrimitiveManager* parent);
+	PrimitiveScanner(PrimitiveManager* parent, const QVector<PrimitiveCategory*>& categories, bool rescanAll);
 	~PrimitiveScanner();
 	const QVector<Primitive>& scannedPrimitives() const;
-
-public slots:
-	void work();
+	void start();
 
 signals:
 	void workDone();
 
 private:
-	PrimitiveManager* m_manager;
+	class Worker;
+
+	struct Directory
+	{
+		qint64 modified = -1;
+		QVector<Primitive> primitives;
+	};
+
+	struct CategoryPatterns
+	{
+		PrimitiveCategory* category;
+		QVector<PrimitiveCategory::RegexEntry> patterns;
+	};
+
+	void categorize();
+	QHash<QString, Directory> loadCache() const;
+	void saveCache(const QHash<QString, Directory>& directories);
+	void scan();
+	static QVector<Primitive> scanDirectory(const QString& path);
+	Q_SLOT void finish();
+
+	QThreadPool* m_threadPool;
+	const QString m_cachePath;
+	const bool m_rescanAll;
+	QStringList m_directories;
+	QVector<CategoryPatterns> m_categories; // Copies of the patterns for the worker thread
 	QVector<Primitive> m_scannedPrimitives;
-	QStack<QDir> directories;
-	QDirIterator* currentIterator = nullptr;
-	int m_basePathLength;
+	QString m_errorString;
 };
@@ -16,30 +16,133 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <QMatrix4x4>
 #include "serializer.h"
 #include "linetypes/modelobject.h"
 
+bool LDObjectState::isEmpty() const
+{
+	return data.isEmpty();
+}
+
+bool LDObjectState::operator==(const LDObjectState& other) const
+{
+	return data == other.data and strings == other.strings;
+}
+
+QDataStream& operator<<(QDataStream& stream, const LDObjectState& state)
+{
+	return stream << state.data << state.strings;
+}
+
+QDataStream& operator>>(QDataStream& stream, LDObjectState& state)
+{
+	return stream >> state.data >> state.strings;
+}
+
 Serializer::Serializer(Archive& archive, Action action) :
 	archive {archive},
 	action {action} {}
 
+/*
+ * Copies the given amount of bytes into the archive or out of it. Returns false if the archive ran out.
+ */
+bool Serializer::transfer(void* data, int size)
+{
+	switch (action)
+	{
+	case Store:
+		this->archive.data.append(static_cast<const char*>(data), size);
+		return true;
+
+	case Restore:
+		if (this->cursor + size <= this->archive.data.size())
+		{
+			memcpy(data, this->archive.data.constData() + this->cursor, size);
+			this->cursor += size;
+			return true;
+		}
+		else
+		{
+			fprintf(stderr, "warning: archive ran out while restoring\n");
+			return false;
+		}
+	}
+
+	return false;
+}
+
+Serializer& Serializer::operator<<(QString& value)
+{
+	switch (action)
+	{
+	case Store:
+		this->archive.strings.append(value);
+		break;
+
+	case Restore:
+		if (this->stringCursor < this->archive.strings.size())
+		{
+			value = this->archive.strings[this->stringCursor];
+			this->stringCursor += 1;
+		}
+		else
+		{
+			fprintf(stderr, "warning: archive ran out of strings while restoring\n");
+			value.clear();
+		}
+		break;
+	}
+
+	return *this;
+}
+
+Serializer& Serializer::operator<<(QColor& value)
+{
+	bool isValid = value.isValid();
+	QRgb rgba = value.rgba();
+	*this << isValid << rgba;
+
+	if (action == Restore)
+		value = isValid ? QColor::fromRgba(rgba) : QColor {};
+
+	return *this;
+}
+
+Serializer& Serializer::operator<<(QMatrix4x4& value)
+{
+	float values[16];
+	std::copy(value.constData(), value.constData() + 16, values);
+
+	if (transfer(values, sizeof values) and action == Restore)
+	{
+		std::copy(values, values + 16, value.data());
+		value.optimize();
+	}
+
+	return *this;
+}
+
 Serializer::Archive Serializer::store(LDObject* object)
 {
 	Archive result;
-	result.append(static_cast<int>(object->type()));
 	Serializer serializer {result, Store};
+	LDObjectType type = object->type();
+	serializer << type;
 	object->serialize(serializer);
 	return result;
 }
 
 LDObject* Serializer::restore(Archive& archive)
 {
-	if (archive.size() > 0)
+	if (not archive.isEmpty())
 	{
 		Serializer serializer {archive, Restore};
-		int type;
+		LDObjectType type;
 		serializer << type;
-		LDObject* object = LDObject::newFromType(static_cast<LDObjectType>(type));
+		LDObject* object = LDObject::newFromType(type);
 
 		if (object)
 			object->serialize(serializer);
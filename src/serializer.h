@@ -17,10 +17,29 @@
  */
 
 #pragma once
+#include <type_traits>
+#include <QColor>
+#include <QDataStream>
 #include "main.h"
 
 class LDObject;
-using LDObjectState = QVector<QVariant>;
+class QMatrix4x4;
+
+/*
+ * The state of an object in a packed form. The fields are stored into a byte array as they are, except for strings,
+ * which are kept in a table of their own so that they stay implicitly shared with the object they came from.
+ */
+struct LDObjectState
+{
+	QByteArray data;
+	QVector<QString> strings;
+
+	bool isEmpty() const;
+	bool operator==(const LDObjectState& other) const;
+};
+
+QDataStream& operator<<(QDataStream& stream, const LDObjectState& state);
+QDataStream& operator>>(QDataStream& stream, LDObjectState& state);
 
 class Serializer
 {
@@ -37,39 +56,33 @@ public:
 
 	template<typename T>
 	Serializer& operator<<(T& value);
+	Serializer& operator<<(QString& value);
+	Serializer& operator<<(QColor& value);
+	Serializer& operator<<(QMatrix4x4& value);
 
 	static Archive store(LDObject* object);
 	static LDObject* restore(Archive& archive) __attribute__((warn_unused_result));
 	static LDObject* clone(LDObject* object) __attribute__((warn_unused_result));
 
 private:
+	bool transfer(void* data, int size);
+
 	Archive& archive;
 	int cursor = 0;
+	int stringCursor = 0;
 	Action action;
 };
 
+/*
+ * Stores or restores a field of plain data, copying its bytes as they are.
+ */
 template<typename T>
 Serializer& Serializer::operator<<(T& value)
 {
-	switch (action)
-	{
-	case Store:
-		this->archive.append(QVariant::fromValue(value));
-		break;
+	static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be archived byte by byte");
 
-	case Restore:
-		if (this->cursor < this->archive.size())
-		{
-			value = this->archive[this->cursor].value<T>();
-			this->cursor += 1;
-		}
-		else
-		{
-			fprintf(stderr, "warning: archive ran out while restoring\n");
-			value = T {};
-		}
-		break;
-	}
+	if (not transfer(&value, sizeof value))
+		value = T {};
 
 	return *this;
 }
@@ -154,6 +154,7 @@ void AlgorithmToolset::roundCoordinates()
 {
 	setlocale (LC_ALL, "C");
 	int num = 0;
+	EditTransaction transaction {currentDocument()};
 
 	for (LDObject* object : selectedObjects())
 	{
@@ -249,11 +250,27 @@ void AlgorithmToolset::fixRoundingErrors()
 			}
 		};
 
+		// Only objects with vertices within the threshold of the reference point need to be looked at, besides those with
+		// a position. The index may have merged a vertex into a point up to its tolerance away, so the box is widened
+		// by that, and fixVertex still tests the actual vertices.
+		const VertexIndex& vertexIndex = currentDocument()->vertexIndex();
+		Vertex minimum {-inf, -inf, -inf};
+		Vertex maximum {inf, inf, inf};
+
+		for (Axis axis : axes)
+		{
+			minimum[axis] = referencePoint[axis] - sqrt(thresholdDistanceSquared) - vertexIndex.tolerance();
+			maximum[axis] = referencePoint[axis] + sqrt(thresholdDistanceSquared) + vertexIndex.tolerance();
+		}
+
+		QSet<LDObject*> candidates = vertexIndex.objectsInBox(minimum, maximum);
+		EditTransaction transaction {currentDocument()};
+
 		for (const QModelIndex& index : m_window->selectedIndexes())
 		{
 			LDObject* object = currentDocument()->lookup(index);
 
-			if (object)
+			if (object and (object->hasMatrix() or candidates.contains(object)))
 			{
 				for (int i : range(0, 1, object->numVertices() - 1))
 				{
@@ -299,8 +316,32 @@ void AlgorithmToolset::replaceCoordinates()
 	if (ui.z->isChecked())
 		selectedAxes << Z;
 
+	// Unless all values are replaced, only the objects with a vertex that has the value on some selected axis need to be
+	// looked at. The index may have merged a vertex into a point up to its tolerance away, so the box is widened by
+	// that, and the vertices of the candidates are still compared with the value below.
+	QSet<LDObject*> candidates;
+
+	if (not replaceAllValues)
+	{
+		const VertexIndex& vertexIndex = currentDocument()->vertexIndex();
+
+		for (Axis axis : selectedAxes)
+		{
+			Vertex minimum {-inf, -inf, -inf};
+			Vertex maximum {inf, inf, inf};
+			minimum[axis] = needle - 1e-6 - vertexIndex.tolerance();
+			maximum[axis] = needle + 1e-6 + vertexIndex.tolerance();
+			candidates |= vertexIndex.objectsInBox(minimum, maximum);
+		}
+	}
+
+	EditTransaction transaction {currentDocument()};
+
 	for (LDObject* obj : selectedObjects())
 	{
+		if (not replaceAllValues and not candidates.contains(obj))
+			continue;
+
 		for (int i = 0; i < obj->numVertices(); ++i)
 		{
 			Vertex vertex = obj->vertex(i);
@@ -339,6 +380,8 @@ void AlgorithmToolset::flip()
 	if (ui.y->isChecked()) sel << Y;
 	if (ui.z->isChecked()) sel << Z;
 
+	EditTransaction transaction {currentDocument()};
+
 	for (LDObject* obj : selectedObjects())
 	{
 		for (int i = 0; i < obj->numVertices(); ++i)
@@ -579,7 +622,7 @@ void AlgorithmToolset::subfileSelection()
 	subfile->setFullPath(fullSubfilePath);
 	subfile->header.description = subfileTitle;
 	subfile->header.type = LDHeader::Subpart;
-	subfile->header.name = LDDocument::shortenName(fullSubfilePath);
+	subfile->setName(LDDocument::shortenName(fullSubfilePath));
 	subfile->header.author = format("%1 [%2]", config::defaultName(), config::defaultUser());
 
 	if (config::useCaLicense())
@@ -82,16 +82,14 @@ void BasicToolset::paste()
 	const QString clipboardText = qApp->clipboard()->text();
 	int row = m_window->suggestInsertPoint();
 	mainWindow()->clearSelection();
-	int count = 0;
+	Model pasted {m_documents};
 
 	for (QString line : clipboardText.split("\n"))
-	{
-		Parser::parseFromString(*currentDocument(), row, line);
-		mainWindow()->select(currentDocument()->index(row));
-		row += 1;
-		count += 1;
-	}
+		Parser::parseFromString(pasted, Parser::EndOfModel, line);
 
+	int count = pasted.size();
+	currentDocument()->insertObjects(row, pasted.takeObjects());
+	mainWindow()->selectRows(row, row + count - 1);
 	print(tr("%1 objects pasted"), count);
 	m_window->refresh();
 }
@@ -124,16 +122,10 @@ void BasicToolset::doInline (bool deep)
 					false
 				);
 
-				// Merge in the inlined objects
-				for (LDObject* inlinedObject : inlined.objects())
-				{
-					currentDocument()->insertCopy(row, inlinedObject);
-					mainWindow()->select(currentDocument()->index(row));
-					row += 1;
-				}
-
-				// Delete the subfile now as it's been inlined.
-				currentDocument()->removeRow(referenceIndex.row());
+				// Replace the subfile with the inlined objects.
+				int count = inlined.size();
+				currentDocument()->replaceRows(row, 1, inlined.takeObjects());
+				mainWindow()->selectRows(row, row + count - 1);
 			}
 		}
 	}
@@ -116,13 +116,9 @@ void FileToolset::insertFrom()
 			parser.parseBody(model);
 
 			mainWindow()->clearSelection();
-
-			for (LDObject* object : model.objects())
-			{
-				currentDocument()->insertCopy (position, object);
-				mainWindow()->select(currentDocument()->index(position));
-				position += 1;
-			}
+			int count = model.size();
+			currentDocument()->insertObjects(position, model.takeObjects());
+			mainWindow()->selectRows(position, position + count - 1);
 
 			m_window->refresh();
 		}
@@ -79,6 +79,7 @@ void MoveToolset::moveObjects(QVector3D vector)
 {
 	// Apply the grid values
 	vector *= grid()->coordinateSnap();
+	EditTransaction transaction {currentDocument()};
 
 	for (LDObject* obj : selectedObjects())
 		obj->move (vector);
@@ -121,31 +122,37 @@ double MoveToolset::getRotateActionAngle()
 
 void MoveToolset::rotateXPos()
 {
+	EditTransaction transaction {currentDocument()};
 	rotateObjects(1, 0, 0, getRotateActionAngle(), selectedObjects().toList().toVector());
 }
 
 void MoveToolset::rotateYPos()
 {
+	EditTransaction transaction {currentDocument()};
 	rotateObjects(0, 1, 0, getRotateActionAngle(), selectedObjects().toList().toVector());
 }
 
 void MoveToolset::rotateZPos()
 {
+	EditTransaction transaction {currentDocument()};
 	rotateObjects(0, 0, 1, getRotateActionAngle(), selectedObjects().toList().toVector());
 }
 
 void MoveToolset::rotateXNeg()
 {
+	EditTransaction transaction {currentDocument()};
 	rotateObjects(-1, 0, 0, getRotateActionAngle(), selectedObjects().toList().toVector());
 }
 
 void MoveToolset::rotateYNeg()
 {
+	EditTransaction transaction {currentDocument()};
 	rotateObjects(0, -1, 0, getRotateActionAngle(), selectedObjects().toList().toVector());
 }
 
 void MoveToolset::rotateZNeg()
 {
+	EditTransaction transaction {currentDocument()};
 	rotateObjects(0, 0, -1, getRotateActionAngle(), selectedObjects().toList().toVector());
 }
 
@@ -0,0 +1,325 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include "vertexindex.h"
+
+enum
+{
+	// Cells are clamped to this range, so that absurd coordinates cannot overflow them.
+	MaximumCell = 1 << 30,
+};
+
+VertexIndex::VertexIndex(qreal cellSize, qreal tolerance) :
+	m_cellSize {cellSize},
+	m_tolerance {tolerance}
+{
+	clear();
+}
+
+bool VertexIndex::Cell::operator==(const Cell& other) const
+{
+	return x == other.x and y == other.y and z == other.z;
+}
+
+/*
+ * Removes all vertices from the index.
+ */
+void VertexIndex::clear()
+{
+	m_cells.clear();
+	m_objectVertices.clear();
+	m_minimumCell = {MaximumCell, MaximumCell, MaximumCell};
+	m_maximumCell = {-MaximumCell, -MaximumCell, -MaximumCell};
+	m_size = 0;
+}
+
+/*
+ * Returns whether the vertices of the given object are in the index.
+ */
+bool VertexIndex::contains(LDObject* object) const
+{
+	return m_objectVertices.contains(object);
+}
+
+/*
+ * Adds the vertices of an object to the index, replacing the vertices that it had before.
+ */
+void VertexIndex::insert(LDObject* object, const QSet<Vertex>& vertices)
+{
+	remove(object);
+	QVector<Vertex>& objectVertices = m_objectVertices[object];
+	objectVertices.reserve(vertices.size());
+
+	for (const Vertex& vertex : vertices)
+	{
+		Point* point = find(vertex);
+
+		if (point == nullptr)
+		{
+			Cell cell = cellOf(vertex);
+			m_cells[cell].append({vertex, {}});
+			point = &m_cells[cell].last();
+			m_minimumCell = {qMin(m_minimumCell.x, cell.x), qMin(m_minimumCell.y, cell.y), qMin(m_minimumCell.z, cell.z)};
+			m_maximumCell = {qMax(m_maximumCell.x, cell.x), qMax(m_maximumCell.y, cell.y), qMax(m_maximumCell.z, cell.z)};
+			m_size += 1;
+		}
+
+		// Vertices of the object may fall within the tolerance of each other.
+		if (not point->objects.contains(object))
+		{
+			point->objects.append(object);
+			objectVertices.append(point->vertex);
+		}
+	}
+}
+
+bool VertexIndex::isEmpty() const
+{
+	return m_size == 0;
+}
+
+/*
+ * Returns the objects that have the given vertex.
+ */
+QSet<LDObject*> VertexIndex::objectsAt(const Vertex& vertex) const
+{
+	QVector3D tolerance {float(m_tolerance), float(m_tolerance), float(m_tolerance)};
+	return objectsInBox(vertex - tolerance, vertex + tolerance);
+}
+
+/*
+ * Returns the objects that have vertices within the given box. The box may be unbounded.
+ */
+QSet<LDObject*> VertexIndex::objectsInBox(const Vertex& minimum, const Vertex& maximum) const
+{
+	QSet<LDObject*> result;
+
+	forEachPointInBox(minimum, maximum, [&](const Point& point)
+	{
+		for (LDObject* object : point.objects)
+			result.insert(object);
+	});
+
+	return result;
+}
+
+/*
+ * Removes the vertices of an object from the index. Vertices that other objects have remain.
+ */
+void VertexIndex::remove(LDObject* object)
+{
+	auto iterator = m_objectVertices.find(object);
+
+	if (iterator == m_objectVertices.end())
+		return;
+
+	for (const Vertex& vertex : *iterator)
+	{
+		auto cellIterator = m_cells.find(cellOf(vertex));
+
+		if (cellIterator == m_cells.end())
+			continue;
+
+		QVector<Point>& points = *cellIterator;
+
+		for (int i = 0; i < points.size(); i += 1)
+		{
+			if (points[i].vertex == vertex)
+			{
+				points[i].objects.removeOne(object);
+
+				if (points[i].objects.isEmpty())
+				{
+					points.removeAt(i);
+					m_size -= 1;
+				}
+
+				break;
+			}
+		}
+
+		if (points.isEmpty())
+			m_cells.erase(cellIterator);
+	}
+
+	m_objectVertices.erase(iterator);
+}
+
+/*
+ * Returns the amount of distinct vertices in the index.
+ */
+int VertexIndex::size() const
+{
+	return m_size;
+}
+
+/*
+ * Returns how far, along each axis, a vertex may be from the point that it was merged into.
+ */
+qreal VertexIndex::tolerance() const
+{
+	return m_tolerance;
+}
+
+/*
+ * Returns all distinct vertices in the index.
+ */
+QSet<Vertex> VertexIndex::vertices() const
+{
+	QSet<Vertex> result;
+	result.reserve(m_size);
+
+	for (const QVector<Point>& points : m_cells)
+	{
+		for (const Point& point : points)
+			result.insert(point.vertex);
+	}
+
+	return result;
+}
+
+/*
+ * Returns the vertices within the given box. The box may be unbounded, e.g. along the depth axis of a camera.
+ */
+QVector<Vertex> VertexIndex::verticesInBox(const Vertex& minimum, const Vertex& maximum) const
+{
+	QVector<Vertex> result;
+
+	forEachPointInBox(minimum, maximum, [&](const Point& point)
+	{
+		result.append(point.vertex);
+	});
+
+	return result;
+}
+
+VertexIndex::Cell VertexIndex::cellOf(const Vertex& vertex) const
+{
+	auto quantize = [&](qreal coordinate)
+	{
+		return static_cast<int>(qBound<qreal>(-MaximumCell, std::floor(coordinate / m_cellSize), MaximumCell));
+	};
+
+	return {quantize(vertex.x), quantize(vertex.y), quantize(vertex.z)};
+}
+
+/*
+ * Like cellOf, but clamps the cell to the cells that have been used, which also makes infinite coordinates finite.
+ */
+VertexIndex::Cell VertexIndex::clampedCellOf(const Vertex& vertex) const
+{
+	Cell cell = cellOf(vertex);
+	cell.x = qBound(m_minimumCell.x, cell.x, m_maximumCell.x);
+	cell.y = qBound(m_minimumCell.y, cell.y, m_maximumCell.y);
+	cell.z = qBound(m_minimumCell.z, cell.z, m_maximumCell.z);
+	return cell;
+}
+
+/*
+ * Finds the point that the given vertex falls within the tolerance of.
+ */
+VertexIndex::Point* VertexIndex::find(const Vertex& vertex)
+{
+	QVector3D tolerance {float(m_tolerance), float(m_tolerance), float(m_tolerance)};
+	Vertex minimum = vertex - tolerance;
+	Vertex maximum = vertex + tolerance;
+	Cell first = cellOf(minimum);
+	Cell last = cellOf(maximum);
+
+	// The tolerance is much smaller than the cells, so this goes through a cell or a few.
+	for (int x = first.x; x <= last.x; x += 1)
+	for (int y = first.y; y <= last.y; y += 1)
+	for (int z = first.z; z <= last.z; z += 1)
+	{
+		auto iterator = m_cells.find({x, y, z});
+
+		if (iterator != m_cells.end())
+		{
+			for (Point& point : *iterator)
+			{
+				if (isInBox(point.vertex, minimum, maximum))
+					return &point;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+bool VertexIndex::isInBox(const Vertex& vertex, const Vertex& minimum, const Vertex& maximum)
+{
+	return vertex.x >= minimum.x and vertex.x <= maximum.x
+		and vertex.y >= minimum.y and vertex.y <= maximum.y
+		and vertex.z >= minimum.z and vertex.z <= maximum.z;
+}
+
+/*
+ * Calls the given function for each point within the given box. If the box covers more cells than there are in use,
+ * the cells in use are gone through instead.
+ */
+template<typename Function>
+void VertexIndex::forEachPointInBox(const Vertex& minimum, const Vertex& maximum, Function function) const
+{
+	if (m_cells.isEmpty())
+		return;
+
+	Cell first = clampedCellOf(minimum);
+	Cell last = clampedCellOf(maximum);
+
+	if (first.x > last.x or first.y > last.y or first.z > last.z)
+		return;
+
+	qint64 cellCount = qint64(last.x - first.x + 1) * (last.y - first.y + 1) * (last.z - first.z + 1);
+
+	auto visitCell = [&](const QVector<Point>& points)
+	{
+		for (const Point& point : points)
+		{
+			if (isInBox(point.vertex, minimum, maximum))
+				function(point);
+		}
+	};
+
+	if (cellCount > m_cells.size())
+	{
+		for (auto iterator = m_cells.begin(); iterator != m_cells.end(); ++iterator)
+		{
+			const Cell& cell = iterator.key();
+
+			if (cell.x >= first.x and cell.x <= last.x
+				and cell.y >= first.y and cell.y <= last.y
+				and cell.z >= first.z and cell.z <= last.z
+			) {
+				visitCell(*iterator);
+			}
+		}
+	}
+	else
+	{
+		for (int x = first.x; x <= last.x; x += 1)
+		for (int y = first.y; y <= last.y; y += 1)
+		for (int z = first.z; z <= last.z; z += 1)
+		{
+			auto iterator = m_cells.find({x, y, z});
+
+			if (iterator != m_cells.end())
+				visitCell(*iterator);
+		}
+	}
+}
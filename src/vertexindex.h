@@ -0,0 +1,90 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QHash>
+#include "main.h"
+
+class LDObject;
+
+/*
+ * A spatial hash of the vertices of a model, for finding the vertices near a point or within a box without going through
+ * all of them. The vertices are put into cubic cells by their quantized coordinates. Vertices closer to each other than
+ * the tolerance count as the same vertex, so the point stored for a vertex may lie up to the tolerance away from it
+ * along each axis. Queries that must find every object with a vertex in a box have to widen the box by the tolerance.
+ *
+ * The vertices belong to objects, so that the vertices of an object can be replaced when it changes without rebuilding
+ * the index. A vertex can belong to several objects.
+ */
+class VertexIndex
+{
+public:
+	VertexIndex(qreal cellSize = 8.0, qreal tolerance = 1e-4);
+
+	void clear();
+	bool contains(LDObject* object) const;
+	void insert(LDObject* object, const QSet<Vertex>& vertices);
+	bool isEmpty() const;
+	QSet<LDObject*> objectsAt(const Vertex& vertex) const;
+	QSet<LDObject*> objectsInBox(const Vertex& minimum, const Vertex& maximum) const;
+	void remove(LDObject* object);
+	int size() const;
+	qreal tolerance() const;
+	QSet<Vertex> vertices() const;
+	QVector<Vertex> verticesInBox(const Vertex& minimum, const Vertex& maximum) const;
+
+private:
+	struct Cell
+	{
+		int x;
+		int y;
+		int z;
+
+		bool operator==(const Cell& other) const;
+
+		friend unsigned int qHash(const Cell& cell)
+		{
+			return qHash(cell.x) ^ rotl10(qHash(cell.y)) ^ rotl20(qHash(cell.z));
+		}
+	};
+
+	/*
+	 * A distinct vertex, and the objects that it belongs to.
+	 */
+	struct Point
+	{
+		Vertex vertex;
+		QVector<LDObject*> objects;
+	};
+
+	Cell cellOf(const Vertex& vertex) const;
+	Cell clampedCellOf(const Vertex& vertex) const;
+	Point* find(const Vertex& vertex);
+	static bool isInBox(const Vertex& vertex, const Vertex& minimum, const Vertex& maximum);
+
+	template<typename Function>
+	void forEachPointInBox(const Vertex& minimum, const Vertex& maximum, Function function) const;
+
+	const qreal m_cellSize;
+	const qreal m_tolerance;
+	QHash<Cell, QVector<Point>> m_cells;
+	QHash<LDObject*, QVector<Vertex>> m_objectVertices;
+	Cell m_minimumCell; // Bounds of the cells that have been used, for clamping unbounded queries
+	Cell m_maximumCell;
+	int m_size = 0;
+};
@@ -70,6 +70,9 @@ QDoubleSpinBox* VertexObjectEditor::spinboxAt(int i, Axis axis)
 
 void VertexObjectEditor::accept()
 {
+	// Announce the change of the object once rather than once per vertex.
+	EditTransaction transaction {nullptr};
+
 	for (int i : range(0, 1, object->numVertices() - 1))
 	{
 		Vertex vertex;
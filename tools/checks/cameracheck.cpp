@@ -0,0 +1,297 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Checks the analytic zoom-to-fit of the fixed cameras against the iterative search that it replaced, checks that
+ * fitting to view centers the model, and checks that the zoom solved for the free camera fits the model into the view.
+ *
+ * The iterative search zoomed by notches, rendered the picking scene, and stopped at the first zoom where the model
+ * no longer touched the border of the view. Here the scene is replaced by the corners of the bounding box, and a
+ * corner touches the border when it projects into the outermost row or column of pixels.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <QQuaternion>
+#include <QtMath>
+#include "glcamera.h"
+
+static const QSize viewSizes[] = {{800, 600}, {300, 900}};
+
+static GLCamera makeCamera(int index)
+{
+	switch (index)
+	{
+	default:
+	case 0: return {"Top camera", {gl::topCameraMatrix, X, Z, false, false, false}};
+	case 1: return {"Front camera", {gl::frontCameraMatrix, X, Y, false,  true, false}};
+	case 2: return {"Left camera", {gl::leftCameraMatrix, Z, Y,  true,  true, false}};
+	case 3: return {"Bottom camera", {gl::bottomCameraMatrix, X, Z, false,  true, true}};
+	case 4: return {"Back camera", {gl::backCameraMatrix, X, Y,  true,  true, true}};
+	case 5: return {"Right camera", {gl::rightCameraMatrix, Z, Y, false,  true, true}};
+	}
+}
+
+/*
+ * Returns the extents of the points in clip coordinates, as the scene is drawn by the camera.
+ */
+static QRectF projectedExtents(const GLCamera& camera, const QVector<QVector3D>& points)
+{
+	const QMatrix4x4 matrix = camera.realMatrix() * gl::ldrawToGLAdapterMatrix;
+	QPointF minimum {inf, inf};
+	QPointF maximum {-inf, -inf};
+
+	for (const QVector3D& point : points)
+	{
+		QVector3D projected = matrix.map(point);
+		minimum = {qMin(minimum.x(), double(projected.x())), qMin(minimum.y(), double(projected.y()))};
+		maximum = {qMax(maximum.x(), double(projected.x())), qMax(maximum.y(), double(projected.y()))};
+	}
+
+	return {minimum, maximum};
+}
+
+static bool touchesBorder(const GLCamera& camera, const QVector<QVector3D>& points, const QSize& size)
+{
+	QRectF extents = projectedExtents(camera, points);
+	double borderX = 1 - 2.0 / size.width();
+	double borderY = 1 - 2.0 / size.height();
+	return qMax(-extents.left(), extents.right()) >= borderX or qMax(-extents.top(), extents.bottom()) >= borderY;
+}
+
+/*
+ * Replicates the search that zoomToFit used to do, and returns the zoom that it arrived at.
+ */
+static double iterativeZoom(GLCamera& camera, const QVector<QVector3D>& points, const QSize& size)
+{
+	camera.setZoom(30.0);
+	bool lastfilled = false;
+	bool firstrun = true;
+	bool inward = true;
+	int runaway = 50;
+
+	while (--runaway)
+	{
+		if (camera.zoom() > 10000.0 or camera.zoom() < 0.0)
+		{
+			camera.setZoom(30.0);
+			break;
+		}
+
+		camera.zoomNotch(inward);
+		bool filled = touchesBorder(camera, points, size);
+
+		if (firstrun)
+		{
+			inward = not filled;
+			firstrun = false;
+		}
+		else
+		{
+			if (filled and not lastfilled)
+			{
+				camera.zoomNotch(false);
+				break;
+			}
+
+			if (not filled and lastfilled)
+				break;
+
+			inward = not filled;
+		}
+
+		lastfilled = filled;
+	}
+
+	return camera.zoom();
+}
+
+/*
+ * Returns the matrix that maps the model into clip space, as the scene is drawn by the free camera at the given
+ * rotation and zoom, with no panning.
+ */
+static QMatrix4x4 freeCameraMatrix(const QQuaternion& rotation, const QVector3D& center, double zoom, const QSize& size)
+{
+	QMatrix4x4 matrix;
+	matrix.perspective(45.0f, static_cast<float>(size.width()) / size.height(), gl::near, gl::far);
+	matrix.translate(0.0f, 0.0f, -2.0f);
+	matrix.translate(0.0f, 0.0f, -zoom);
+	matrix.rotate(rotation);
+	matrix.translate(-center);
+	return matrix;
+}
+
+/*
+ * Replicates the zoom that zoomToFit solves for the free camera, before it is bounded.
+ */
+static double freeCameraZoom(
+	const QQuaternion& rotation,
+	const QVector3D& center,
+	const QVector<QVector3D>& corners,
+	const QSize& size
+) {
+	QMatrix4x4 rotationMatrix;
+	rotationMatrix.rotate(rotation);
+	const double focalLength = 1 / tan(qDegreesToRadians(45.0 / 2));
+	const double aspectRatio = double(size.width()) / size.height();
+	double zoom = -inf;
+
+	for (const QVector3D& corner : corners)
+	{
+		QVector3D rotated = rotationMatrix.map(corner - center);
+		double depth = rotated.z() - 2;
+		zoom = qMax(zoom, focalLength / aspectRatio * qAbs(rotated.x()) + depth);
+		zoom = qMax(zoom, focalLength * qAbs(rotated.y()) + depth);
+		zoom = qMax(zoom, gl::near + depth);
+	}
+
+	return zoom;
+}
+
+/*
+ * Checks that the free camera, zoomed to fit, shows every corner inside clip space, and that some corner reaches its
+ * border, which may also be the near plane. The border check is skipped when the zoom has to be bounded. Returns
+ * whether the case passes.
+ */
+static bool checkFreeCamera(const QQuaternion& rotation, const QVector<QVector3D>& corners, const QSize& size)
+{
+	QVector3D center = (corners.first() + corners.last()) / 2;
+	double zoom = freeCameraZoom(rotation, center, corners, size);
+	double boundedZoom = qBound(0.01, zoom, 10000.0);
+	QMatrix4x4 matrix = freeCameraMatrix(rotation, center, boundedZoom, size);
+	double reach = 0;
+	bool isInside = true;
+
+	for (const QVector3D& corner : corners)
+	{
+		QVector4D clipped = matrix * QVector4D {corner, 1};
+		QVector3D normalized = clipped.toVector3DAffine();
+		double cornerReach = qMax(qMax(qAbs(normalized.x()), qAbs(normalized.y())), -normalized.z());
+
+		if (clipped.w() <= 0 or cornerReach > 1 + 1e-3 or normalized.z() > 1 + 1e-3)
+			isInside = false;
+
+		reach = qMax(reach, cornerReach);
+	}
+
+	if (not isInside or (boundedZoom == zoom and qAbs(reach - 1) > 1e-3))
+	{
+		std::fprintf(stderr, "Free camera at (%g, %g, %g, %g) at %dx%d: corners reach %g at zoom %g%s\n",
+			rotation.scalar(), rotation.x(), rotation.y(), rotation.z(), size.width(), size.height(), reach,
+			boundedZoom, isInside ? "" : ", not all of them inside clip space");
+		return false;
+	}
+
+	return true;
+}
+
+int main()
+{
+	std::mt19937 generator {3};
+	std::uniform_real_distribution<float> offset {-500, 500};
+	std::uniform_real_distribution<float> extent {1, 200};
+	std::uniform_real_distribution<float> angle {-180, 180};
+	const QQuaternion rotations[] = {
+		{},
+		QQuaternion::fromAxisAndAngle(1, 0, 0, 90),
+		QQuaternion::fromAxisAndAngle(0, 1, 0, 45),
+		QQuaternion::fromAxisAndAngle(0, 0, 1, 180),
+		QQuaternion::fromEulerAngles(30, 45, 0),
+		QQuaternion::fromEulerAngles(-60, 135, 20),
+	};
+	int failures = 0;
+	int cases = 0;
+
+	for (int i = 0; i < 1000; i += 1)
+	{
+		QVector3D minimum {offset(generator), offset(generator), offset(generator)};
+		QVector3D maximum = minimum + QVector3D {extent(generator), extent(generator), extent(generator)};
+		QVector<QVector3D> corners;
+
+		for (int j = 0; j < 8; ++j)
+		{
+			corners.append({
+				(j & 1) ? maximum.x() : minimum.x(),
+				(j & 2) ? maximum.y() : minimum.y(),
+				(j & 4) ? maximum.z() : minimum.z()
+			});
+		}
+
+		for (const QSize& size : viewSizes)
+		for (int cameraIndex = 0; cameraIndex < 6; cameraIndex += 1)
+		{
+			GLCamera camera = makeCamera(cameraIndex);
+			camera.rendererResized(size.width(), size.height());
+			cases += 1;
+
+			// At the panning that the search ran at, the analytic zoom must be at most the searched one, and
+			// within one notch of it. The slack covers the border pixels that the search looked at.
+			const double slack = 1 + 4.0 / qMin(size.width(), size.height());
+			double searched = iterativeZoom(camera, corners, size);
+			double analytic = camera.fittingZoom(corners);
+
+			if (searched < 10000 and (analytic > searched * slack or searched * 0.833 > analytic * slack))
+			{
+				std::fprintf(stderr, "%s at %dx%d: fitting zoom %g, searched zoom %g\n",
+					qPrintable(camera.name()), size.width(), size.height(), analytic, searched);
+				failures += 1;
+			}
+
+			// Fitting to view must center the model, touch the border on one axis, and never zoom out further
+			// than leaving the panning alone would.
+			camera.fitToView(corners);
+			QRectF extents = projectedExtents(camera, corners);
+			double reach = qMax(qMax(-extents.left(), extents.right()), qMax(-extents.top(), extents.bottom()));
+
+			if (qAbs(extents.center().x()) > 1e-3
+				or qAbs(extents.center().y()) > 1e-3
+				or qAbs(reach - 1) > 1e-3
+				or camera.zoom() > analytic * (1 + 1e-4))
+			{
+				std::fprintf(stderr, "%s at %dx%d: fitted view spans (%g, %g) to (%g, %g) at zoom %g\n",
+					qPrintable(camera.name()), size.width(), size.height(), extents.left(), extents.top(),
+					extents.right(), extents.bottom(), camera.zoom());
+				failures += 1;
+			}
+		}
+
+		for (const QSize& size : viewSizes)
+		{
+			for (const QQuaternion& rotation : rotations)
+			{
+				cases += 1;
+
+				if (not checkFreeCamera(rotation, corners, size))
+					failures += 1;
+			}
+
+			float pitch = angle(generator);
+			float yaw = angle(generator);
+			float roll = angle(generator);
+			cases += 1;
+
+			if (not checkFreeCamera(QQuaternion::fromEulerAngles(pitch, yaw, roll), corners, size))
+				failures += 1;
+		}
+	}
+
+	std::printf("%d of %d cases failed\n", failures, cases);
+	return (failures == 0) ? 0 : 1;
+}
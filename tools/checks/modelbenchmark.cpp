@@ -0,0 +1,175 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Measures deep inlining of a stud-heavy part, and compares merging models by moving their objects, as Model::merge
+ * does, with merging them by cloning every object, as it used to.
+ *
+ * Usage: modelbenchmark [stud count]
+ *
+ * Exits with a non-zero status if the two ways of merging do not produce the same objects.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include "colors.h"
+#include "documentmanager.h"
+#include "lddocument.h"
+#include "linetypes/modelobject.h"
+
+/*
+ * Writes a stud of 16 segments, and a part with the given amount of them on a grid.
+ */
+static bool writeFiles(const QDir& directory, int studCount)
+{
+	QFile stud {directory.filePath("stud.dat")};
+	QFile part {directory.filePath("studs.dat")};
+
+	if (not stud.open(QIODevice::WriteOnly) or not part.open(QIODevice::WriteOnly))
+		return false;
+
+	stud.write("0 Stud\r\n0 Name: stud.dat\r\n0 BFC CERTIFY CCW\r\n");
+
+	for (int i = 0; i < 16; i += 1)
+	{
+		double angles[] = {2 * pi * i / 16, 2 * pi * (i + 1) / 16};
+		double x[] = {6 * std::cos(angles[0]), 6 * std::cos(angles[1])};
+		double z[] = {6 * std::sin(angles[0]), 6 * std::sin(angles[1])};
+		auto write = [&](const char* format, auto... arguments)
+		{
+			char line[256];
+			std::snprintf(line, sizeof line, format, arguments...);
+			stud.write(line);
+		};
+		write("4 16 %g 0 %g %g 0 %g %g -4 %g %g -4 %g\r\n", x[1], z[1], x[0], z[0], x[0], z[0], x[1], z[1]);
+		write("3 16 0 -4 0 %g -4 %g %g -4 %g\r\n", x[1], z[1], x[0], z[0]);
+		write("2 24 %g 0 %g %g 0 %g\r\n", x[0], z[0], x[1], z[1]);
+		write("2 24 %g -4 %g %g -4 %g\r\n", x[0], z[0], x[1], z[1]);
+	}
+
+	part.write("0 Stud-heavy part\r\n0 Name: studs.dat\r\n0 BFC CERTIFY CCW\r\n");
+	int columns = qMax(1, static_cast<int>(std::sqrt(studCount)));
+
+	for (int i = 0; i < studCount; i += 1)
+		part.write(QString {"1 16 %1 0 %2 1 0 0 0 1 0 0 0 1 stud.dat\r\n"}.arg(20 * (i % columns)).arg(20 * (i / columns)).toUtf8());
+
+	return true;
+}
+
+/*
+ * Merges the model the way Model::merge used to: every object is cloned into the target, and the originals are deleted.
+ */
+static void mergeByCloning(Model& target, Model& source)
+{
+	int position = target.size();
+
+	for (LDObject* object : source.objects())
+	{
+		target.insertCopy(position, object);
+		position += 1;
+	}
+
+	source.clear();
+}
+
+static QStringList codeOf(const Model& model)
+{
+	QStringList code;
+
+	for (LDObject* object : model.objects())
+		code.append(object->asText());
+
+	return code;
+}
+
+static double elapsedMilliseconds(const QElapsedTimer& timer)
+{
+	return timer.nsecsElapsed() / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication app {argc, argv};
+	LDColor::initColors();
+	int studCount = (argc > 1) ? QString {argv[1]}.toInt() : 2000;
+	QTemporaryDir directory;
+
+	if (not directory.isValid() or not writeFiles(QDir {directory.path()}, studCount))
+	{
+		std::fprintf(stderr, "could not write the test files\n");
+		return 1;
+	}
+
+	// Subfiles that are not in a library are looked up from the current directory.
+	QDir::setCurrent(directory.path());
+	DocumentManager documents;
+	LDDocument* part = documents.openDocument(QDir {directory.path()}.filePath("studs.dat"), false, true);
+
+	if (part == nullptr)
+	{
+		std::fprintf(stderr, "could not open the part\n");
+		return 1;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	Model inlined {&documents};
+	part->inlineContents(inlined, true, false);
+	std::printf("inlining %d studs deeply: %d objects in %.1f ms\n", studCount, inlined.size(), elapsedMilliseconds(timer));
+
+	// Take turns so that both ways see the same state of the allocator, and keep the best time of each.
+	Model moved {&documents};
+	Model cloned {&documents};
+	double bestMoveTime = inf;
+	double bestCloneTime = inf;
+	int objectCount = inlined.size();
+	const QStringList code = codeOf(inlined);
+	bool isSame = true;
+
+	for (int round = 0; round < 5; round += 1)
+	{
+		timer.restart();
+		moved.merge(inlined);
+		bestMoveTime = qMin(bestMoveTime, elapsedMilliseconds(timer));
+
+		timer.restart();
+		mergeByCloning(cloned, moved);
+		bestCloneTime = qMin(bestCloneTime, elapsedMilliseconds(timer));
+
+		isSame = isSame and cloned.size() == objectCount and moved.size() == 0;
+		inlined.merge(cloned);
+	}
+
+	isSame = isSame and codeOf(inlined) == code;
+
+	std::printf("merging %d objects: moving %.1f ms, cloning %.1f ms\n", objectCount, bestMoveTime, bestCloneTime);
+
+	if (not isSame)
+	{
+		std::fprintf(stderr, "merging changed the objects\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,549 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Checks the number conversion of the parser against QString::toDouble, checks the parser line by line against the
+ * QString-based parser that it replaced, and measures the throughput of the parser.
+ *
+ * Usage: parserbenchmark [directory]
+ *
+ * Without a directory, the parser is checked and measured on generated LDraw code. Otherwise every .dat file under the
+ * directory is read into memory, checked and then parsed. Exits with a non-zero status if a conversion differs from
+ * Qt's or a line is parsed differently from the old parser.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include "model.h"
+#include "parser.h"
+#include "parsertokens.h"
+#include "linetypes/circularprimitive.h"
+#include "linetypes/comment.h"
+#include "linetypes/conditionaledge.h"
+#include "linetypes/edgeline.h"
+#include "linetypes/empty.h"
+#include "linetypes/quadrilateral.h"
+#include "linetypes/triangle.h"
+
+/*
+ * Compares the conversion of the given token with that of Qt, down to the bits. Returns whether they agree.
+ */
+static bool checkToken(const QByteArray& token)
+{
+	bool ok = false;
+	bool expectedOk = false;
+	double value = parseDouble({token.constData(), token.constData() + token.size()}, &ok);
+	double expected = QString::fromUtf8(token).toDouble(&expectedOk);
+
+	if (ok != expectedOk or (ok and std::memcmp(&value, &expected, sizeof value) != 0))
+	{
+		std::fprintf(stderr, "parseDouble(\"%s\") gives %.17g (ok: %d), QString::toDouble gives %.17g (ok: %d)\n",
+			token.constData(), value, ok, expected, expectedOk);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Checks tokens of the kinds that the fast path of parseDouble handles and those that it leaves to Qt. Returns the
+ * amount of mismatches.
+ */
+static int checkNumberConversion()
+{
+	static const char* const edgeCases[] = {
+		"0", "-0", "0.0", "-0.0", "1", "-1", "0.5", "-.5", ".5", "5.", "+1", "1e5", "1E-3", "-1.5e+2", "00012.50",
+		"999999999999999", "9999999999999999", "0.000000000000001", "0.1234567890123456", "123456789012345.6",
+		"1.7976931348623157e308", "abc", "", "-", ".", "1..2", "1-2", "inf", "nan", "0x10", " 1", "1 ",
+	};
+	std::mt19937 generator {1};
+	int mismatches = 0;
+
+	for (const char* token : edgeCases)
+	{
+		if (not checkToken(token))
+			mismatches += 1;
+	}
+
+	// Random decimal numbers on both sides of the 15 digit limit of the fast path.
+	for (int i = 0; i < 1000000; i += 1)
+	{
+		int digits = 1 + generator() % 18;
+		int decimals = generator() % (digits + 1);
+		QByteArray token;
+
+		if (generator() % 2)
+			token += '-';
+
+		for (int digit = 0; digit < digits; digit += 1)
+		{
+			if (digit == digits - decimals)
+				token += '.';
+
+			token += char('0' + generator() % 10);
+		}
+
+		if (not checkToken(token))
+			mismatches += 1;
+	}
+
+	return mismatches;
+}
+
+/*
+ * The following is the QString-based line parser that Parser used before it tokenized the bytes of the file, kept
+ * here as the reference that the new parser must agree with.
+ */
+static void CheckTokenCount (const QStringList& tokens, int num)
+{
+	if (countof(tokens) != num)
+		throw QString (format ("Bad amount of tokens, expected %1, got %2", num, countof(tokens)));
+}
+
+static void CheckTokenNumbers (const QStringList& tokens, int min, int max)
+{
+	bool ok;
+	QRegExp scientificRegex ("\\-?[0-9]+\\.[0-9]+e\\-[0-9]+");
+
+	for (int i = min; i <= max; ++i)
+	{
+		// Check for floating point
+		tokens[i].toDouble (&ok);
+		if (ok)
+			return;
+
+		// Check hex
+		if (tokens[i].startsWith ("0x"))
+		{
+			tokens[i].mid (2).toInt (&ok, 16);
+
+			if (ok)
+				return;
+		}
+
+		// Check scientific notation, e.g. 7.99361e-15
+		if (scientificRegex.exactMatch (tokens[i]))
+			return;
+
+		throw QString (format ("Token #%1 was `%2`, expected a number (matched length: %3)",
+			(i + 1), tokens[i], scientificRegex.matchedLength()));
+	}
+}
+
+static Vertex parseVertex(QStringList& tokens, const int n)
+{
+	return {tokens[n].toDouble(), tokens[n + 1].toDouble(), tokens[n + 2].toDouble()};
+}
+
+static LDObject* legacyParseFromString(Model& model, int position, QString line)
+{
+	try
+	{
+		QStringList tokens = line.split(" ", QString::SkipEmptyParts);
+
+		if (tokens.isEmpty())
+		{
+			// Line was empty, or only consisted of whitespace
+			return model.emplaceAt<LDEmpty>(position);
+		}
+
+		if (countof(tokens[0]) != 1 or not tokens[0][0].isDigit())
+			throw QString ("Illogical line code");
+
+		int num = tokens[0][0].digitValue();
+
+		switch (num)
+		{
+			case 0:
+			{
+				// Comment
+				QString commentText = line.mid(line.indexOf("0") + 2);
+
+				if (countof(tokens) > 2 and tokens[1] == "!LDFORGE")
+				{
+					// Handle LDForge-specific types, they're embedded into comments too
+					if (tokens[2] == "BEZIER_CURVE")
+					{
+						CheckTokenCount (tokens, 16);
+						CheckTokenNumbers (tokens, 3, 15);
+						LDBezierCurve* obj = model.emplaceAt<LDBezierCurve>(position);
+						obj->setColor(LDColor {tokens[3].toInt(nullptr, 0)});
+
+						for (int i = 0; i < 4; ++i)
+							obj->setVertex (i, parseVertex (tokens, 4 + (i * 3)));
+
+						return obj;
+					}
+				}
+
+				// Just a regular comment:
+				return model.emplaceAt<LDComment>(position, commentText);
+			}
+
+			case 1:
+			{
+				// Subfile
+				CheckTokenCount (tokens, 15);
+				CheckTokenNumbers (tokens, 1, 13);
+
+				Vertex displacement = parseVertex (tokens, 2);  // 2 - 4
+				QMatrix4x4 matrix;
+				matrix.translate(displacement.toVector());
+				QString referenceName = tokens[14];
+
+				for (int i = 0; i < 9; ++i)
+					matrix(i / 3, i % 3) = tokens[i + 5].toDouble(); // 5 - 13
+
+				matrix.optimize();
+				static const QRegExp circularPrimitiveRegexp {
+					R"((?:(\d+)\\)?(\d+)-(\d+)(cyli|edge|disc|ndis|cylc|cylo|chrd)\.dat)"
+				};
+				LDObject* obj;
+
+				if (circularPrimitiveRegexp.exactMatch(referenceName))
+				{
+					int resolution = MediumResolution;
+
+					if (not circularPrimitiveRegexp.capturedTexts()[1].isEmpty())
+						resolution = circularPrimitiveRegexp.capturedTexts()[1].toInt();
+
+					int numerator = circularPrimitiveRegexp.capturedTexts()[2].toInt();
+					int denominator = circularPrimitiveRegexp.capturedTexts()[3].toInt();
+					QString stem = circularPrimitiveRegexp.capturedTexts()[4];
+					int segments = (numerator * resolution) / denominator;
+					PrimitiveModel::Type type = PrimitiveModel::Cylinder;
+
+					if (stem == "edge")
+						type = PrimitiveModel::Circle;
+					else if (stem == "disc")
+						type = PrimitiveModel::Disc;
+					else if (stem == "ndis")
+						type = PrimitiveModel::DiscNegative;
+					else if (stem == "cylc")
+						type = PrimitiveModel::CylinderClosed;
+					else if (stem == "cylo")
+						type = PrimitiveModel::CylinderOpen;
+					else if (stem == "chrd")
+						type = PrimitiveModel::Chord;
+
+					obj = model.emplaceAt<LDCircularPrimitive>(
+						position,
+						type,
+						segments,
+						resolution,
+						matrix
+					);
+				}
+				else
+				{
+					obj = model.emplaceAt<LDSubfileReference>(position, referenceName, matrix);
+				}
+
+				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+				return obj;
+			}
+
+			case 2:
+			{
+				CheckTokenCount (tokens, 8);
+				CheckTokenNumbers (tokens, 1, 7);
+
+				// Line
+				LDEdgeLine* obj = model.emplaceAt<LDEdgeLine>(position);
+				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+
+				for (int i = 0; i < 2; ++i)
+					obj->setVertex (i, parseVertex (tokens, 2 + (i * 3)));   // 2 - 7
+
+				return obj;
+			}
+
+			case 3:
+			{
+				CheckTokenCount (tokens, 11);
+				CheckTokenNumbers (tokens, 1, 10);
+
+				// Triangle
+				LDTriangle* obj = model.emplaceAt<LDTriangle>(position);
+				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+
+				for (int i = 0; i < 3; ++i)
+					obj->setVertex (i, parseVertex (tokens, 2 + (i * 3)));   // 2 - 10
+
+				return obj;
+			}
+
+			case 4:
+			case 5:
+			{
+				CheckTokenCount (tokens, 14);
+				CheckTokenNumbers (tokens, 1, 13);
+
+				// Quadrilateral / Conditional line
+				LDObject* obj;
+
+				if (num == 4)
+					obj = model.emplaceAt<LDQuadrilateral>(position);
+				else
+					obj = model.emplaceAt<LDConditionalEdge>(position);
+
+				obj->setColor(LDColor {tokens[1].toInt(nullptr, 0)});
+
+				for (int i = 0; i < 4; ++i)
+					obj->setVertex (i, parseVertex (tokens, 2 + (i * 3)));   // 2 - 13
+
+				return obj;
+			}
+
+			default:
+				throw QString {"Unknown line code number"};
+		}
+	}
+	catch (QString& errorMessage)
+	{
+		// Strange line we couldn't parse
+		return model.emplaceAt<LDError>(position, line, errorMessage);
+	}
+}
+
+/*
+ * Parses every line of the given code like the old parser did: each line is decoded and trimmed through QString.
+ */
+static void legacyParseBody(const QByteArray& contents, Model& model)
+{
+	QByteArray copy = contents;
+	QBuffer buffer {&copy};
+	buffer.open(QIODevice::ReadOnly);
+	bool invertNext = false;
+
+	while (not buffer.atEnd())
+	{
+		QString line = QString::fromUtf8(buffer.readLine()).trimmed();
+
+		if (line == "0 BFC INVERTNEXT" or line == "0 BFC CERTIFY INVERTNEXT")
+		{
+			invertNext = true;
+			continue;
+		}
+
+		LDObject* object = legacyParseFromString(model, model.size(), line);
+
+		if (invertNext and object->isRasterizable())
+			object->setInverted(true);
+
+		invertNext = false;
+	}
+}
+
+/*
+ * Returns the error reason of the object, or an empty string if it was parsed without an error.
+ */
+static QString errorReason(LDObject* object)
+{
+	if (object->type() == LDObjectType::Error)
+		return static_cast<LDError*>(object)->reason();
+	else
+		return {};
+}
+
+/*
+ * Parses the given code with both the old and the new parser, and compares the results line by line. The header is
+ * not parsed, so that every line goes through the body parsers. Returns the amount of lines parsed differently.
+ */
+static int checkAgainstLegacyParser(const QByteArray& contents, const QString& fileName)
+{
+	QByteArray copy = contents;
+	QBuffer buffer {&copy};
+	buffer.open(QIODevice::ReadOnly);
+	Parser parser {buffer};
+	Model model {nullptr};
+	Model legacyModel {nullptr};
+	parser.parseBody(model);
+	legacyParseBody(contents, legacyModel);
+	int mismatches = 0;
+
+	if (model.size() != legacyModel.size())
+	{
+		std::fprintf(stderr, "%s: %d objects, the old parser gives %d\n", qPrintable(fileName), model.size(),
+			legacyModel.size());
+		return 1;
+	}
+
+	for (int i = 0; i < model.size(); i += 1)
+	{
+		LDObject* object = model.getObject(i);
+		LDObject* legacyObject = legacyModel.getObject(i);
+
+		if (object->asText() != legacyObject->asText()
+			or errorReason(object) != errorReason(legacyObject)
+			or object->isInverted() != legacyObject->isInverted())
+		{
+			std::fprintf(stderr, "%s: object %d is \"%s\" (%s), the old parser gives \"%s\" (%s)\n",
+				qPrintable(fileName), i + 1,
+				qPrintable(object->asText()), qPrintable(errorReason(object)),
+				qPrintable(legacyObject->asText()), qPrintable(errorReason(legacyObject)));
+			mismatches += 1;
+		}
+	}
+
+	return mismatches;
+}
+
+/*
+ * Generates LDraw code of every line type with coordinates like those of real parts.
+ */
+static QByteArray generateCode(int lineCount)
+{
+	std::mt19937 generator {2};
+	QByteArray code = "0 Generated part\r\n0 Name: generated.dat\r\n0 BFC CERTIFY CCW\r\n";
+
+	auto coordinate = [&]()
+	{
+		return QByteArray::number((int(generator() % 200001) - 100000) / 1000.0, 'g', 8);
+	};
+
+	for (int i = 0; i < lineCount; i += 1)
+	{
+		int type = 1 + generator() % 5;
+		int vertexCount = (type == 1) ? 1 : (type == 2) ? 2 : (type == 3) ? 3 : 4;
+		code += QByteArray::number(type) + ' ' + ((type == 2 or type == 5) ? "24" : "16");
+
+		for (int j = 0; j < 3 * vertexCount; j += 1)
+			code += ' ' + coordinate();
+
+		if (type == 1)
+			code += " 1 0 0 0 1 0 0 0 1 stud.dat";
+
+		code += "\r\n";
+	}
+
+	return code;
+}
+
+/*
+ * Returns LDraw code with the lines that the two parsers are most likely to treat differently: unusual whitespace,
+ * non-ASCII text, unusual numbers and every kind of malformed line.
+ */
+static QByteArray edgeCaseCode()
+{
+	static const char* const lines[] = {
+		"", "   ", "\t", "\r", "0", "0 ", "0  spaced  comment  ", "\t0 tabbed comment\t", "0\tnot a comment",
+		"0 Gr\xc3\xb6\xc3\x9f" "e", "0 \xe2\x80\x83wide space", "\xc2\xa0" "0 non-breaking space\xc2\xa0",
+		"0 broken \xff\xfe utf-8", "\xe3\x80\x80" "2 24 0 0 0 1 1 1",
+		"0 BFC INVERTNEXT", "1 16 0 0 0 1 0 0 0 1 0 0 0 1 stud.dat", "0 BFC CERTIFY INVERTNEXT",
+		"3 16 0 0 0 1 0 0 0 1 0", "0 BFC INVERTNEXT", "0 BFC INVERTNEXT", "4 16 0 0 0 1 0 0 1 1 0 0 1 0",
+		"1 16 0 0 0 1 0 0 0 1 0 0 0 1 4-4cyli.dat", "1 16 0 0 0 1 0 0 0 1 0 0 0 1 48\\1-4edge.dat",
+		"1 16 0 0 0 1 0 0 0 1 0 0 0 1 3-16disc.dat", "1 16 0 0 0 1 0 0 0 1 0 0 0 1 1-4CYLI.DAT",
+		"1 16 0 0 0 1 0 0 0 1 0 0 0 1 1-4chrd.dat", "1 16 0 0 0 1 0 0 0 1 0 0 0 1 x-4cyli.dat",
+		"1 16 0 0 0 1 0 0 0 1 0 0 0 1 sub\xc3\xa4.dat", "1 16 0 0 0 1 0 0 0 1 0 0 0 1 two words.dat",
+		"2 0x2FF0000 0 0 0 1 1 1", "2 0x2ff0000 -.5 5. +1 1e5 1E-3 -1.5e+2", "2 24 7.99361e-15 0 0 1 1 1",
+		"2 24 00012.50 0 0 999999999999999 9999999999999999 0.1234567890123456",
+		"2\t24 0 0 0 1 1 1", "2 24  0   0 0 1 1 1", "2 24 0 0 0 1 1", "2 24 0 0 0 1 1 1 1", "2 24 a 0 0 1 1 1",
+		"2 24 0 0 0 1 1 x", "2 24 inf 0 0 1 1 1", "2 24 nan 0 0 1 1 1", "2 24 0x 0 0 1 1 1", "2 x 0 0 0 1 1 1",
+		"3 16 0 0 0 1 0 0 0 1", "5 24 0 0 0 1 1 1 0 1 0 1 0 0", "5 24 0 0 0 1 1 1 0 1 0 1 0 0 0",
+		"0 !LDFORGE BEZIER_CURVE 24 0 0 0 1 0 0 1 1 0 0 1 0", "0 !LDFORGE BEZIER_CURVE 24 0 0 0",
+		"0 !LDFORGE BEZIER_CURVE x 0 0 0 1 0 0 1 1 0 0 1 0", "0 !LDFORGE OTHER", "6 16 0 0 0", "10 16 0 0 0",
+		"x", "-1 16", "\xd9\xa3 16 0 0 0", "1", "2", "3", "4", "5",
+	};
+	QByteArray code;
+
+	for (const char* line : lines)
+		code += QByteArray {line} + "\r\n";
+
+	// Without a newline at the end.
+	code += "2 24 0 0 0 1 1 1";
+	return code;
+}
+
+/*
+ * Parses the given files from memory. Returns the amount of objects parsed.
+ */
+static qint64 parseAll(const QVector<QByteArray>& files)
+{
+	qint64 objectCount = 0;
+
+	for (QByteArray contents : files)
+	{
+		QBuffer buffer {&contents};
+		buffer.open(QIODevice::ReadOnly);
+		Parser parser {buffer};
+		Model model {nullptr};
+		Winding winding = NoWinding;
+		parser.parseHeader(winding);
+		parser.parseBody(model);
+		objectCount += model.size();
+	}
+
+	return objectCount;
+}
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication app {argc, argv};
+	int mismatches = checkNumberConversion();
+	std::printf("number conversion: %d mismatches\n", mismatches);
+	QVector<QByteArray> files;
+	QStringList fileNames;
+	qint64 byteCount = 0;
+
+	if (argc > 1)
+	{
+		QDirIterator iterator {QString::fromLocal8Bit(argv[1]), {"*.dat"}, QDir::Files, QDirIterator::Subdirectories};
+
+		while (iterator.hasNext())
+		{
+			QFile file {iterator.next()};
+
+			if (file.open(QIODevice::ReadOnly))
+			{
+				files.append(file.readAll());
+				fileNames.append(file.fileName());
+			}
+		}
+	}
+	else
+	{
+		files.append(generateCode(200000));
+		fileNames.append("generated");
+	}
+
+	int lineMismatches = checkAgainstLegacyParser(edgeCaseCode(), "edge cases");
+
+	for (int i = 0; i < files.size(); i += 1)
+	{
+		lineMismatches += checkAgainstLegacyParser(files[i], fileNames[i]);
+		byteCount += files[i].size();
+	}
+
+	std::printf("lines parsed differently from the old parser: %d\n", lineMismatches);
+
+	QElapsedTimer timer;
+	timer.start();
+	qint64 objectCount = parseAll(files);
+	double seconds = qMax(timer.nsecsElapsed() / 1e9, 1e-9);
+	std::printf("parsed %d files, %lld objects, %.1f MB in %.3f s: %.0f objects/s, %.1f MB/s\n",
+		files.size(), objectCount, byteCount / 1e6, seconds, objectCount / seconds, byteCount / 1e6 / seconds);
+	return (mismatches == 0 and lineMismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+/*
+ *  LDForge: LDraw parts authoring CAD
+ *  Copyright (C) 2013 - 2018 Teemu Piippo
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Checks that the coordinate tools find every object with a matching vertex through the vertex index, even when the
+ * index has merged that vertex into a point stored for another object up to the tolerance away.
+ *
+ * The queries and the tests of the vertices are those of AlgorithmToolset::replaceCoordinates and
+ * AlgorithmToolset::fixRoundingErrors.
+ */
+
+#include <cstdio>
+#include "generics/functions.h"
+#include "linetypes/edgeline.h"
+#include "vertexindex.h"
+
+/*
+ * Returns the objects that replaceCoordinates looks at for the given value on the given axis.
+ */
+static QSet<LDObject*> replacementCandidates(const VertexIndex& index, Axis axis, double needle)
+{
+	Vertex minimum {-inf, -inf, -inf};
+	Vertex maximum {inf, inf, inf};
+	minimum[axis] = needle - 1e-6 - index.tolerance();
+	maximum[axis] = needle + 1e-6 + index.tolerance();
+	return index.objectsInBox(minimum, maximum);
+}
+
+/*
+ * Replaces the value on the given axis in the vertices of the candidates, as replaceCoordinates does. Returns the
+ * amount of values replaced.
+ */
+static int replaceCoordinates(const QSet<LDObject*>& candidates, Axis axis, double needle, double replacement)
+{
+	int count = 0;
+
+	for (LDObject* object : candidates)
+	{
+		for (int i = 0; i < object->numVertices(); ++i)
+		{
+			Vertex vertex = object->vertex(i);
+
+			if (isZero(vertex[axis] - needle))
+			{
+				vertex.setCoordinate(axis, replacement);
+				object->setVertex(i, vertex);
+				count += 1;
+			}
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Returns the objects that fixRoundingErrors looks at for the given reference point and threshold along the X axis.
+ */
+static QSet<LDObject*> roundingCandidates(const VertexIndex& index, const Vertex& referencePoint, double threshold)
+{
+	Vertex minimum {-inf, -inf, -inf};
+	Vertex maximum {inf, inf, inf};
+	minimum[X] = referencePoint[X] - threshold - index.tolerance();
+	maximum[X] = referencePoint[X] + threshold + index.tolerance();
+	return index.objectsInBox(minimum, maximum);
+}
+
+static void insertObject(VertexIndex& index, LDObject* object)
+{
+	QSet<Vertex> vertices;
+
+	for (int i = 0; i < object->numVertices(); ++i)
+		vertices.insert(object->vertex(i));
+
+	index.insert(object, vertices);
+}
+
+int main()
+{
+	int failures = 0;
+	auto check = [&](bool condition, const char* description)
+	{
+		if (not condition)
+		{
+			std::fprintf(stderr, "failed: %s\n", description);
+			failures += 1;
+		}
+	};
+
+	// The first vertex of the second line is stored second and closer than the tolerance to the first vertex of the
+	// first line, so the index merges it into that point.
+	const double needle = 5e-5;
+	LDEdgeLine first {{0, 0, 0}, {10, 0, 0}};
+	LDEdgeLine second {{needle, 0, 0}, {20, 5, 0}};
+	VertexIndex index;
+	insertObject(index, &first);
+	insertObject(index, &second);
+	check(index.size() == 3, "the vertices closer than the tolerance are merged");
+	check(index.tolerance() > needle, "the vertices are closer than the tolerance");
+
+	QSet<LDObject*> candidates = replacementCandidates(index, X, needle);
+	check(candidates.contains(&second), "replacing finds the vertex that was stored second");
+	check(replaceCoordinates(candidates, X, needle, 1) == 1, "replacing changes exactly one value");
+	check(second.vertex(0) == Vertex {1, 0, 0}, "replacing changes the vertex that was stored second");
+	check(first.vertex(0) == Vertex {0, 0, 0}, "replacing leaves the vertex that was stored first alone");
+
+	// The same for the rounding error fixer, with a threshold smaller than the distance between the vertices.
+	LDEdgeLine third {{0, 0, 0}, {10, 0, 0}};
+	LDEdgeLine fourth {{needle, 0, 0}, {20, 5, 0}};
+	VertexIndex roundingIndex;
+	insertObject(roundingIndex, &third);
+	insertObject(roundingIndex, &fourth);
+	check(roundingCandidates(roundingIndex, {needle, 0, 0}, 1e-6).contains(&fourth),
+		"fixing rounding errors finds the vertex that was stored second");
+
+	std::printf("%d checks failed\n", failures);
+	return (failures == 0) ? 0 : 1;
+}